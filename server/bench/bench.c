@@ -0,0 +1,24 @@
+/*
+ * bench.c - Support code linked into every benchmark
+ */
+
+#include "bench.h"
+#include "config.h"
+
+#include <time.h>
+
+// The server's runtime configuration (main.c is not linked in)
+int MAX_ROOMS = 5;
+int MAX_PLAYERS = 10;
+int SERVER_THREADS = 1;
+int PIN_THREADS = 0;
+int USE_IO_URING = 0;
+int SEND_HIGH_WATER = 64 * 1024;
+unsigned long long DICE_SEED = 0;
+
+double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
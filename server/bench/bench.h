@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Shared by the benchmarks (bench.c is linked into every one). It also defines the
+ * server's runtime configuration (config.h) with main.c's defaults, as main.c is never
+ * linked in; a benchmark sets what it needs at the start of main(), before any server
+ * code runs.
+ */
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+double now_ns(void);
+
+#endif // BENCH_H
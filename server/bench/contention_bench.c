@@ -0,0 +1,122 @@
+/*
+ * contention_bench.c - JOIN_ROOM/LEAVE_ROOM lock contention benchmark
+ *
+ * Runs 1, 2, 4, ... threads (up to the number of CPUs, at least 8), each one
+ * a client that keeps joining and leaving rooms through join_room() and
+ * leave_room() in src/lobby.c, room updates included. Threads never share a
+ * room, so any slowdown with more threads is contention on lobby-wide state.
+ * The baseline runs the same calls under one global mutex, which is how the
+ * single lobby_mutex serialized them before.
+ *
+ * The clients' sockets are not real, sending to them fails right away.
+ *
+ * Usage: contention_bench [iterations per thread]
+ */
+
+#include "bench.h"
+#include "lobby.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+	pthread_t thread;
+	int index;
+	int threads;
+	long iterations;
+	int global_lock;
+	long joined; // successful JOIN_ROOM + LEAVE_ROOM pairs
+} client_t;
+
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* client_main(void* arg)
+{
+	client_t* client = arg;
+	// Far above any real descriptor
+	player_t* player = add_player(1000000 + client->index, 0);
+	if (!player)
+	{
+		return NULL;
+	}
+
+	// This client's rooms are the ones with id % threads == index
+	const int own_rooms = MAX_ROOMS / client->threads;
+	unsigned int seed = 2463534242u + (unsigned int)client->index;
+	int host_shard;
+	for (long n = 0; n < client->iterations; ++n)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		const int room_id = (int)(seed % (unsigned int)own_rooms) * client->threads + client->index;
+
+		if (client->global_lock) pthread_mutex_lock(&global_mutex);
+		const int joined = join_room(room_id, player, &host_shard) == 0;
+		if (client->global_lock) pthread_mutex_unlock(&global_mutex);
+
+		if (client->global_lock) pthread_mutex_lock(&global_mutex);
+		const int left = joined && leave_room(player) == 0;
+		if (client->global_lock) pthread_mutex_unlock(&global_mutex);
+
+		client->joined += left;
+	}
+
+	remove_player(player);
+	return NULL;
+}
+
+/*
+ * Runs the clients, returns JOIN_ROOM + LEAVE_ROOM pairs per second.
+ */
+static double run(client_t* clients, const int threads, const long iterations, const int global_lock)
+{
+	const double start = now_ns();
+	for (int i = 0; i < threads; ++i)
+	{
+		clients[i] = (client_t){ .index = i, .threads = threads, .iterations = iterations, .global_lock = global_lock };
+		pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+	}
+	long pairs = 0;
+	for (int i = 0; i < threads; ++i)
+	{
+		pthread_join(clients[i].thread, NULL);
+		pairs += clients[i].joined;
+	}
+	if (pairs != (long)threads * iterations)
+	{
+		fprintf(stderr, "%ld of %ld joins/leaves failed\n", (long)threads * iterations - pairs, (long)threads * iterations);
+	}
+	return (double)pairs / ((now_ns() - start) / 1e9);
+}
+
+int main(const int argc, char* argv[])
+{
+	MAX_ROOMS = 1024;
+	MAX_PLAYERS = 64;
+	const long iterations = argc > 1 ? atol(argv[1]) : 100000;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 8) cpus = 8;
+	if (cpus > MAX_PLAYERS) cpus = MAX_PLAYERS;
+
+	init_lobby();
+	client_t* clients = calloc((size_t)cpus, sizeof(client_t));
+
+	printf("%d rooms, %ld join/leave pairs per thread\n", MAX_ROOMS, iterations);
+	for (int threads = 1; threads <= cpus; threads *= 2)
+	{
+		const double baseline = run(clients, threads, iterations, 1);
+		const double current = run(clients, threads, iterations, 0);
+		printf(
+			"%2d threads: one lobby lock %9.0f pairs/s, per-room locks %9.0f pairs/s (%.1fx)\n",
+			threads, baseline, current, current / baseline
+		);
+	}
+
+	free(clients);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*
+ * engine_bench.c - Pig engine benchmark
+ *
+ * Plays whole games, both players holding at HOLD_AT points a turn:
+ *
+ *  - previous: handle_roll()/handle_hold() as they were before the engine,
+ *    mutating an int game_state and logging every move (the logger has no
+ *    files open here, so this is only the formatting; the server also writes
+ *    every line out), kept here as the baseline
+ *  - engine: pig_step() on a pig_state_t, the same dice, no side effects
+ *
+ * Reports ns per move and games per second, and checks both end the same.
+ *
+ * Usage: engine_bench [games]
+ */
+
+#include "bench.h"
+#include "game.h"
+#include "logger.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOLD_AT 20
+
+// The previous rules
+typedef struct
+{
+	int scores[2];
+	int current_player;
+	int turn_score;
+	int roll_result;
+	int game_over;
+	int game_winner;
+} baseline_game_t;
+
+static void baseline_switch_player(baseline_game_t* game)
+{
+	game->current_player = 1 - game->current_player;
+	LOG(LOG_GAME, "Switching turn to player %d.", game->current_player);
+}
+
+static void baseline_roll(baseline_game_t* game, const int roll)
+{
+	game->roll_result = roll;
+	LOG(LOG_GAME, "Player %d rolled a %d.", game->current_player, roll);
+	if (roll == 1)
+	{
+		game->turn_score = 0;
+		baseline_switch_player(game);
+	}
+	else
+	{
+		game->turn_score += roll;
+		if (game->scores[game->current_player] + game->turn_score >= WINNING_SCORE)
+		{
+			game->game_over = 1;
+			game->game_winner = game->current_player;
+		}
+	}
+}
+
+static void baseline_hold(baseline_game_t* game)
+{
+	game->scores[game->current_player] += game->turn_score;
+	LOG(
+		LOG_GAME, "Player %d holds. Score for turn: %d. New total: %d.", game->current_player, game->turn_score,
+		game->scores[game->current_player]
+	);
+	game->turn_score = 0;
+	game->roll_result = 0;
+	baseline_switch_player(game);
+}
+
+int main(const int argc, char* argv[])
+{
+	const long count = argc > 1 ? atol(argv[1]) : 100000;
+	if (count < 1)
+	{
+		fprintf(stderr, "usage: engine_bench [games >= 1]\n");
+		return EXIT_FAILURE;
+	}
+
+	rng_t rng;
+	long moves = 0;
+	long wins[2] = {0};
+	rng_seed(&rng, 1, 0);
+	double start = now_ns();
+	for (long g = 0; g < count; ++g)
+	{
+		baseline_game_t game = { .current_player = (int)rng_below(&rng, 2), .game_winner = -1 };
+		while (!game.game_over)
+		{
+			if (game.turn_score < HOLD_AT)
+			{
+				baseline_roll(&game, rng_roll(&rng));
+			}
+			else
+			{
+				baseline_hold(&game);
+			}
+			moves++;
+		}
+		wins[game.game_winner]++;
+	}
+	const double baseline_ns = now_ns() - start;
+	const long baseline_moves = moves;
+	const long baseline_wins = wins[0];
+
+	moves = 0;
+	wins[0] = wins[1] = 0;
+	rng_seed(&rng, 1, 0);
+	start = now_ns();
+	for (long g = 0; g < count; ++g)
+	{
+		pig_state_t game = pig_new_game((int)rng_below(&rng, 2));
+		pig_events_t events;
+		while (game.status == GAME_RUNNING)
+		{
+			const int player = game.current_player;
+			if (game.turn_score < HOLD_AT)
+			{
+				game = pig_step(game, player, PIG_ROLL, rng_roll(&rng), &events);
+			}
+			else
+			{
+				game = pig_step(game, player, PIG_HOLD, 0, &events);
+			}
+			moves++;
+		}
+		wins[game.winner]++;
+	}
+	const double engine_ns = now_ns() - start;
+
+	if (moves != baseline_moves || wins[0] != baseline_wins)
+	{
+		fprintf(stderr, "the engines disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	printf(
+		"%ld games, %ld moves, holding at %d:\n"
+		"previous: %7.2f ns/move, %10.0f games/s\n"
+		"engine:   %7.2f ns/move, %10.0f games/s (%.1fx)\n",
+		count, moves, HOLD_AT,
+		baseline_ns / moves, count / baseline_ns * 1e9,
+		engine_ns / moves, count / engine_ns * 1e9, baseline_ns / engine_ns
+	);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * game_bench.c - Game store benchmark: per-field arrays vs. games in rooms
+ *
+ * Fills a number of rooms, two thirds of them with a game under way, and
+ * sweeps them all for game_stats() (running games, points banked, games
+ * decided):
+ *
+ *  - rooms: the previous layout, the game (ints and the dice) embedded in
+ *    the second cache line of a two-line room, the room state in the first;
+ *    kept here as the baseline
+ *  - store: game_stats() over the game store of src/game.c
+ *
+ * Reports the bytes each layout spends per game and ns per game swept.
+ *
+ * Usage: game_bench [rooms] [rounds]
+ */
+
+#include "bench.h"
+#include "game.h"
+#include "lobby.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The previous layout
+typedef struct
+{
+	int player_fds[2];
+	int scores[2];
+	int current_player;
+	int turn_score;
+	int roll_result;
+	int game_over;
+	int game_winner;
+	rng_t rng;
+} baseline_game_t;
+
+typedef struct
+{
+	_Alignas(CACHE_LINE) pthread_mutex_t mutex;
+	int id;
+	room_state state;
+	int player_count;
+	int shard;
+	int idle_player_idx;
+	unsigned games;
+
+	_Alignas(CACHE_LINE) player_t* players[MAX_PLAYERS_PER_ROOM];
+	baseline_game_t game;
+} baseline_room_t;
+
+static void baseline_stats(game_stats_t* stats, const baseline_room_t* rooms, const int count)
+{
+	int running = 0;
+	int decided = 0;
+	long points = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const baseline_room_t* room = &rooms[i];
+		if (room->state == IN_PROGRESS || room->state == PAUSED)
+		{
+			running++;
+			points += room->game.scores[0] + room->game.scores[1];
+		}
+		else if (room->game.game_over && room->game.game_winner >= 0)
+		{
+			decided++;
+		}
+	}
+	stats->running = running;
+	stats->decided = decided;
+	stats->points = points;
+}
+
+int main(const int argc, char* argv[])
+{
+	const int count = argc > 1 ? atoi(argv[1]) : 1000000;
+	const int rounds = argc > 2 ? atoi(argv[2]) : 50;
+	if (count < 1 || rounds < 1)
+	{
+		fprintf(stderr, "usage: game_bench [rooms >= 1] [rounds >= 1]\n");
+		return EXIT_FAILURE;
+	}
+
+	baseline_room_t* rooms = aligned_alloc(CACHE_LINE, sizeof(baseline_room_t) * count);
+	if (!rooms || init_games(count) != 0)
+	{
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	rng_t rng;
+	rng_seed(&rng, 1, 0);
+	for (int i = 0; i < count; ++i)
+	{
+		const int running = i % 3 != 0;
+		const int decided = !running && rng_below(&rng, 4) == 0;
+		const int score0 = (int)rng_below(&rng, WINNING_SCORE);
+		const int score1 = (int)rng_below(&rng, WINNING_SCORE);
+
+		baseline_room_t* room = &rooms[i];
+		room->id = i;
+		room->state = running ? (rng_below(&rng, 10) ? IN_PROGRESS : PAUSED) : WAITING;
+		room->game.scores[0] = score0;
+		room->game.scores[1] = score1;
+		room->game.game_over = decided;
+		room->game.game_winner = decided ? 0 : -1;
+
+		games.status[i] = running ? GAME_RUNNING : decided ? GAME_OVER : GAME_NONE;
+		games.scores[0][i] = (uint8_t)score0;
+		games.scores[1][i] = (uint8_t)score1;
+		games.winner[i] = (int8_t)(decided ? 0 : -1);
+	}
+
+	game_stats_t baseline;
+	double start = now_ns();
+	for (int r = 0; r < rounds; ++r)
+	{
+		baseline_stats(&baseline, rooms, count);
+	}
+	const double baseline_ns = (now_ns() - start) / rounds / count;
+
+	game_stats_t store;
+	start = now_ns();
+	for (int r = 0; r < rounds; ++r)
+	{
+		game_stats(&store, count);
+	}
+	const double store_ns = (now_ns() - start) / rounds / count;
+
+	if (baseline.running != store.running || baseline.points != store.points || baseline.decided != store.decided)
+	{
+		fprintf(stderr, "the layouts disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	const size_t store_bytes = sizeof(rng_t) + 6 * sizeof(uint8_t) + sizeof(int8_t);
+	printf(
+		"%d rooms, %d games running, %ld points banked, %d decided:\n"
+		"rooms: %3zu bytes per game (in a %zu-byte room), %6.3f ns per game swept\n"
+		"store: %3zu bytes per game, %6.3f ns per game swept (%.1fx)\n",
+		count, store.running, store.points, store.decided,
+		sizeof(baseline_game_t), sizeof(baseline_room_t), baseline_ns,
+		store_bytes, store_ns, baseline_ns / store_ns
+	);
+
+	free(rooms);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,349 @@
+/*
+ * layout_bench.c - player_t/room_t memory layout benchmark
+ *
+ * Compares the cache-line layout of player_t and room_t in include/lobby.h
+ * with the previous one (fields in declaration order, rooms packed back to
+ * back in a malloc'd array), which is kept here as the baseline:
+ *
+ *  - scan: the idle timeout check server_on_tick() used to run over every player
+ *  - broadcast: every room rendered under its lock with its players'
+ *    sockets looked up, the work behind a full LIST_ROOMS or lobby update
+ *  - lock: threads taking the locks of neighbouring rooms, where rooms
+ *    sharing a cache line slow each other down (needs more than one CPU)
+ *
+ * Both layouts hold the same data, except for the game, which the baseline
+ * room embeds and room_t leaves to the game store (include/game.h).
+ *
+ * Usage: layout_bench [players] [rounds]
+ */
+
+#include "bench.h"
+#include "lobby.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The previous layouts
+typedef struct
+{
+	int socket;
+	char nickname[NICKNAME_LEN];
+	player_state state;
+	int room_id;
+	time_t disconnected_timestamp;
+	time_t last_activity;
+	session_state session;
+	int watched;
+	int shard;
+	int feed_shard;
+	int feed_index;
+} baseline_player_t;
+
+typedef struct
+{
+	int player_fds[2];
+	int scores[2];
+	int current_player;
+	int turn_score;
+	int roll_result;
+	int game_over;
+	int game_winner;
+	unsigned int rand_seed;
+} baseline_game_t;
+
+typedef struct
+{
+	int id;
+	room_state state;
+	baseline_player_t* players[MAX_PLAYERS_PER_ROOM];
+	int player_count;
+	int shard;
+	baseline_game_t game;
+	time_t pause_start;
+	int idle_player_idx;
+	pthread_mutex_t mutex;
+} baseline_room_t;
+
+#define SHARDS 4
+#define LOCK_ITERATIONS 2000000
+
+static void fill(player_t* players, room_t* rooms, const int player_count, const time_t now)
+{
+	for (int i = 0; i < player_count / 2; ++i)
+	{
+		const int in_game = i % 3 != 0;
+		rooms[i].id = i;
+		rooms[i].state = in_game ? IN_PROGRESS : WAITING;
+		rooms[i].player_count = in_game ? 2 : 0;
+		rooms[i].shard = i % SHARDS;
+		rooms[i].players[0] = in_game ? &players[2 * i] : NULL;
+		rooms[i].players[1] = in_game ? &players[2 * i + 1] : NULL;
+		pthread_mutex_init(&rooms[i].mutex, NULL);
+	}
+	for (int i = 0; i < player_count; ++i)
+	{
+		const int in_game = (i / 2) % 3 != 0;
+		players[i].socket = 1000 + i;
+		snprintf(players[i].nickname, NICKNAME_LEN, "player%d", i);
+		players[i].state = in_game ? IN_GAME : LOBBY;
+		players[i].room_id = in_game ? i / 2 : -1;
+		players[i].last_activity = now - i % (2 * IDLE_TIMEOUT);
+		players[i].session = SESSION_ACTIVE;
+		players[i].watched = 1;
+		players[i].shard = (i / 2) % SHARDS;
+	}
+}
+
+static void copy_to_baseline(
+	const player_t* players, const room_t* rooms, baseline_player_t* baseline_players,
+	baseline_room_t* baseline_rooms, const int player_count
+)
+{
+	for (int i = 0; i < player_count / 2; ++i)
+	{
+		baseline_rooms[i].id = rooms[i].id;
+		baseline_rooms[i].state = rooms[i].state;
+		baseline_rooms[i].player_count = rooms[i].player_count;
+		baseline_rooms[i].shard = rooms[i].shard;
+		for (int j = 0; j < MAX_PLAYERS_PER_ROOM; ++j)
+		{
+			baseline_rooms[i].players[j] = rooms[i].players[j] ? &baseline_players[rooms[i].players[j] - players] : NULL;
+		}
+		pthread_mutex_init(&baseline_rooms[i].mutex, NULL);
+	}
+	for (int i = 0; i < player_count; ++i)
+	{
+		baseline_players[i].socket = players[i].socket;
+		memcpy(baseline_players[i].nickname, players[i].nickname, NICKNAME_LEN);
+		baseline_players[i].state = players[i].state;
+		baseline_players[i].room_id = players[i].room_id;
+		baseline_players[i].last_activity = players[i].last_activity;
+		baseline_players[i].session = players[i].session;
+		baseline_players[i].watched = players[i].watched;
+		baseline_players[i].shard = players[i].shard;
+	}
+}
+
+/*
+ * The old server_on_tick() idle check for every shard (a running game stands in for
+ * get_running_room()). Returns the players it would drop.
+ */
+static long scan(const player_t* players, const int player_count, const time_t now)
+{
+	long idle = 0;
+	for (int shard = 0; shard < SHARDS; ++shard)
+	{
+		for (int i = 0; i < player_count; ++i)
+		{
+			const player_t* player = &players[i];
+			if (
+				player->shard != shard ||
+				!player->watched ||
+				player->socket == -1 ||
+				(player->session == SESSION_ACTIVE && player->state == IN_GAME && player->room_id >= 0) ||
+				now - player->last_activity <= IDLE_TIMEOUT
+			)
+			{
+				continue;
+			}
+			idle++;
+		}
+	}
+	return idle;
+}
+
+static long baseline_scan(const baseline_player_t* players, const int player_count, const time_t now)
+{
+	long idle = 0;
+	for (int shard = 0; shard < SHARDS; ++shard)
+	{
+		for (int i = 0; i < player_count; ++i)
+		{
+			const baseline_player_t* player = &players[i];
+			if (
+				player->shard != shard ||
+				!player->watched ||
+				player->socket == -1 ||
+				(player->session == SESSION_ACTIVE && player->state == IN_GAME && player->room_id >= 0) ||
+				now - player->last_activity <= IDLE_TIMEOUT
+			)
+			{
+				continue;
+			}
+			idle++;
+		}
+	}
+	return idle;
+}
+
+/*
+ * Every room read under its lock, with its players' sockets. Returns a checksum.
+ */
+static long broadcast(room_t* rooms, const int room_count)
+{
+	long sum = 0;
+	for (int i = 0; i < room_count; ++i)
+	{
+		room_t* room = &rooms[i];
+		pthread_mutex_lock(&room->mutex);
+		sum += room->id + room->state + room->player_count;
+		for (int j = 0; j < room->player_count; ++j)
+		{
+			sum += room->players[j]->socket;
+		}
+		pthread_mutex_unlock(&room->mutex);
+	}
+	return sum;
+}
+
+static long baseline_broadcast(baseline_room_t* rooms, const int room_count)
+{
+	long sum = 0;
+	for (int i = 0; i < room_count; ++i)
+	{
+		baseline_room_t* room = &rooms[i];
+		pthread_mutex_lock(&room->mutex);
+		sum += room->id + room->state + room->player_count;
+		for (int j = 0; j < room->player_count; ++j)
+		{
+			sum += room->players[j]->socket;
+		}
+		pthread_mutex_unlock(&room->mutex);
+	}
+	return sum;
+}
+
+typedef struct
+{
+	pthread_t thread;
+	pthread_mutex_t* mutex; // the room's lock
+	int* state;             // and its state, written under it
+} locker_t;
+
+static void* locker_main(void* arg)
+{
+	locker_t* locker = arg;
+	for (int n = 0; n < LOCK_ITERATIONS; ++n)
+	{
+		pthread_mutex_lock(locker->mutex);
+		*locker->state ^= 1;
+		pthread_mutex_unlock(locker->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * One thread per room, rooms 0..threads-1 (neighbours). Returns lock round trips per second.
+ */
+static double run_lockers(locker_t* lockers, const int threads)
+{
+	const double start = now_ns();
+	for (int i = 0; i < threads; ++i)
+	{
+		pthread_create(&lockers[i].thread, NULL, locker_main, &lockers[i]);
+	}
+	for (int i = 0; i < threads; ++i)
+	{
+		pthread_join(lockers[i].thread, NULL);
+	}
+	return (double)threads * LOCK_ITERATIONS / ((now_ns() - start) / 1e9);
+}
+
+int main(const int argc, char* argv[])
+{
+	const int player_count = argc > 1 ? atoi(argv[1]) : 1000000;
+	const int rounds = argc > 2 ? atoi(argv[2]) : 10;
+	const int room_count = player_count / 2;
+	if (player_count < 2 || rounds < 1)
+	{
+		fprintf(stderr, "usage: layout_bench [players >= 2] [rounds >= 1]\n");
+		return EXIT_FAILURE;
+	}
+
+	const time_t now = time(NULL);
+	baseline_player_t* baseline_players = malloc(sizeof(baseline_player_t) * player_count);
+	baseline_room_t* baseline_rooms = malloc(sizeof(baseline_room_t) * room_count);
+	player_t* players = aligned_alloc(CACHE_LINE, sizeof(player_t) * player_count);
+	room_t* rooms = aligned_alloc(CACHE_LINE, sizeof(room_t) * room_count);
+	fill(players, rooms, player_count, now);
+	copy_to_baseline(players, rooms, baseline_players, baseline_rooms, player_count);
+
+	printf(
+		"%d players (%zu -> %zu bytes), %d rooms (%zu -> %zu bytes), %d rounds\n",
+		player_count, sizeof(baseline_player_t), sizeof(player_t),
+		room_count, sizeof(baseline_room_t), sizeof(room_t), rounds
+	);
+
+	double baseline_ns = 0;
+	double current_ns = 0;
+	long checks = 0;
+	for (int r = 0; r < rounds; ++r)
+	{
+		double start = now_ns();
+		checks += baseline_scan(baseline_players, player_count, now);
+		baseline_ns += now_ns() - start;
+		start = now_ns();
+		checks -= scan(players, player_count, now);
+		current_ns += now_ns() - start;
+	}
+	printf(
+		"scan:      previous %6.2f ns/player, cache-line layout %6.2f ns/player (%.2fx)\n",
+		baseline_ns / rounds / player_count, current_ns / rounds / player_count, baseline_ns / current_ns
+	);
+
+	baseline_ns = current_ns = 0;
+	for (int r = 0; r < rounds; ++r)
+	{
+		double start = now_ns();
+		checks += baseline_broadcast(baseline_rooms, room_count);
+		baseline_ns += now_ns() - start;
+		start = now_ns();
+		checks -= broadcast(rooms, room_count);
+		current_ns += now_ns() - start;
+	}
+	printf(
+		"broadcast: previous %6.2f ns/room,   cache-line layout %6.2f ns/room   (%.2fx)\n",
+		baseline_ns / rounds / room_count, current_ns / rounds / room_count, baseline_ns / current_ns
+	);
+	if (checks != 0)
+	{
+		fprintf(stderr, "the layouts disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 2) cpus = 2;
+	if (cpus > room_count) cpus = room_count;
+	locker_t* lockers = calloc((size_t)cpus, sizeof(locker_t));
+	for (int threads = 2; threads <= cpus; threads *= 2)
+	{
+		for (int i = 0; i < threads; ++i)
+		{
+			lockers[i].mutex = &baseline_rooms[i].mutex;
+			lockers[i].state = (int*)&baseline_rooms[i].state;
+		}
+		const double baseline = run_lockers(lockers, threads);
+		for (int i = 0; i < threads; ++i)
+		{
+			lockers[i].mutex = &rooms[i].mutex;
+			lockers[i].state = (int*)&rooms[i].state;
+		}
+		const double current = run_lockers(lockers, threads);
+		printf(
+			"lock:      %2d threads on neighbouring rooms: previous %10.0f locks/s, cache-line layout %10.0f locks/s (%.2fx)\n",
+			threads, baseline, current, current / baseline
+		);
+	}
+
+	free(lockers);
+	free(rooms);
+	free(players);
+	free(baseline_rooms);
+	free(baseline_players);
+	return EXIT_SUCCESS;
+}
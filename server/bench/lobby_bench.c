@@ -0,0 +1,151 @@
+/*
+ * lobby_bench.c - Player slot allocation benchmark
+ *
+ * Fills the player table to 10%, 50% and 99% occupancy and then churns it:
+ * a random connected player leaves and a new connection takes a slot, as
+ * server_on_accept() does. Reports ns per accept (with its disconnect) for
+ * add_player()/remove_player() in src/lobby.c and for the linear scan they
+ * replaced, which is kept here as the baseline. The baseline runs on its own
+ * copy of the table. Both include the LOG calls of a real accept, which are
+ * formatted even though no log file is open.
+ *
+ * Usage: lobby_bench [max_players] [iterations]
+ */
+
+#include "bench.h"
+#include "lobby.h"
+#include "config.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Baseline: the previous add_player()/remove_player() (first free slot from index 0)
+
+static player_t* baseline_players;
+static int baseline_count = 0;
+static pthread_mutex_t baseline_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static player_t* baseline_add_player(const int socket, const int shard)
+{
+	pthread_mutex_lock(&baseline_mutex);
+	if (baseline_count >= MAX_PLAYERS)
+	{
+		pthread_mutex_unlock(&baseline_mutex);
+		return NULL;
+	}
+	for (int i = 0; i < MAX_PLAYERS; ++i)
+	{
+		if (baseline_players[i].socket == -1 && baseline_players[i].state == LOBBY)
+		{
+			baseline_players[i].socket = socket;
+			baseline_players[i].state = LOBBY;
+			baseline_players[i].nickname[0] = '\0';
+			baseline_players[i].room_id = -1;
+			baseline_players[i].last_activity = time(NULL);
+			baseline_players[i].session = SESSION_LOGIN;
+			baseline_players[i].watched = 0;
+			baseline_players[i].shard = shard;
+			baseline_count++;
+			LOG(LOG_LOBBY, "Player slot %d assigned to socket %d. Total players: %d", i, socket, baseline_count);
+			pthread_mutex_unlock(&baseline_mutex);
+			return &baseline_players[i];
+		}
+	}
+	pthread_mutex_unlock(&baseline_mutex);
+	return NULL;
+}
+
+static void baseline_remove_player(player_t* player)
+{
+	pthread_mutex_lock(&baseline_mutex);
+	if (player && player->socket != -1)
+	{
+		LOG(LOG_LOBBY, "Removing player %s (socket %d)", player->nickname, player->socket);
+		player->socket = -1;
+		player->state = LOBBY;
+		player->room_id = -1;
+		baseline_count--;
+	}
+	pthread_mutex_unlock(&baseline_mutex);
+}
+
+// xorshift32, the same sequence for both variants
+static unsigned int next_random(unsigned int* state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+typedef player_t* (*add_fn)(int socket, int shard);
+typedef void (*remove_fn)(player_t* player);
+
+/*
+ * Fills the table to the given number of players, churns it and empties it again.
+ * Returns ns per accept.
+ */
+static double run(const add_fn add, const remove_fn remove, player_t** held, const int occupied, const long iterations)
+{
+	for (int i = 0; i < occupied; ++i)
+	{
+		held[i] = add(1000 + i, 0);
+	}
+
+	unsigned int seed = 2463534242u;
+	const double start = now_ns();
+	for (long n = 0; n < iterations; ++n)
+	{
+		const int victim = (int)(next_random(&seed) % (unsigned int)occupied);
+		remove(held[victim]);
+		held[victim] = add(1000 + victim, 0);
+	}
+	const double ns = (now_ns() - start) / (double)iterations;
+
+	for (int i = 0; i < occupied; ++i)
+	{
+		remove(held[i]);
+	}
+	return ns;
+}
+
+int main(const int argc, char* argv[])
+{
+	MAX_ROOMS = 1;
+	MAX_PLAYERS = argc > 1 ? atoi(argv[1]) : 50000;
+	const long iterations = argc > 2 ? atol(argv[2]) : 200000;
+	if (MAX_PLAYERS < 100)
+	{
+		fprintf(stderr, "max_players must be at least 100\n");
+		return EXIT_FAILURE;
+	}
+
+	init_lobby();
+	baseline_players = aligned_alloc(CACHE_LINE, sizeof(player_t) * MAX_PLAYERS);
+	player_t** held = malloc(sizeof(player_t*) * MAX_PLAYERS);
+	for (int i = 0; i < MAX_PLAYERS; ++i)
+	{
+		baseline_players[i].socket = -1;
+		baseline_players[i].state = LOBBY;
+	}
+
+	printf("%d player slots, %ld accepts per run\n", MAX_PLAYERS, iterations);
+	static const int occupancies[] = { 10, 50, 99 };
+	for (size_t i = 0; i < sizeof(occupancies) / sizeof(occupancies[0]); ++i)
+	{
+		const int occupied = (int)((long)MAX_PLAYERS * occupancies[i] / 100);
+		const double baseline_ns = run(baseline_add_player, baseline_remove_player, held, occupied, iterations);
+		const double current_ns = run(add_player, remove_player, held, occupied, iterations);
+		printf(
+			"%2d%% occupied: linear scan %8.1f ns/accept, free list %6.1f ns/accept (%.1fx)\n",
+			occupancies[i], baseline_ns, current_ns, baseline_ns / current_ns
+		);
+	}
+
+	free(held);
+	free(baseline_players);
+	return EXIT_SUCCESS;
+}
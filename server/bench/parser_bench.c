@@ -0,0 +1,166 @@
+/*
+ * parser_bench.c - Command parser microbenchmark
+ *
+ * Parses a mix of typical client commands (in-game traffic, lobby commands)
+ * and looks up their arguments, reporting ns/command for the parser in
+ * src/parser.c and for the strtok_r based parser it replaced, which is kept
+ * here as the baseline. Both get a fresh copy of the line every time since
+ * they tokenize in place.
+ *
+ * Usage: parser_bench [iterations]
+ */
+
+#include "bench.h"
+#include "parser.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* commands[] = {
+	"PING",
+	"ROLL",
+	"HOLD",
+	"GAME_STATE_REQUEST",
+	"ROLL",
+	"PING",
+	"LIST_ROOMS",
+	"JOIN_ROOM|room:3",
+	"LOGIN|nick:alice",
+	"LEAVE_ROOM",
+};
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+// Baseline: the previous parser (two nested strtok_r passes, strcmp chains)
+
+typedef struct
+{
+	client_command_t type;
+	command_arg args[MAX_ARGS];
+	int arg_count;
+} baseline_command_t;
+
+static client_command_t baseline_command_type(const char* verb)
+{
+	if (strcmp(verb, C_LOGIN) == 0) return CMD_LOGIN;
+	if (strcmp(verb, C_RESUME) == 0) return CMD_RESUME;
+	if (strcmp(verb, C_LIST_ROOMS) == 0) return CMD_LIST_ROOMS;
+	if (strcmp(verb, C_JOIN_ROOM) == 0) return CMD_JOIN_ROOM;
+	if (strcmp(verb, C_LEAVE_ROOM) == 0) return CMD_LEAVE_ROOM;
+	if (strcmp(verb, C_ROLL) == 0) return CMD_ROLL;
+	if (strcmp(verb, C_HOLD) == 0) return CMD_HOLD;
+	if (strcmp(verb, C_GAME_STATE_REQUEST) == 0) return CMD_GAME_STATE_REQUEST;
+	if (strcmp(verb, C_QUIT) == 0) return CMD_QUIT;
+	if (strcmp(verb, C_EXIT) == 0) return CMD_EXIT;
+	if (strcmp(verb, C_PING) == 0) return CMD_PING;
+	return CMD_UNKNOWN;
+}
+
+static int baseline_parse(char* buffer, baseline_command_t* out_cmd)
+{
+	out_cmd->type = CMD_UNKNOWN;
+	out_cmd->arg_count = 0;
+
+	char* ptr_1;
+	char* ptr_2;
+	const char* verb = strtok_r(buffer, "|", &ptr_1);
+	if (verb == NULL)
+	{
+		return -1;
+	}
+	out_cmd->type = baseline_command_type(verb);
+
+	char* token;
+	while ((token = strtok_r(NULL, "|", &ptr_1)) != NULL)
+	{
+		if (out_cmd->arg_count >= MAX_ARGS)
+		{
+			return -1;
+		}
+		char* key = strtok_r(token, ":", &ptr_2);
+		if (key == NULL)
+		{
+			return -1;
+		}
+		char* value = strtok_r(NULL, ":", &ptr_2);
+		if (value == NULL)
+		{
+			return -1;
+		}
+		out_cmd->args[out_cmd->arg_count].key = key;
+		out_cmd->args[out_cmd->arg_count].value = value;
+		out_cmd->arg_count++;
+	}
+	return 0;
+}
+
+static const char* baseline_arg(const baseline_command_t* cmd, const char* key)
+{
+	for (int i = 0; i < cmd->arg_count; ++i)
+	{
+		if (strcmp(cmd->args[i].key, key) == 0)
+		{
+			return cmd->args[i].value;
+		}
+	}
+	return NULL;
+}
+
+int main(const int argc, char* argv[])
+{
+	const long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+	size_t lengths[NUM_COMMANDS];
+	for (size_t i = 0; i < NUM_COMMANDS; ++i)
+	{
+		lengths[i] = strlen(commands[i]) + 1;
+	}
+
+	char line[MSG_MAX_LEN];
+	unsigned long checksum = 0;
+
+	// Baseline
+	double start = now_ns();
+	for (long n = 0; n < iterations; ++n)
+	{
+		const size_t i = (size_t)n % NUM_COMMANDS;
+		memcpy(line, commands[i], lengths[i]);
+		baseline_command_t cmd;
+		if (baseline_parse(line, &cmd) == 0)
+		{
+			checksum += cmd.type;
+			checksum += baseline_arg(&cmd, K_ROOM) != NULL;
+			checksum += baseline_arg(&cmd, K_NICK) != NULL;
+		}
+	}
+	const double baseline_ns = (now_ns() - start) / (double)iterations;
+
+	// Current
+	unsigned long current_checksum = 0;
+	start = now_ns();
+	for (long n = 0; n < iterations; ++n)
+	{
+		const size_t i = (size_t)n % NUM_COMMANDS;
+		memcpy(line, commands[i], lengths[i]);
+		parsed_command_t cmd;
+		if (parse_command(line, &cmd) == 0)
+		{
+			current_checksum += cmd.type;
+			current_checksum += get_command_arg(&cmd, KEY_ROOM) != NULL;
+			current_checksum += get_command_arg(&cmd, KEY_NICK) != NULL;
+		}
+	}
+	const double current_ns = (now_ns() - start) / (double)iterations;
+
+	if (checksum != current_checksum)
+	{
+		fprintf(stderr, "Parsers disagree (checksum %lu vs %lu)\n", checksum, current_checksum);
+		return EXIT_FAILURE;
+	}
+
+	printf("%ld commands\n", iterations);
+	printf("strtok_r parser: %6.1f ns/command\n", baseline_ns);
+	printf("current parser:  %6.1f ns/command (%.1fx)\n", current_ns, baseline_ns / current_ns);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+/*
+ * pig_sim.c - Headless Pig simulator
+ *
+ * Plays games between two strategies through the engine of src/game.c
+ * (pig_step(), the rules the server plays by), spread over worker threads
+ * that each get their own dice from the master seed (rng_split()), so a
+ * seed and a thread count reproduce a run exactly. The first player is
+ * drawn for every game, like in the server.
+ *
+ * Strategies:
+ *  - hold:N   roll until the turn is worth N points, then hold
+ *  - random   roll or hold with equal odds once the turn is worth anything
+ *  - optimal  the policy maximizing the chance to win, found by value
+ *             iteration over (own score, opponent's score, turn points)
+ *             before the games start (Neller & Presser, "Optimal Play of
+ *             the Dice Game Pig")
+ *
+ * Reports games/s and ns per move (an engine regression benchmark), the
+ * rolls per face with their chi-square, the win rates of both strategies
+ * and how often the first player wins, each with a 95% interval.
+ *
+ * Usage: pig-sim [-g games] [-t threads] [-s seed] [-a strategy] [-b strategy]
+ */
+
+#include "bench.h"
+#include "game.h"
+#include "rng.h"
+#include "config.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROLL_BATCH 4096
+
+typedef enum
+{
+	HOLD_AT,
+	RANDOM,
+	OPTIMAL
+} strategy_kind;
+
+typedef struct
+{
+	strategy_kind kind;
+	int hold_at;
+	char name[16];
+} strategy_t;
+
+// Per worker: its share of the games, its dice and what it counted. Workers don't share
+// cache lines, the counters are written every move.
+typedef struct
+{
+	_Alignas(CACHE_LINE) pthread_t thread;
+	long long games;
+	rng_t rng;
+	long long moves;
+	long long faces[7];
+	long long wins[2];        // by strategy (-a, -b)
+	long long first_wins;     // games the first player won
+} worker_t;
+
+static strategy_t strategies[2];
+
+// Optimal policy: roll[i][j][k] with own score i, opponent's score j, turn points k (i + k < WINNING_SCORE)
+static uint8_t optimal_roll[WINNING_SCORE][WINNING_SCORE][WINNING_SCORE];
+
+static int parse_strategy(strategy_t* strategy, const char* spec)
+{
+	if (strncmp(spec, "hold:", 5) == 0)
+	{
+		strategy->kind = HOLD_AT;
+		strategy->hold_at = atoi(spec + 5);
+		if (strategy->hold_at < 1)
+		{
+			return -1;
+		}
+	}
+	else if (strcmp(spec, "random") == 0)
+	{
+		strategy->kind = RANDOM;
+	}
+	else if (strcmp(spec, "optimal") == 0)
+	{
+		strategy->kind = OPTIMAL;
+	}
+	else
+	{
+		return -1;
+	}
+	snprintf(strategy->name, sizeof(strategy->name), "%s", spec);
+	return 0;
+}
+
+/*
+ * Chance to win for the player about to decide, from the table of those chances.
+ * A turn worth reaching WINNING_SCORE has won already.
+ */
+static double chance(double (*win)[WINNING_SCORE][WINNING_SCORE], const int i, const int j, const int k)
+{
+	return i + k >= WINNING_SCORE ? 1.0 : win[i][j][k];
+}
+
+/*
+ * Value iteration until no chance moves by more than 1e-12, then the decision that
+ * maximizes each one. Ties roll.
+ */
+static void solve_optimal(void)
+{
+	double (*win)[WINNING_SCORE][WINNING_SCORE] = calloc(WINNING_SCORE, sizeof(*win));
+	double change;
+	do
+	{
+		change = 0;
+		for (int i = WINNING_SCORE - 1; i >= 0; --i)
+		{
+			for (int j = WINNING_SCORE - 1; j >= 0; --j)
+			{
+				for (int k = WINNING_SCORE - 1 - i; k >= 0; --k)
+				{
+					// Rolling a 1 hands the opponent the turn with our score unchanged
+					double roll = (1.0 - win[j][i][0]) / 6;
+					for (int face = 2; face <= 6; ++face)
+					{
+						roll += chance(win, i, j, k + face) / 6;
+					}
+					const double hold = 1.0 - chance(win, j, i + k, 0);
+					const double best = roll >= hold ? roll : hold;
+					change = fmax(change, fabs(best - win[i][j][k]));
+					win[i][j][k] = best;
+					optimal_roll[i][j][k] = roll >= hold;
+				}
+			}
+		}
+	}
+	while (change > 1e-12);
+	printf("optimal: the first player wins %.4f of the games\n", win[0][0][0]);
+	free(win);
+}
+
+static int wants_roll(const strategy_t* strategy, const pig_state_t* game, const int player, rng_t* rng)
+{
+	switch (strategy->kind)
+	{
+		case HOLD_AT:
+			return game->turn_score < strategy->hold_at;
+		case RANDOM:
+			return game->turn_score == 0 || (rng_next(rng) & 1);
+		case OPTIMAL:
+			return optimal_roll[game->scores[player]][game->scores[1 - player]][game->turn_score];
+	}
+	return 1;
+}
+
+static void* run_worker(void* arg)
+{
+	worker_t* worker = arg;
+	uint8_t rolls[ROLL_BATCH];
+	int next_roll = ROLL_BATCH;
+
+	for (long long g = 0; g < worker->games; ++g)
+	{
+		// Seat 0 plays strategy -a, seat 1 strategy -b; who starts is drawn
+		const int first = (int)(rng_next(&worker->rng) & 1);
+		pig_state_t game = pig_new_game(first);
+		pig_events_t events;
+		while (game.status == GAME_RUNNING)
+		{
+			const int player = game.current_player;
+			if (wants_roll(&strategies[player], &game, player, &worker->rng))
+			{
+				if (next_roll == ROLL_BATCH)
+				{
+					rng_rolls(&worker->rng, rolls, ROLL_BATCH);
+					next_roll = 0;
+				}
+				const int roll = rolls[next_roll++];
+				worker->faces[roll]++;
+				game = pig_step(game, player, PIG_ROLL, roll, &events);
+			}
+			else
+			{
+				game = pig_step(game, player, PIG_HOLD, 0, &events);
+			}
+			worker->moves++;
+		}
+		worker->wins[game.winner]++;
+		worker->first_wins += game.winner == first;
+	}
+	return NULL;
+}
+
+static void report_rate(const char* label, const long long hits, const long long total)
+{
+	const double p = (double)hits / total;
+	printf("%-28s %7.4f +- %.4f\n", label, p, 1.96 * sqrt(p * (1 - p) / total));
+}
+
+int main(const int argc, char* argv[])
+{
+	long long total = 10000000;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long seed = 0;
+	int seeded = 0;
+	const char* specs[2] = { "hold:20", "hold:20" };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:t:s:a:b:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'g':
+				total = atoll(optarg);
+				break;
+			case 't':
+				threads = atol(optarg);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 0);
+				seeded = 1;
+				break;
+			case 'a':
+				specs[0] = optarg;
+				break;
+			case 'b':
+				specs[1] = optarg;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-g games] [-t threads] [-s seed] [-a strategy] [-b strategy]\n", argv[0]);
+				fprintf(stderr, "Strategies: hold:N, random, optimal (default hold:20)\n");
+				return EXIT_FAILURE;
+		}
+	}
+	if (total < 1 || threads < 1 || parse_strategy(&strategies[0], specs[0]) != 0 || parse_strategy(&strategies[1], specs[1]) != 0)
+	{
+		fprintf(stderr, "Usage: %s [-g games >= 1] [-t threads >= 1] [-s seed] [-a strategy] [-b strategy]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!seeded)
+	{
+		seed = rng_mix((unsigned long long)time(NULL) << 20 ^ (unsigned long long)getpid());
+	}
+	if (strategies[0].kind == OPTIMAL || strategies[1].kind == OPTIMAL)
+	{
+		solve_optimal();
+	}
+
+	rng_t master;
+	rng_seed(&master, seed, 0);
+	worker_t* workers = aligned_alloc(CACHE_LINE, sizeof(worker_t) * threads);
+	memset(workers, 0, sizeof(worker_t) * threads);
+	for (long t = 0; t < threads; ++t)
+	{
+		workers[t].games = total / threads + (t < total % threads);
+		rng_split(&master, &workers[t].rng, (uint64_t)t);
+	}
+
+	const double start = now_ns();
+	for (long t = 0; t < threads; ++t)
+	{
+		pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+	}
+	worker_t sum = {0};
+	for (long t = 0; t < threads; ++t)
+	{
+		pthread_join(workers[t].thread, NULL);
+		sum.moves += workers[t].moves;
+		sum.wins[0] += workers[t].wins[0];
+		sum.wins[1] += workers[t].wins[1];
+		sum.first_wins += workers[t].first_wins;
+		for (int f = 1; f <= 6; ++f)
+		{
+			sum.faces[f] += workers[t].faces[f];
+		}
+	}
+	const double elapsed = now_ns() - start;
+
+	long long rolls = 0;
+	for (int f = 1; f <= 6; ++f)
+	{
+		rolls += sum.faces[f];
+	}
+	double chi = 0;
+	printf("%lld games, %s vs %s, to %d points, %ld threads, seed %llu\n", total, strategies[0].name, strategies[1].name, WINNING_SCORE, threads, seed);
+	printf("%.0f games/s, %.2f ns/move, %.1f moves/game\n", total / elapsed * 1e9, elapsed / sum.moves, (double)sum.moves / total);
+	printf("rolls:");
+	for (int f = 1; f <= 6; ++f)
+	{
+		const double d = (double)sum.faces[f] - (double)rolls / 6;
+		chi += d * d / ((double)rolls / 6);
+		printf(" %d: %.4f", f, (double)sum.faces[f] / rolls);
+	}
+	printf(" (chi-square %.2f, 5 degrees of freedom)\n", chi);
+
+	char label[48];
+	snprintf(label, sizeof(label), "-a %s wins", strategies[0].name);
+	report_rate(label, sum.wins[0], total);
+	snprintf(label, sizeof(label), "-b %s wins", strategies[1].name);
+	report_rate(label, sum.wins[1], total);
+	report_rate("the first player wins", sum.first_wins, total);
+
+	free(workers);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,323 @@
+/*
+ * quick_match_bench.c - QUICK_MATCH with more players than rooms
+ *
+ * Runs the server (reactor, lobby, real sockets on the loopback) in this
+ * process with one room by default, so every room is busy most of the time,
+ * and has clients play quick matches over and over:
+ *
+ *  - a client sends QUICK_MATCH and waits for the OK with its room
+ *  - of the pair, the one whose turn it is quits, which ends the game and
+ *    empties the room
+ *  - both go again once they got the game's result
+ *
+ * The clients are spread over the shards by the kernel, so waiting players
+ * are also brought together across shards. Every QUICK_MATCH must end in a
+ * game and be answered once while waiting (moving to another shard included)
+ * and once with the room; a client that gets anything else, an ERROR or
+ * nothing for 10 s fails the run.
+ * Reports matches/s.
+ *
+ * Usage: quick_match_bench [-u] [-r rooms] [-t shards] [-c clients] [-n matches] [-p port]
+ */
+
+#include "bench.h"
+#include "lobby.h"
+#include "scan.h"
+#include "server.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char QUEUED[] = "OK|cmd:QUICK_MATCH";
+static const char MATCHED[] = "OK|cmd:QUICK_MATCH|room:";
+
+typedef struct
+{
+	pthread_t thread;
+	int index;
+	int fd;
+	char buf[4096];   // received, not yet returned by read_line()
+	size_t start;
+	size_t end;
+	long rounds;      // QUICK_MATCHes that ended in a finished game
+	int failed;
+} client_t;
+
+static int port = 5601;
+static long target = 2000;
+static long matches = 0;   // games ended so far, counted by the player who quits
+static int stopping = 0;   // target reached, the clients still waiting are cut off
+static int active = 0;     // client threads still running
+
+static void* server_main(void* arg)
+{
+	(void)arg;
+	run_server(port, "127.0.0.1");
+	fprintf(stderr, "the server stopped\n");
+	exit(EXIT_FAILURE);
+}
+
+static int connect_client(void)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	// The server may not be listening yet
+	for (int attempt = 0; attempt < 200; ++attempt)
+	{
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+		{
+			const struct timeval timeout = { .tv_sec = 10 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	return -1;
+}
+
+static int send_all(const int fd, const char* text)
+{
+	const size_t len = strlen(text);
+	return send(fd, text, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Reads the next line, without its newline.
+ * @return 0, -1 if the connection failed or timed out.
+ */
+static int read_line(client_t* client, char* line, const size_t size)
+{
+	for (;;)
+	{
+		char* newline = memchr(client->buf + client->start, '\n', client->end - client->start);
+		if (newline)
+		{
+			size_t len = (size_t)(newline - (client->buf + client->start));
+			if (len >= size)
+			{
+				len = size - 1;
+			}
+			memcpy(line, client->buf + client->start, len);
+			line[len] = '\0';
+			client->start = (size_t)(newline - client->buf) + 1;
+			return 0;
+		}
+		memmove(client->buf, client->buf + client->start, client->end - client->start);
+		client->end -= client->start;
+		client->start = 0;
+		if (client->end == sizeof(client->buf))
+		{
+			return -1;
+		}
+		const ssize_t got = recv(client->fd, client->buf + client->end, sizeof(client->buf) - client->end, 0);
+		if (got <= 0)
+		{
+			return -1;
+		}
+		client->end += (size_t)got;
+	}
+}
+
+/*
+ * Reads lines until one starting with prefix (or an ERROR) comes in.
+ * @return 0 if it did, -1 on an ERROR or a failed connection.
+ */
+static int read_until(client_t* client, const char* prefix, char* line, const size_t size)
+{
+	const size_t prefix_len = strlen(prefix);
+	do
+	{
+		if (read_line(client, line, size) != 0 || strncmp(line, "ERROR", 5) == 0)
+		{
+			return -1;
+		}
+	} while (strncmp(line, prefix, prefix_len) != 0);
+	return 0;
+}
+
+// One QUICK_MATCH up to the end of its game
+static int play_round(client_t* client)
+{
+	char line[256];
+	int waiting = 0;
+	if (send_all(client->fd, "QUICK_MATCH\n") != 0)
+	{
+		return -1;
+	}
+	do
+	{
+		if (read_until(client, QUEUED, line, sizeof(line)) != 0)
+		{
+			return -1;
+		}
+		if (strcmp(line, QUEUED) == 0 && ++waiting > 1)
+		{
+			fprintf(stderr, "client %d: QUICK_MATCH answered twice while waiting\n", client->index);
+			client->failed = 1;
+			return -1;
+		}
+	} while (strncmp(line, MATCHED, sizeof(MATCHED) - 1) != 0);
+	if (read_until(client, "GAME_START|", line, sizeof(line)) != 0)
+	{
+		return -1;
+	}
+	if (strstr(line, "your_turn:1"))
+	{
+		if (send_all(client->fd, "QUIT\n") != 0)
+		{
+			return -1;
+		}
+		__atomic_add_fetch(&matches, 1, __ATOMIC_RELAXED);
+	}
+	// The game's result
+	do
+	{
+		if (read_until(client, "GAME_", line, sizeof(line)) != 0)
+		{
+			return -1;
+		}
+	} while (strncmp(line, "GAME_WIN", 8) != 0 && strncmp(line, "GAME_LOSE", 9) != 0);
+	return 0;
+}
+
+static void* client_main(void* arg)
+{
+	client_t* client = arg;
+	char login[64];
+	char line[256];
+	snprintf(login, sizeof(login), "LOGIN|nick:match%d\n", client->index);
+	if (send_all(client->fd, login) != 0 || read_until(client, "OK|cmd:LOGIN", line, sizeof(line)) != 0)
+	{
+		client->failed = 1;
+	}
+	while (!client->failed && __atomic_load_n(&matches, __ATOMIC_RELAXED) < target)
+	{
+		if (play_round(client) != 0)
+		{
+			// Cut off while waiting for a partner once the target is reached, a failure otherwise
+			client->failed |= !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+			break;
+		}
+		client->rounds++;
+	}
+	__atomic_sub_fetch(&active, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int main(const int argc, char* argv[])
+{
+	int clients = 4;
+	int opt;
+	MAX_ROOMS = 1;
+	MAX_PLAYERS = 64;
+	SERVER_THREADS = 2;
+	DICE_SEED = 1;
+
+	while ((opt = getopt(argc, argv, "ur:t:c:n:p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'u':
+				USE_IO_URING = 1;
+				break;
+			case 'r':
+				MAX_ROOMS = atoi(optarg);
+				break;
+			case 't':
+				SERVER_THREADS = atoi(optarg);
+				break;
+			case 'c':
+				clients = atoi(optarg);
+				break;
+			case 'n':
+				target = atol(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-u] [-r rooms] [-t shards] [-c clients] [-n matches] [-p port]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (MAX_ROOMS < 1 || SERVER_THREADS < 1 || clients < 2 || clients > MAX_PLAYERS || target < 1)
+	{
+		fprintf(
+			stderr, "Usage: %s [-u] [-r rooms >= 1] [-t shards >= 1] [-c clients 2-%d] [-n matches >= 1] [-p port]\n",
+			argv[0], MAX_PLAYERS
+		);
+		return EXIT_FAILURE;
+	}
+
+	init_lobby();
+	scan_init();
+	pthread_t server;
+	pthread_create(&server, NULL, server_main, NULL);
+
+	client_t* all = calloc(clients, sizeof(client_t));
+	for (int i = 0; i < clients; ++i)
+	{
+		all[i].index = i;
+		all[i].fd = connect_client();
+		if (all[i].fd < 0)
+		{
+			fprintf(stderr, "cannot connect to the server\n");
+			return EXIT_FAILURE;
+		}
+	}
+	active = clients;
+	const double start = now_ns();
+	for (int i = 0; i < clients; ++i)
+	{
+		pthread_create(&all[i].thread, NULL, client_main, &all[i]);
+	}
+	while (__atomic_load_n(&matches, __ATOMIC_RELAXED) < target && __atomic_load_n(&active, __ATOMIC_ACQUIRE) > 0)
+	{
+		usleep(1000);
+	}
+	const double elapsed = now_ns() - start;
+
+	// Whoever is still waiting for a partner now waits for nobody
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	for (int i = 0; i < clients; ++i)
+	{
+		shutdown(all[i].fd, SHUT_RDWR);
+	}
+	long rounds = 0;
+	int failed = 0;
+	for (int i = 0; i < clients; ++i)
+	{
+		pthread_join(all[i].thread, NULL);
+		close(all[i].fd);
+		rounds += all[i].rounds;
+		failed += all[i].failed;
+	}
+
+	const long done = __atomic_load_n(&matches, __ATOMIC_RELAXED);
+	printf(
+		"%d room(s), %d shard(s), %d clients, %s:\n"
+		"%ld/%ld matches, %.0f matches/s (%ld rounds played)\n",
+		MAX_ROOMS, SERVER_THREADS, clients, USE_IO_URING ? "io_uring" : "epoll",
+		done, target, done / elapsed * 1e9, rounds
+	);
+	free(all);
+	if (failed || done < target)
+	{
+		fprintf(stderr, "%d client(s) failed or timed out\n", failed);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+/*
+ * rng_bench.c - Dice roll benchmark
+ *
+ * Rolls a die with the previous rand_r() % 6 (kept here as the baseline),
+ * with rng_roll() and with batches from rng_rolls(), and reports ns per roll
+ * and how far each face's count is off the expected count (chi-square, 5
+ * degrees of freedom: about 11 or more is suspicious at 5%).
+ *
+ * Usage: rng_bench [rolls]
+ */
+
+#define _DEFAULT_SOURCE // rand_r
+
+#include "bench.h"
+#include "rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH 4096
+
+static double chi_square(const long* faces, const long rolls)
+{
+	const double expected = (double)rolls / 6;
+	double chi = 0;
+	for (int f = 1; f <= 6; ++f)
+	{
+		const double d = (double)faces[f] - expected;
+		chi += d * d / expected;
+	}
+	return chi;
+}
+
+static void report(const char* name, const double ns, const long* faces, const long rolls)
+{
+	printf("%-22s %6.2f ns/roll, chi-square %8.2f\n", name, ns / rolls, chi_square(faces, rolls));
+}
+
+int main(const int argc, char* argv[])
+{
+	const long rolls = argc > 1 ? atol(argv[1]) : 200000000;
+	if (rolls < BATCH)
+	{
+		fprintf(stderr, "usage: rng_bench [rolls >= %d]\n", BATCH);
+		return EXIT_FAILURE;
+	}
+
+	long faces[7] = {0};
+	unsigned int seed = 42;
+	double start = now_ns();
+	for (long i = 0; i < rolls; ++i)
+	{
+		faces[rand_r(&seed) % 6 + 1]++;
+	}
+	report("rand_r() % 6", now_ns() - start, faces, rolls);
+
+	long pcg_faces[7] = {0};
+	rng_t rng;
+	rng_seed(&rng, 42, 0);
+	start = now_ns();
+	for (long i = 0; i < rolls; ++i)
+	{
+		pcg_faces[rng_roll(&rng)]++;
+	}
+	report("rng_roll()", now_ns() - start, pcg_faces, rolls);
+
+	long batch_faces[7] = {0};
+	uint8_t batch[BATCH];
+	start = now_ns();
+	for (long done = 0; done + BATCH <= rolls; done += BATCH)
+	{
+		rng_rolls(&rng, batch, BATCH);
+		for (int i = 0; i < BATCH; ++i)
+		{
+			batch_faces[batch[i]]++;
+		}
+	}
+	report("rng_rolls() batches", now_ns() - start, batch_faces, rolls / BATCH * BATCH);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,253 @@
+/*
+ * room_list_bench.c - LIST_ROOMS with more rooms than the send hard limit
+ *
+ * Runs the server (reactor, lobby, real sockets on the loopback) in this
+ * process with so many rooms that one LIST_ROOMS reply is larger than the
+ * send hard limit (4x the high-water mark), and has clients ask for it:
+ *
+ *  - readers: read as fast as they can and ask again once a reply is in
+ *  - one slow client: reads a few KB at a time with pauses, so its reply
+ *    waits in the output queue and drains as the socket takes it
+ *
+ * Every request is followed by a PING: a reply must hold one ROOM_INFO per
+ * room and be followed by the PING's OK, i.e. the client was not evicted as
+ * a slow consumer. Reports replies/s and MB/s of the readers.
+ *
+ * Usage: room_list_bench [-u] [-r rooms] [-c clients] [-n requests] [-p port]
+ */
+
+#include "bench.h"
+#include "lobby.h"
+#include "scan.h"
+#include "server.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SLOW_READ 4096   // bytes the slow client takes at a time
+#define SLOW_PAUSE_US 500
+
+static const char PING_OK[] = "OK|cmd:PING\n";
+
+typedef struct
+{
+	pthread_t thread;
+	int index;
+	int slow;
+	long requests;
+	long replies;     // complete and followed by the PING's OK
+	long long bytes;
+} client_t;
+
+static int port = 5600;
+
+static void* server_main(void* arg)
+{
+	(void)arg;
+	run_server(port, "127.0.0.1");
+	fprintf(stderr, "the server stopped\n");
+	exit(EXIT_FAILURE);
+}
+
+static int connect_client(void)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	// The server may not be listening yet
+	for (int attempt = 0; attempt < 200; ++attempt)
+	{
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+		{
+			const struct timeval timeout = { .tv_sec = 10 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	return -1;
+}
+
+static int send_all(const int fd, const char* text)
+{
+	const size_t len = strlen(text);
+	return send(fd, text, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Reads up to and including the PING's OK. Counts the ROOM_INFO lines before it.
+ * @return Bytes read, -1 if the connection failed or timed out.
+ */
+static long long read_reply(const int fd, const int slow, long* room_lines)
+{
+	char buf[64 * 1024];
+	char line[sizeof(PING_OK)]; // start of the current line
+	size_t line_len = 0;
+	long long bytes = 0;
+	*room_lines = 0;
+	while (1)
+	{
+		const ssize_t got = recv(fd, buf, slow ? SLOW_READ : sizeof(buf), 0);
+		if (got <= 0)
+		{
+			return -1;
+		}
+		bytes += got;
+		for (ssize_t i = 0; i < got; ++i)
+		{
+			if (line_len < sizeof(line))
+			{
+				line[line_len] = buf[i];
+			}
+			line_len++;
+			if (buf[i] != '\n')
+			{
+				continue;
+			}
+			if (line_len == sizeof(PING_OK) - 1 && memcmp(line, PING_OK, line_len) == 0)
+			{
+				return bytes;
+			}
+			*room_lines += line_len > 10 && memcmp(line, "ROOM_INFO|", 10) == 0;
+			line_len = 0;
+		}
+		if (slow)
+		{
+			usleep(SLOW_PAUSE_US);
+		}
+	}
+}
+
+static void* client_main(void* arg)
+{
+	client_t* client = arg;
+	const int fd = connect_client();
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	char login[64];
+	long room_lines;
+	snprintf(login, sizeof(login), "LOGIN|nick:bench%d\nPING\n", client->index);
+	if (send_all(fd, login) != 0 || read_reply(fd, 0, &room_lines) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	for (long r = 0; r < client->requests; ++r)
+	{
+		if (send_all(fd, "LIST_ROOMS\nPING\n") != 0)
+		{
+			break;
+		}
+		const long long bytes = read_reply(fd, client->slow, &room_lines);
+		if (bytes < 0 || room_lines != MAX_ROOMS)
+		{
+			break;
+		}
+		client->bytes += bytes;
+		client->replies++;
+	}
+	close(fd);
+	return NULL;
+}
+
+int main(const int argc, char* argv[])
+{
+	int clients = 4;
+	long requests = 20;
+	int opt;
+	MAX_ROOMS = 10000;
+	MAX_PLAYERS = 64;
+	SERVER_THREADS = 2;
+	DICE_SEED = 1;
+
+	while ((opt = getopt(argc, argv, "ur:c:n:p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'u':
+				USE_IO_URING = 1;
+				break;
+			case 'r':
+				MAX_ROOMS = atoi(optarg);
+				break;
+			case 'c':
+				clients = atoi(optarg);
+				break;
+			case 'n':
+				requests = atol(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-u] [-r rooms] [-c clients] [-n requests] [-p port]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (MAX_ROOMS < 1 || clients < 1 || requests < 1 || clients + 1 > MAX_PLAYERS)
+	{
+		fprintf(stderr, "Usage: %s [-u] [-r rooms >= 1] [-c clients 1-%d] [-n requests >= 1] [-p port]\n", argv[0], MAX_PLAYERS - 1);
+		return EXIT_FAILURE;
+	}
+
+	init_lobby();
+	scan_init();
+	pthread_t server;
+	pthread_create(&server, NULL, server_main, NULL);
+
+	// The readers, then the slow client, which asks once
+	client_t* all = calloc(clients + 1, sizeof(client_t));
+	for (int i = 0; i <= clients; ++i)
+	{
+		all[i].index = i;
+		all[i].slow = i == clients;
+		all[i].requests = all[i].slow ? 1 : requests;
+	}
+	const double start = now_ns();
+	for (int i = 0; i <= clients; ++i)
+	{
+		pthread_create(&all[i].thread, NULL, client_main, &all[i]);
+	}
+	long replies = 0;
+	long long bytes = 0;
+	for (int i = 0; i < clients; ++i)
+	{
+		pthread_join(all[i].thread, NULL);
+		replies += all[i].replies;
+		bytes += all[i].bytes;
+	}
+	const double elapsed = now_ns() - start;
+	pthread_join(all[clients].thread, NULL);
+
+	printf(
+		"%d rooms, %lld-byte replies, hard limit %d bytes, %s:\n"
+		"readers: %ld/%ld replies, %.0f replies/s, %.1f MB/s\n"
+		"slow client: %ld/1 replies\n",
+		MAX_ROOMS, replies ? bytes / replies : 0, SEND_HIGH_WATER * 4, USE_IO_URING ? "io_uring" : "epoll",
+		replies, requests * clients, replies / elapsed * 1e9, bytes / elapsed * 1e3,
+		all[clients].replies
+	);
+	const int complete = replies == requests * clients && all[clients].replies == 1;
+	free(all);
+	if (!complete)
+	{
+		fprintf(stderr, "clients lost replies (evicted?)\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
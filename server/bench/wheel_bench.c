@@ -0,0 +1,186 @@
+/*
+ * wheel_bench.c - Idle timeout benchmark: timer wheel vs. the per-second scan
+ *
+ * Simulates connections that PING every PING_INTERVAL seconds (each at its
+ * own offset) for a while of virtual time, and finds the idle ones:
+ *
+ *  - scan: the previous server_on_tick(), which woke up every second on
+ *    every shard and checked last_activity of every player slot (skipping
+ *    those of other shards), kept here as the baseline
+ *  - wheel: the idle deadline of src/wheel.c the reactor arms per connection,
+ *    re-armed lazily when it fires and the player was heard from meanwhile;
+ *    the loop sleeps for whatever wheel_timeout() says
+ *
+ * Reports the CPU time spent on the timeouts and how often each woke up,
+ * then the cost of arming and cancelling deadlines (connects and disconnects).
+ *
+ * Both spread the connections over SHARDS shards; the wheel's work is the
+ * same in total however many there are.
+ *
+ * Usage: wheel_bench [connections] [seconds]
+ */
+
+#include "bench.h"
+#include "wheel.h"
+#include "lobby.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+	deadline_t idle;
+	uint64_t offset_ms; // when in the PING_INTERVAL it pings
+} connection_t;
+
+#define SHARDS 4
+
+static timer_wheel_t wheel;
+static uint64_t clock_ms;   // the virtual clock
+static long fired;
+
+static uint64_t last_ping(const connection_t* conn)
+{
+	const uint64_t interval = PING_INTERVAL * 1000;
+	if (clock_ms < conn->offset_ms)
+	{
+		return 0;
+	}
+	return conn->offset_ms + (clock_ms - conn->offset_ms) / interval * interval;
+}
+
+static void on_idle(void* arg);
+
+/*
+ * Like reactor_arm_idle(): rounded up to a whole second.
+ */
+static void arm_idle(connection_t* conn, const uint64_t due_ms)
+{
+	wheel_arm(&wheel, &conn->idle, (due_ms + 999) / 1000 * 1000, on_idle, conn);
+}
+
+static void on_idle(void* arg)
+{
+	connection_t* conn = arg;
+	fired++;
+	// They pinged since: watch them again from their last message, like watch_idle()
+	arm_idle(conn, last_ping(conn) + (IDLE_TIMEOUT + 1) * 1000);
+}
+
+/*
+ * The previous tick of every shard for one second.
+ */
+static long scan(const player_t* players, const int count, const time_t now)
+{
+	long idle = 0;
+	for (int shard = 0; shard < SHARDS; ++shard)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			const player_t* player = &players[i];
+			if (
+				player->shard != shard ||
+				!player->watched ||
+				player->socket == -1 ||
+				now - player->last_activity <= IDLE_TIMEOUT
+			)
+			{
+				continue;
+			}
+			idle++;
+		}
+	}
+	return idle;
+}
+
+int main(const int argc, char* argv[])
+{
+	const int count = argc > 1 ? atoi(argv[1]) : 100000;
+	const int seconds = argc > 2 ? atoi(argv[2]) : 600;
+	if (count < 1 || seconds < 1)
+	{
+		fprintf(stderr, "usage: wheel_bench [connections >= 1] [seconds >= 1]\n");
+		return EXIT_FAILURE;
+	}
+
+	player_t* players = aligned_alloc(CACHE_LINE, sizeof(player_t) * count);
+	connection_t* conns = calloc(count, sizeof(connection_t));
+	srand(1);
+	const time_t start = time(NULL);
+	for (int i = 0; i < count; ++i)
+	{
+		players[i].socket = 1000 + i;
+		players[i].watched = 1;
+		players[i].shard = i % SHARDS;
+		players[i].last_activity = start;
+		conns[i].offset_ms = (uint64_t)(rand() % (PING_INTERVAL * 1000));
+	}
+
+	// Baseline: a wakeup and a full scan per second (the PINGs in between are not timed)
+	long idle = 0;
+	double scan_ns = 0;
+	for (int s = 0; s < seconds; ++s)
+	{
+		clock_ms = (uint64_t)s * 1000;
+		for (int i = 0; i < count; ++i)
+		{
+			players[i].last_activity = start + (time_t)(last_ping(&conns[i]) / 1000);
+		}
+		const double t = now_ns();
+		idle += scan(players, count, start + s);
+		scan_ns += now_ns() - t;
+	}
+
+	// Wheel: sleep until the next deadline, fire what is due
+	clock_ms = 0;
+	wheel_init(&wheel, clock_ms);
+	double t = now_ns();
+	for (int i = 0; i < count; ++i)
+	{
+		arm_idle(&conns[i], (IDLE_TIMEOUT + 1) * 1000);
+	}
+	long wakeups = 0;
+	const uint64_t end_ms = (uint64_t)seconds * 1000;
+	while (clock_ms < end_ms)
+	{
+		const int timeout = wheel_timeout(&wheel, clock_ms);
+		if (timeout < 0)
+		{
+			break;
+		}
+		clock_ms += (uint64_t)timeout;
+		wheel_advance(&wheel, clock_ms);
+		wakeups++;
+	}
+	const double wheel_ns = now_ns() - t;
+
+	printf(
+		"%d connections on %d shards pinging every %d s, %d s, %ld found idle:\n"
+		"scan:  %8.2f ms, %6d wakeups per shard\n"
+		"wheel: %8.2f ms, %6ld wakeups at most per shard, %ld deadlines fired (%.2fx)\n",
+		count, SHARDS, PING_INTERVAL, seconds, idle, scan_ns / 1e6, seconds, wheel_ns / 1e6, wakeups, fired,
+		scan_ns / wheel_ns
+	);
+
+	// Connects and disconnects: arm and cancel, a full wheel in the background
+	const int rounds = 10;
+	t = now_ns();
+	for (int r = 0; r < rounds; ++r)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			wheel_cancel(&conns[i].idle);
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			arm_idle(&conns[i], clock_ms + (IDLE_TIMEOUT + 1) * 1000);
+		}
+	}
+	printf("arm + cancel: %.1f ns per connection\n", (now_ns() - t) / rounds / count);
+
+	free(conns);
+	free(players);
+	return EXIT_SUCCESS;
+}
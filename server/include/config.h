@@ -8,6 +8,10 @@
 // Lobby limits
 #define MAX_PLAYERS_PER_ROOM 2
 #define NICKNAME_LEN 32
+#define ROOM_PAGE_MAX 100        // most rooms in one paged LIST_ROOMS reply (also the default limit)
+
+// Memory layout
+#define CACHE_LINE 64            // bytes; player_t and room_t are laid out in lines of this size
 
 // Game rules
 #define WINNING_SCORE 30         // points needed to win
@@ -16,9 +20,15 @@
 #define RECONNECT_TIMEOUT 20     // how long we wait for a disconnected player to come back
 #define PING_INTERVAL 10         // client should ping at least this often
 #define IDLE_TIMEOUT 20          // kick player after this much inactivity
+#define SLOW_CONSUMER_TIMEOUT 10 // drop a client whose unsent output stays over SEND_HIGH_WATER this long
 
 // Set at runtime based on command line args (defaults in main.c)
 extern int MAX_ROOMS;
 extern int MAX_PLAYERS;
+extern int SERVER_THREADS;      // reactor shards (one per thread)
+extern int PIN_THREADS;         // pin shard i to CPU i
+extern int USE_IO_URING;        // io_uring instead of epoll (falls back to epoll if unavailable)
+extern int SEND_HIGH_WATER;     // bytes of unsent output per connection before it counts as a slow consumer
+extern unsigned long long DICE_SEED; // master seed of every game's dice (-s), random unless given
 
 #endif // CONFIG_H
@@ -1,45 +1,167 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include <stdint.h>
 #include "config.h"
+#include "rng.h"
+
+// Where a game is
+typedef enum
+{
+	GAME_NONE,    // no game in this room
+	GAME_RUNNING, // being played (the room is IN_PROGRESS or PAUSED)
+	GAME_OVER     // decided or aborted, the room is about to be emptied
+} game_status;
+
+/*
+ * The Pig engine: pig_step() applies one move to a game held by value and reports
+ * what happened as events. No I/O, no logging, no dice of its own - the caller rolls -
+ * so the server, benchmarks and simulators all play by exactly the same rules.
+ */
+
+// One game, as the engine sees it (the store keeps the same fields per game, see below)
+typedef struct
+{
+	uint8_t scores[2];      // banked points for each player
+	uint8_t turn_score;     // points accumulated this turn (lost if you roll a 1)
+	uint8_t roll;           // last dice roll (1-6), 0 after a hold
+	uint8_t current_player; // whose turn it is (0 or 1)
+	uint8_t status;         // game_status
+	int8_t winner;          // index of winner, or -1 if no winner (yet)
+} pig_state_t;
+
+// What a player can do
+typedef enum
+{
+	PIG_ROLL,  // roll the die (on their turn)
+	PIG_HOLD,  // bank the turn's points (on their turn)
+	PIG_QUIT,  // give the game up (any time)
+	PIG_ACTIONS
+} pig_action;
+
+// What a move did
+typedef enum
+{
+	PIG_ROLLED,   // value: the roll
+	PIG_BUSTED,   // rolled a 1, the turn's points are lost
+	PIG_HELD,     // value: the points banked
+	PIG_TURN,     // the turn passed to player
+	PIG_WON,      // player won, the game is over
+	PIG_REJECTED  // the move is not allowed now (not their turn, game over), nothing changed
+} pig_event_type;
 
-// Pig dice game state - tracks everything about an ongoing game
 typedef struct
 {
-	int player_fds[2];     // socket fds for each player (index 0 and 1)
-	int scores[2];         // banked points for each player
-	int current_player;    // whose turn it is (0 or 1)
-	int turn_score;        // points accumulated this turn (lost if you roll a 1)
-	int roll_result;       // last dice roll (1-6)
-	int game_over;         // 1 if game has ended
-	int game_winner;       // index of winner, or -1 if no winner yet
-	unsigned int rand_seed; // for thread-safe rand_r()
-} game_state;
+	uint8_t type;   // pig_event_type
+	uint8_t player; // who it is about
+	uint8_t value;
+} pig_event_t;
+
+#define PIG_MAX_EVENTS 4 // a move causes at most this many events
+
+typedef struct
+{
+	pig_event_t events[PIG_MAX_EVENTS];
+	int count;
+} pig_events_t;
+
+/**
+ * @brief A new game: zero scores, first_player on turn.
+ */
+pig_state_t pig_new_game(int first_player);
+
+/**
+ * @brief Whether a move would be accepted (its player may take it now). Rolling only
+ * for accepted moves keeps the dice of a game independent of rejected commands.
+ */
+int pig_accepts(const pig_state_t* state, int player, pig_action action);
+
+/**
+ * @brief Applies one move. Pure: the result only depends on the arguments.
+ * @param state The game before the move.
+ * @param player Who moves (0 or 1).
+ * @param action The move.
+ * @param roll The die (1-6) if the action is PIG_ROLL, ignored otherwise.
+ * @param events Filled with what happened, in order.
+ * @return The game after the move (unchanged if it was rejected).
+ */
+pig_state_t pig_step(pig_state_t state, int player, pig_action action, int roll, pig_events_t* events);
+
+/*
+ * Pig dice game state of every room, one array per field, indexed by room ID (a room
+ * hosts one game at a time, so the room ID is the game's handle). 15 bytes per game:
+ * scores stay below WINNING_SCORE + 6, so every field but the dice is a byte. The arrays
+ * are reserved for MAX_ROOMS games, but only the pages of the rooms in use are backed
+ * by memory. Any thread can read a game; only the shard hosting its room changes it.
+ */
+typedef struct
+{
+	rng_t* rng;              // the dice, seeded per game from DICE_SEED (see start_game())
+	uint8_t* scores[2];      // banked points for each player
+	uint8_t* turn_score;     // points accumulated this turn (lost if you roll a 1)
+	uint8_t* roll;           // last dice roll (1-6), 0 after a hold
+	uint8_t* current_player; // whose turn it is (0 or 1)
+	uint8_t* status;         // game_status
+	int8_t* winner;          // index of winner, or -1 if no winner (yet)
+	int capacity;
+} game_store_t;
+
+// Totals over the store, see game_stats()
+typedef struct
+{
+	int running;      // games being played
+	int decided;      // games over with a winner, not yet cleared
+	long points;      // banked points in running games
+} game_stats_t;
+
+extern game_store_t games;
+
+/**
+ * @brief Reserves (not yet allocates) the store for capacity games.
+ * @param capacity The most games, one per room.
+ * @return 0 on success, -1 if the memory could not be reserved.
+ */
+int init_games(int capacity);
+
+/**
+ * @brief Starts a new game: zero scores, a random first player. Seed games.rng[game] first.
+ * @param game The game (room ID).
+ */
+void init_game(int game);
+
+/**
+ * @brief A game of the store as a value, and back.
+ */
+pig_state_t load_game(int game);
+void save_game(int game, const pig_state_t* state);
 
 /**
- * @brief Initializes a new game state.
- * @param game A pointer to the game_state object to initialize.
- * @param p1_fd The file descriptor for player 1.
- * @param p2_fd The file descriptor for player 2.
+ * @brief Plays one move of a stored game with its dice (pig_step() on the store).
+ * @param game The game (room ID).
+ * @param player Who moves (0 or 1).
+ * @param action The move.
+ * @param events Filled with what happened.
  */
-void init_game(game_state* game, int p1_fd, int p2_fd);
+void play_move(int game, int player, pig_action action, pig_events_t* events);
 
 /**
- * @brief Handles a player's roll action.
- * @param game A pointer to the current game_state object.
+ * @brief Ends a game outside the rules (reconnect timeout). Quitting is a move, PIG_QUIT.
+ * @param game The game (room ID).
+ * @param winner Index of the winner, or -1 if nobody wins.
  */
-void handle_roll(game_state* game);
+void end_game(int game, int winner);
 
 /**
- * @brief Handles a player's hold action.
- * @param game A pointer to the current game_state object.
+ * @brief Frees the game's place in the store once its room is emptied.
+ * @param game The game (room ID).
  */
-void handle_hold(game_state* game);
+void clear_game(int game);
 
 /**
- * @brief Switches the current player.
- * @param game A pointer to the current game_state object.
+ * @brief Counts the games of rooms [0, bound). A snapshot: games may move on meanwhile.
+ * @param stats The totals.
+ * @param bound Upper bound (exclusive) of the room IDs, see room_slots().
  */
-void switch_player(game_state* game);
+void game_stats(game_stats_t* stats, int bound);
 
 #endif // GAME_H
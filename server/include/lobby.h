@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <time.h>
 #include "config.h"
+#include "game.h"
 
 // Where the player currently is
 typedef enum
@@ -18,47 +19,70 @@ typedef enum
 	WAITING,     // waiting for players to join
 	IN_PROGRESS, // game is running
 	PAUSED,      // one player disconnected, waiting for reconnect
-	ABORTED      // game was cancelled (e.g. player quit during reconnect)
+	ABORTED,     // game was cancelled (e.g. player quit during reconnect)
+	NUM_ROOM_STATES
 } room_state;
 
+// Where the connection is in the login handshake (driven by the reactor)
+typedef enum
+{
+	SESSION_LOGIN,  // connected, waiting for LOGIN
+	SESSION_RESUME, // took over a paused game slot, waiting for RESUME
+	SESSION_ACTIVE  // logged in - lobby or room, see player_state
+} session_state;
+
+/*
+ * Exactly one cache line: everything the idle timeouts, the lobby scans and the nickname
+ * lookups read for a player. Rarely used bookkeeping (the lobby feed) lives in lobby.c.
+ */
 typedef struct player_s
 {
-	int socket;                        // -1 if disconnected
-	char nickname[NICKNAME_LEN];
+	_Alignas(CACHE_LINE) int socket;   // -1 if disconnected
 	player_state state;
 	int room_id;                       // -1 if not in a room
-	time_t disconnected_timestamp;     // when they dropped (for reconnect timeout)
+	session_state session;             // login handshake progress
+	int watched;                       // 1 while the socket is registered with the reactor
+	int shard;                         // reactor shard that owns the socket
 	time_t last_activity;              // last time we heard from them (for idle timeout)
-	char read_buffer[MSG_MAX_LEN * 2]; // partial message buffer (TCP can split messages)
-	size_t buffer_len;                 // how much is in read_buffer
+	char nickname[NICKNAME_LEN];
 } player_t;
 
+/*
+ * Two cache lines, no two rooms share one. The first has the lock with what is read
+ * under it by other shards (JOIN_ROOM, ROOM_INFO), the second the players, used by the
+ * hosting shard. The game lives in the game store under the room's ID (see game.h), the
+ * reconnect deadline of a paused game in server.c.
+ */
 typedef struct room_s
 {
+	_Alignas(CACHE_LINE) pthread_mutex_t mutex; // protects state, players and player_count
 	int id;
 	room_state state;
-	player_t* players[MAX_PLAYERS_PER_ROOM];
 	int player_count;
-	pthread_t game_thread;  // runs game_thread_func when game starts
-	pthread_mutex_t mutex;  // protects room state changes
-	pthread_cond_t cond;    // signals client threads when game state changes
+	int shard;              // reactor shard hosting the room (claimed by the first player), -1 while empty
+	int idle_player_idx;    // who went idle if PAUSED by idle timeout, -1 for a real disconnect
+	unsigned games;         // games started here so far, numbers the game for its dice seed
+
+	_Alignas(CACHE_LINE) player_t* players[MAX_PLAYERS_PER_ROOM];
 } room_t;
 
+// Reserved for MAX_PLAYERS/MAX_ROOMS items, but only the chunks in use are backed by memory
 extern player_t* players;
 extern room_t* rooms;
 
 // Function declarations
 /**
- * @brief Initializes the lobby, allocating memory for players and rooms.
+ * @brief Initializes the lobby, reserving (not yet allocating) memory for players and rooms.
  */
 void init_lobby();
 
 /**
  * @brief Adds a new player to the lobby.
  * @param socket The socket file descriptor for the new player.
+ * @param shard The reactor shard that accepted the socket.
  * @return A pointer to the newly created player_t object, or NULL if the server is full.
  */
-player_t* add_player(int socket);
+player_t* add_player(int socket, int shard);
 
 /**
  * @brief Removes a player from the lobby and any room they were in.
@@ -67,20 +91,101 @@ player_t* add_player(int socket);
 void remove_player(player_t* player);
 
 /**
- * @brief Adds a player to a game room.
+ * @brief Adds a player to a game room. An empty room moves to the player's shard,
+ * otherwise the player has to be on the shard hosting the room.
  * @param room_id The ID of the room to join.
  * @param player A pointer to the player_t object joining the room.
- * @return 0 on success, -1 on failure (e.g., room is full or in progress).
+ * @param host_shard Set to the shard hosting the room when 1 is returned.
+ * @return 0 on success, -1 on failure (e.g., room is full or in progress),
+ *         1 if the room is hosted on another shard - migrate there and retry.
+ */
+int join_room(int room_id, player_t* player, int* host_shard);
+
+/**
+ * @brief Finds a room nobody is in (WAITING and empty), for quick matches.
+ * @param from The lowest room ID to consider.
+ * @return The lowest such room ID at or above from, or -1 if there is none. The room may
+ *         fill up before the caller joins it.
+ */
+int find_empty_room(int from);
+
+/**
+ * @brief Puts a lobby player into their shard's quick-match queue. Owning shard only, as are
+ * the other functions on the queue except quick_match_length() and find_quick_match_shard().
+ * @param player The player.
+ * @param at_head 1 to put them first (back where they were), 0 to put them last.
+ * @return 0 on success, -1 if they are queued already.
+ */
+int enqueue_quick_match(player_t* player, int at_head);
+
+/**
+ * @brief Takes a player out of the quick-match queue. join_room() and remove_player() do it too.
+ * @param player The player.
+ * @return 0 if they were waiting, -1 if not.
+ */
+int cancel_quick_match(player_t* player);
+
+/**
+ * @brief Takes the player who has been waiting longest out of a shard's quick-match queue.
+ * @param shard The shard.
+ * @return The player, or NULL if nobody is waiting.
+ */
+player_t* dequeue_quick_match(int shard);
+
+/**
+ * @brief Takes the player who has been waiting longest out of a shard's quick-match queue, to
+ * move them to another shard. requeue_quick_match() puts them in line there on arrival.
+ * @param shard The shard.
+ * @return The player, or NULL if nobody is waiting.
  */
-int join_room(int room_id, player_t* player);
+player_t* move_quick_match(int shard);
 
 /**
- * @brief Retrieves a pointer to a room by its ID.
+ * @brief Puts a player taken out by move_quick_match() last in the queue of the shard they arrived on.
+ * @param player The player.
+ * @return 0 if they were moving to wait here, -1 if not.
+ */
+int requeue_quick_match(player_t* player);
+
+/**
+ * @brief Number of players in a shard's quick-match queue. Any thread.
+ * @param shard The shard.
+ */
+int quick_match_length(int shard);
+
+/**
+ * @brief Finds a lower shard with players waiting for a quick match. Waiting players only move
+ * down, so two of them never swap shards. Any thread.
+ * @param shard The shard asking.
+ * @return The lowest shard below it with players waiting, or -1 if there is none.
+ */
+int find_quick_match_shard(int shard);
+
+/**
+ * @brief Retrieves a pointer to a room by its ID, creating the room if needed.
  * @param room_id The ID of the room to retrieve.
  * @return A pointer to the room_t object, or NULL if the ID is invalid.
  */
 room_t* get_room(int room_id);
 
+/**
+ * @brief Like get_room(), but does not create the room.
+ * @return The room, or NULL if the ID is invalid or the room was never created.
+ */
+room_t* peek_room(int room_id);
+
+/**
+ * @brief Retrieves a player slot for a scan, without creating it.
+ * @return The player, or NULL if the slot is out of range or not backed by memory.
+ */
+player_t* peek_player(int slot);
+
+/**
+ * @brief Upper bounds (exclusive) of the room IDs and player slots a scan has to visit.
+ */
+int room_slots();
+int player_slots();
+
 /**
  * @brief Finds a disconnected player by their nickname.
  * @param nickname The nickname of the player to find.
@@ -95,6 +200,20 @@ player_t* find_disconnected_player(const char* nickname);
  */
 player_t* find_active_player_by_nickname(const char* nickname);
 
+/**
+ * @brief Sets the nickname of a player who just logged in and indexes it for the lookups above.
+ * @param player The player.
+ * @param nickname The nickname (truncated to NICKNAME_LEN - 1 characters).
+ */
+void set_player_nickname(player_t* player, const char* nickname);
+
+/**
+ * @brief Takes a player out of their finished game. A player who is still disconnected
+ * gives up their slot (and nickname).
+ * @param player The player.
+ */
+void return_player_to_lobby(player_t* player);
+
 /**
  * @brief Removes a player from their current room if the room is in a WAITING state.
  * @param player The player to remove.
@@ -116,9 +235,52 @@ void handle_player_disconnect(player_t* player);
 void update_room_state_and_broadcast(int room_id, room_state new_state);
 
 /**
- * @brief Broadcasts the state of a specific room to all players in the LOBBY state.
+ * @brief Announces a change of a room to the players in the lobby. The room is queued on every
+ * shard's lobby feed and sent with the next publish_room_updates(), as it is by then; a room
+ * that changes several times in between goes out once.
+ * Call it after changing the room, with room->mutex released.
  * @param room A pointer to the room_t object whose state needs to be broadcast.
  */
-void broadcast_room_update(const room_t* room);
+void broadcast_room_update(room_t* room);
+
+/**
+ * @brief Sends the rooms changed since the last call, as one batch of ROOM_INFO, to every
+ * subscriber of the shard's lobby feed. Called by the shard in the tick the first change asked for.
+ * @param shard The shard whose feed to publish.
+ */
+void publish_room_updates(int shard);
+
+/**
+ * @brief Subscribes a player to the lobby feed of their shard if they are logged in, connected
+ * and in the lobby, and unsubscribes them otherwise. Call it after the player's state, session
+ * or shard changed.
+ * @param player The player.
+ */
+void update_lobby_subscription(player_t* player);
+
+/**
+ * @brief Sends ROOM_INFO for every room (the LIST_ROOMS reply).
+ *
+ * The list is serialized once per change of any room and shared by all requesters,
+ * so repeated LIST_ROOMS between changes cost a single copy into the output queue.
+ *
+ * @param socket The requesting client's socket.
+ * @return 0 on success, -1 if the list could not be built or queued.
+ */
+int send_room_list(int socket);
+
+/**
+ * @brief Sends ROOM_INFO for one page of rooms (LIST_ROOMS with state, offset or limit).
+ *
+ * Rooms are indexed by state, so a filtered page costs about its own size rather than
+ * a walk over all rooms.
+ *
+ * @param socket The requesting client's socket.
+ * @param state Only rooms in this state, or -1 for any state.
+ * @param offset How many matching rooms (in room ID order) to skip.
+ * @param limit Most rooms to send, at most ROOM_PAGE_MAX.
+ * @return The number of rooms sent.
+ */
+int send_room_page(int socket, int state, int offset, int limit);
 
 #endif // LOBBY_H
@@ -1,6 +1,8 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
+
 // Enum for all possible client commands
 typedef enum
 {
@@ -15,16 +17,43 @@ typedef enum
 	CMD_GAME_STATE_REQUEST,
 	CMD_QUIT,
 	CMD_EXIT,
-	CMD_PING
+	CMD_PING,
+	CMD_QUICK_MATCH
 } client_command_t;
 
+// Known argument keys (K_* in protocol.h); each has a slot in parsed_command_t
+typedef enum
+{
+	KEY_CMD,
+	KEY_MSG,
+	KEY_NICK,
+	KEY_ROOM,
+	KEY_STATE,
+	KEY_OPP_NICK,
+	KEY_YOUR_TURN,
+	KEY_MY_SCORE,
+	KEY_OPP_SCORE,
+	KEY_TURN_SCORE,
+	KEY_CURRENT,
+	KEY_COUNT,
+	KEY_ROLL,
+	KEY_PLAYERS,
+	KEY_ROOMS,
+	KEY_PROTO,
+	KEY_OFFSET,
+	KEY_LIMIT,
+	NUM_KEYS
+} command_key_t;
+
 // A structure to hold a parsed command argument (key-value pair)
 #define MAX_ARGS 5 // A command can have up to 5 arguments
 
 typedef struct
 {
-	char* key;
+	const char* key;     // views into the command buffer, NUL-terminated in place
 	char* value;
+	unsigned short key_len;
+	unsigned short value_len;
 } command_arg;
 
 // A structure to hold a fully parsed command
@@ -33,13 +62,17 @@ typedef struct
 	client_command_t type;
 	command_arg args[MAX_ARGS];
 	int arg_count;
+	unsigned key_mask;                // bit k is set if known key k is present
+	unsigned char key_slot[NUM_KEYS]; // index into args of every key in key_mask
 } parsed_command_t;
 
 /**
  * @brief Parses a raw command buffer into a structured parsed_command_t.
  *
- * This function tokenizes the input buffer and populates the output struct.
- * It modifies the input buffer by replacing delimiters with null terminators.
+ * A single pass over the buffer: fields and key/value pairs are recorded as views
+ * into it (delimiters are replaced with null terminators), the verb and the known
+ * keys are recognized by length and content without string comparisons in a loop.
+ * Nothing is allocated or copied.
  *
  * @param buffer The mutable character buffer containing the raw command from the client.
  * @param out_cmd A pointer to the struct that will be filled with the parsed data.
@@ -48,13 +81,70 @@ typedef struct
 int parse_command(char* buffer, parsed_command_t* out_cmd);
 
 /**
- * @brief Searches for the value of a specific key in a parsed command's arguments.
+ * @brief Decodes the payload of a binary frame (see protocol.h) into a parsed_command_t.
+ *
+ * Keys point to their static names, values are rendered as strings into the scratch
+ * buffer (integers in decimal), so the result reads the same as a parsed text command.
+ *
+ * @param payload The frame payload: opcode byte followed by the fields.
+ * @param len Length of the payload.
+ * @param scratch Where to put the values; must hold at least BINARY_SCRATCH_LEN(len) bytes.
+ * @param out_cmd A pointer to the struct that will be filled with the decoded data.
+ * @return 0 on success, -1 on a malformed payload.
+ */
+int parse_binary_command(const unsigned char* payload, size_t len, char* scratch, parsed_command_t* out_cmd);
+
+// Scratch space parse_binary_command() needs at most for a payload of len bytes
+#define BINARY_SCRATCH_LEN(len) ((len) + MAX_ARGS * 12)
+
+/**
+ * @brief Renders a parsed command back as a text protocol line (without the \n).
+ * @param cmd The command.
+ * @param out Where to put the line.
+ * @param out_len Size of out; longer lines are truncated.
+ */
+void format_command(const parsed_command_t* cmd, char* out, size_t out_len);
+
+/**
+ * @brief Maps a verb to its command.
+ * @param verb The verb (not necessarily NUL-terminated).
+ * @param len Length of the verb.
+ * @return The command, CMD_UNKNOWN if there is no such verb.
+ */
+client_command_t lookup_command(const char* verb, size_t len);
+
+/**
+ * @brief Maps a key name to its slot.
+ * @param key The key (not necessarily NUL-terminated).
+ * @param len Length of the key.
+ * @return The key, or -1 if the server does not know it.
+ */
+int lookup_key(const char* key, size_t len);
+
+/**
+ * @brief Returns the verb of a command (C_* in protocol.h), NULL for CMD_UNKNOWN.
+ */
+const char* command_name(client_command_t type);
+
+/**
+ * @brief Returns the name of a key (K_* in protocol.h).
+ */
+const char* key_name(command_key_t key);
+
+/**
+ * @brief Whether a key carries a string (e.g. a nickname) rather than a number or enum value.
+ * In binary frames strings are length-prefixed, everything else is a varint.
+ */
+int key_is_string(command_key_t key);
+
+/**
+ * @brief Returns the value of a known key in a parsed command's arguments.
  *
  * @param cmd A pointer to the parsed command.
- * @param key The key to search for.
- * @return A pointer to the value string if the key is found, otherwise NULL.
+ * @param key The key to look up.
+ * @return A pointer to the value string if the key is present (the first one if repeated), otherwise NULL.
  */
-const char* get_command_arg(const parsed_command_t* cmd, const char* key);
+const char* get_command_arg(const parsed_command_t* cmd, command_key_t key);
 
 
 #endif //PARSER_H
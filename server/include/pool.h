@@ -0,0 +1,66 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * @brief A fixed-size item array that is backed by memory only where it is used.
+ *
+ * The address range for the whole ceiling is reserved once, so items never move and
+ * plain indexing (base[i]) works. It is committed chunk by chunk: a chunk is initialized
+ * the first time one of its items is needed, and an idle chunk can be handed back to the
+ * OS - its addresses stay valid and read as zeros until it is initialized again.
+ * Chunks are whole pages.
+ */
+typedef struct
+{
+	char* base;                 // reserved for capacity items, never moves
+	size_t item_size;
+	int capacity;               // the ceiling, in items
+	int chunk_items;            // items per chunk
+	int chunk_count;
+	unsigned char* live;        // per chunk: initialized and backed by memory
+	int high_water;             // chunks [0, high_water) have been live at some point
+	void (*init_item)(void* item, int index);
+	pthread_mutex_t mutex;      // initializing chunks
+} pool_t;
+
+/**
+ * @brief Reserves the address range for a pool. Nothing is committed yet.
+ * @param pool The pool.
+ * @param item_size Size of one item.
+ * @param capacity Most items the pool can hold.
+ * @param min_chunk_items Fewest items per chunk (rounded up to whole pages).
+ * @param init_item Called for every item of a chunk when the chunk is initialized.
+ * @return 0 on success, -1 if the range could not be reserved.
+ */
+int pool_init(pool_t* pool, size_t item_size, int capacity, int min_chunk_items, void (*init_item)(void* item, int index));
+
+/**
+ * @brief Makes sure the chunk holding an item is initialized. Thread-safe.
+ * @param pool The pool.
+ * @param index The item.
+ * @return 1 if this call initialized the chunk, 0 if it was live already.
+ */
+int pool_ensure(pool_t* pool, int index);
+
+/**
+ * @brief Whether the chunk holding an item is live (initialized and not released).
+ */
+int pool_is_live(const pool_t* pool, int index);
+
+/**
+ * @brief Returns the memory of an idle chunk to the OS. The caller makes sure nothing in
+ * the chunk is in use; a later pool_ensure() initializes it again.
+ * @param pool The pool.
+ * @param chunk The chunk.
+ */
+void pool_release(pool_t* pool, int chunk);
+
+/**
+ * @brief Upper bound (exclusive) of the items that have ever been live, for scans.
+ */
+int pool_bound(const pool_t* pool);
+
+#endif // POOL_H
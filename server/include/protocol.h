@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include "lobby.h"
+#include "parser.h"
 
 // Commands from Client to Server
 
@@ -28,6 +29,8 @@
 
 #define C_PING "PING"
 
+#define C_QUICK_MATCH "QUICK_MATCH"
+
 typedef enum
 {
 	S_OK,
@@ -90,6 +93,131 @@ typedef enum
 
 #define K_ROOMS "rooms"
 
+#define K_PROTO "proto"
+
+#define K_OFFSET "offset"
+
+#define K_LIMIT "limit"
+
+// Value of K_PROTO in LOGIN that switches the connection to binary frames
+#define PROTO_BIN "bin"
+
+/*
+ * Binary protocol, negotiated with LOGIN|nick:...|proto:bin. LOGIN and its reply
+ * are text; every frame after the reply, in both directions, is binary:
+ *
+ *   frame   = varint(payload length) payload     (payload length 1..MSG_MAX_LEN)
+ *   payload = opcode field*
+ *   opcode  = one byte, client_command_t (client -> server) or server_command_t (server -> client)
+ *   field   = key value
+ *   key     = one byte, command_key_t (parser.h)
+ *   value   = varint(length) bytes  for string keys (nick, opp_nick)
+ *           | varint                for everything else: numbers, and enums by their value -
+ *                                   cmd: client_command_t, msg: server_error_t, state: room_state
+ *
+ * Varints are unsigned LEB128 (7 bits per byte, least significant first).
+ */
+typedef enum
+{
+	PROTO_TEXT,
+	PROTO_BINARY
+} wire_protocol_t;
+
+// Pre-rendered key and "|key:" prefix of a field, the length known at compile time (name as in K_name)
+#define MSG_FIELD(name) KEY_##name, "|" K_##name ":", sizeof("|" K_##name ":") - 1
+
+/**
+ * @brief A server message built in place in both encodings at once: msg_begin(), then the
+ * fields, then msg_send(), which picks the one the recipient speaks.
+ * Fields that do not fit into MSG_MAX_LEN are truncated, as with snprintf.
+ */
+typedef struct
+{
+	char data[MSG_MAX_LEN];
+	size_t len;                         // without the trailing \n
+	unsigned char bin[2 + MSG_MAX_LEN]; // payload starts at bin + 2, room for the length in front
+	size_t bin_len;                     // payload length
+} message_t;
+
+/**
+ * @brief Sets up the per-socket protocol table. Call once before accepting clients.
+ * @return 0 on success, -1 on error.
+ */
+int init_protocol(void);
+
+/**
+ * @brief Chooses how messages to a socket are framed, and how its input is read.
+ * New connections must be reset to PROTO_TEXT.
+ * @param socket The client socket.
+ * @param proto The protocol.
+ */
+void set_socket_protocol(int socket, wire_protocol_t proto);
+
+/**
+ * @brief Returns the protocol of a socket.
+ * @param socket The client socket.
+ */
+wire_protocol_t get_socket_protocol(int socket);
+
+/**
+ * @brief Starts a message with the (pre-rendered) name of the command.
+ * @param msg The message to build.
+ * @param command The command to send.
+ */
+void msg_begin(message_t* msg, server_command_t command);
+
+/**
+ * @brief Appends a string field.
+ * @param msg The message to build.
+ * @param key The key, field prefix and its length, as given by MSG_FIELD(name).
+ * @param field The field prefix.
+ * @param field_len Length of the field prefix.
+ * @param value The value.
+ */
+void msg_add_str(message_t* msg, command_key_t key, const char* field, size_t field_len, const char* value);
+
+/**
+ * @brief Appends an integer field, formatted straight into the message.
+ * @param msg The message to build.
+ * @param key The key, field prefix and its length, as given by MSG_FIELD(name).
+ * @param field The field prefix.
+ * @param field_len Length of the field prefix.
+ * @param value The value (not negative).
+ */
+void msg_add_int(message_t* msg, command_key_t key, const char* field, size_t field_len, int value);
+
+/**
+ * @brief Appends the ROOM_INFO fields describing a room (id, player count, state).
+ * @param msg The message to build, started with S_ROOM_INFO.
+ * @param room The room.
+ */
+void msg_add_room_info(message_t* msg, const room_t* room);
+
+/**
+ * @brief Reads a room state as sent by a client: its name (text), or its value (binary).
+ * @param value The value of a state field.
+ * @return The room_state, or -1 if there is no such state.
+ */
+int parse_room_state(const char* value);
+
+/**
+ * @brief Terminates the message in the given encoding.
+ * @param msg The finished message.
+ * @param proto The encoding.
+ * @param out Set to the encoded bytes (inside msg).
+ * @return Number of bytes.
+ */
+size_t msg_encode(message_t* msg, wire_protocol_t proto, const char** out);
+
+/**
+ * @brief Terminates the message and sends it with its exact length. The same message may be
+ * sent to several clients.
+ * @param socket The socket file descriptor of the client.
+ * @param msg The finished message.
+ * @return The number of bytes sent, or -1 on error.
+ */
+int msg_send(int socket, message_t* msg);
+
 
 /**
  * @brief Sends an error message to a client.
@@ -112,10 +240,12 @@ int send_structured_message(int socket, server_command_t command, int num_args,
 /**
  * @brief Receives a command from a client, handling partial reads.
  * @param player A pointer to the player_t object.
- * @param out_command_buffer The buffer to store the received command.
- * @param buffer_size The size of the output buffer.
- * @return The number of bytes in the command, 0 on disconnect, -1 on error, -2 on buffer full.
+ * @param out_line Set to the command inside the connection's receive buffer: a NUL-terminated
+ *        line, or the payload of a binary frame if the socket speaks PROTO_BINARY.
+ *        It may be modified in place and stays valid until the next call.
+ * @return The number of bytes in the command, 0 on disconnect, -1 on error, -2 on a line
+ *         (frame) longer than MSG_MAX_LEN, -3 if no complete command is available yet.
  */
-ssize_t receive_command(player_t* player, char* out_command_buffer, size_t buffer_size);
+ssize_t receive_command(player_t* player, char** out_line);
 
 #endif // PROTOCOL_H
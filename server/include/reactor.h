@@ -0,0 +1,159 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "lobby.h"
+#include "wheel.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RECV_BATCH_MAX 64 // complete lines found by one scan of the receive buffer
+
+/**
+ * @brief Bytes received on a connection and not consumed yet. receive_command() frames lines
+ * straight out of it: [scanned, end) has not been scanned yet, and the newlines found in
+ * [start, scanned) are listed in lines[line_next..line_count) as offsets into data.
+ */
+typedef struct
+{
+	char* data;
+	size_t cap;
+	size_t start;
+	size_t end;
+	size_t scanned;
+	uint32_t lines[RECV_BATCH_MAX];
+	unsigned line_count;
+	unsigned line_next;
+} recv_buffer_t;
+
+typedef enum
+{
+	IO_EPOLL,  // readiness notifications, read()/send() per message
+	IO_URING,  // completions: multishot accept/recv into provided buffers, batched sends
+} io_backend_t;
+
+/**
+ * @brief Creates one shard per listening socket.
+ * @param listen_fds Bound, listening, non-blocking sockets sharing the port via SO_REUSEPORT, one per shard.
+ * @param count Number of shards (and listening sockets).
+ * @param pin_threads If non-zero, shard i is pinned to CPU i (modulo the number of CPUs).
+ * @param io The I/O backend to use. IO_URING falls back to IO_EPOLL if the kernel does not support it.
+ * @return 0 on success, -1 on error.
+ */
+int reactor_init(const int* listen_fds, int count, int pin_threads, io_backend_t io);
+
+/**
+ * @brief Starts a thread for every shard but the first and runs shard 0 on the calling thread.
+ * Only returns on a fatal epoll error.
+ * @return -1 on error.
+ */
+int reactor_run();
+
+/**
+ * @brief Starts polling the player's socket (edge-triggered) on the player's shard. Owning shard only.
+ * @param player The player whose socket should be watched.
+ * @return 0 on success, -1 on error.
+ */
+int reactor_watch(player_t* player);
+
+/**
+ * @brief Stops polling the player's socket, before it gets closed. Owning shard only.
+ * @param player The player whose socket should no longer be watched.
+ */
+void reactor_unwatch(player_t* player);
+
+/**
+ * @brief Closes an unwatched socket. Output already queued for it is still delivered. Owning shard only.
+ * @param socket The socket to close.
+ */
+void reactor_close(int socket);
+
+/**
+ * @brief Moves a watched socket over to another player object (reconnect handoff). Owning shard only.
+ * @param from The temporary player that currently owns the socket.
+ * @param to The player slot that takes the socket over (to->socket must already be set).
+ */
+void reactor_rebind(player_t* from, player_t* to);
+
+/**
+ * @brief Moves the player's socket to another shard, e.g. the one hosting the room they want.
+ * The caller must stop touching the player right after. Owning shard only.
+ * @param player The player to move.
+ * @param shard The target shard.
+ * @param command A raw command line the target shard runs before reading more, or NULL.
+ */
+void reactor_migrate(player_t* player, int shard, const char* command);
+
+/**
+ * @brief Returns the receive buffer of the player's connection. Owning shard only.
+ * @param player The player.
+ * @return The buffer, or NULL if the player's socket is not watched.
+ */
+recv_buffer_t* reactor_recv_buffer(const player_t* player);
+
+/**
+ * @brief Appends newly arrived bytes to the player's receive buffer, compacting it first if the
+ * free space ran out. Offsets (including the line list) stay valid, pointers into the buffer do not. Owning shard only.
+ * @param player The player whose socket to read.
+ * @return Number of bytes added, 0 if the peer closed the connection, -1 on error (errno EAGAIN if there is nothing to read).
+ */
+ssize_t reactor_fill(const player_t* player);
+
+/**
+ * @brief Sends bytes on a client socket. With io_uring, sockets of the calling shard get the bytes
+ * queued and sent in one batch at the end of the loop round; everything else is a direct send().
+ * @param socket The client socket.
+ * @param data The bytes to send.
+ * @param len Number of bytes.
+ * @return Number of bytes sent or queued, -1 on error.
+ */
+ssize_t reactor_send(int socket, const char* data, size_t len);
+
+// Gives back a reference held by the output queue, see reactor_send_shared()
+typedef void (*reactor_release_fn)(void* ref);
+
+/**
+ * @brief Sends bytes by reference: the output queue holds on to them, not a copy, until they are
+ * sent or dropped. For large replies that are the same for many clients (the room list).
+ * @param socket The client socket.
+ * @param data The bytes to send, left unchanged until release(ref) is called.
+ * @param len Number of bytes.
+ * @param release Called exactly once with ref, from any shard, when the bytes are no longer needed.
+ * @param ref The reference the call takes over.
+ * @return Number of bytes sent or queued, -1 on error.
+ */
+ssize_t reactor_send_shared(int socket, const char* data, size_t len, reactor_release_fn release, void* ref);
+
+/**
+ * @brief Arms a deadline on the calling shard's timer wheel, replacing its earlier arming.
+ * It fires on this shard and has to be disarmed here too. Reactor threads only.
+ * @param deadline The deadline (zeroed memory is a disarmed one).
+ * @param delay_ms How long from now, on the shard's clock (read once per loop round).
+ * @param fire Called with arg when the deadline is due.
+ * @param arg Passed to fire.
+ */
+void reactor_arm(deadline_t* deadline, int delay_ms, void (*fire)(void* arg), void* arg);
+
+/**
+ * @brief Disarms a deadline armed with reactor_arm(). Nothing happens if it is not armed. Owning shard only.
+ * @param deadline The deadline.
+ */
+void reactor_disarm(deadline_t* deadline);
+
+/**
+ * @brief Arms the idle deadline of the player's connection: server_on_idle() runs after delay_ms
+ * unless it is armed again first. The deadline goes away with the connection (unwatch, migration,
+ * close), the player is watched again on arrival. Owning shard only.
+ * @param player The player.
+ * @param delay_ms How long from now.
+ */
+void reactor_arm_idle(const player_t* player, int delay_ms);
+
+/**
+ * @brief Asks a shard to run its tick (server_on_tick()) within a second, if it is not due already.
+ * The shard does not tick otherwise. Any thread; does nothing while no reactor is running.
+ * @param shard The shard.
+ */
+void reactor_schedule_tick(int shard);
+
+#endif // REACTOR_H
@@ -0,0 +1,82 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief PCG32 (XSH RR, single stream) generator: 8 bytes of state, one multiply per 32-bit
+ * output. Every generator walks the same 2^64-long cycle; rng_seed() puts each one at an
+ * independent, well mixed position in it, so games and workers do not overlap in practice.
+ */
+typedef struct
+{
+	uint64_t state;
+} rng_t;
+
+/**
+ * @brief SplitMix64 finalizer: spreads the bits of x, for deriving seeds from seeds.
+ */
+uint64_t rng_mix(uint64_t x);
+
+/**
+ * @brief Seeds a generator. Different (seed, stream) pairs give unrelated sequences.
+ * @param rng The generator.
+ * @param seed The seed, e.g. the master seed.
+ * @param stream What the generator is for, e.g. a room or a worker thread.
+ */
+void rng_seed(rng_t* rng, uint64_t seed, uint64_t stream);
+
+/**
+ * @brief Seeds child from the next outputs of rng and a stream number - for handing
+ * independent generators to workers from one master generator.
+ */
+void rng_split(rng_t* rng, rng_t* child, uint64_t stream);
+
+/**
+ * @brief Fills out with die rolls (1-6), eleven per 32-bit output (see rng.c), as
+ * unbiased as rng_roll(). Not the same sequence as rng_roll().
+ * @param rng The generator.
+ * @param out The rolls.
+ * @param count How many.
+ */
+void rng_rolls(rng_t* rng, uint8_t* out, size_t count);
+
+static inline uint32_t rng_next(rng_t* rng)
+{
+	const uint64_t old = rng->state;
+	rng->state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+	const uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+	const uint32_t rot = (uint32_t)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/**
+ * @brief Uniform number in [0, bound), bound > 0. Lemire's multiply-shift: the modulo that
+ * rejects the biased low end is only computed in the rare case it may be needed.
+ */
+static inline uint32_t rng_below(rng_t* rng, const uint32_t bound)
+{
+	uint64_t m = (uint64_t)rng_next(rng) * bound;
+	uint32_t low = (uint32_t)m;
+	if (low < bound)
+	{
+		const uint32_t threshold = -bound % bound;
+		while (low < threshold)
+		{
+			m = (uint64_t)rng_next(rng) * bound;
+			low = (uint32_t)m;
+		}
+	}
+	return (uint32_t)(m >> 32);
+}
+
+/**
+ * @brief One die roll, 1-6.
+ */
+static inline int rng_roll(rng_t* rng)
+{
+	return (int)rng_below(rng, 6) + 1;
+}
+
+#endif // RNG_H
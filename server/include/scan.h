@@ -0,0 +1,28 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Picks the fastest newline scanning kernel the CPU supports (AVX2, SSE2 or scalar).
+ * Call once at startup, before any scan_newlines().
+ */
+void scan_init(void);
+
+/**
+ * @brief Name of the kernel picked by scan_init(), for the startup log.
+ */
+const char* scan_kernel_name(void);
+
+/**
+ * @brief Finds the '\n' bytes of a buffer in one pass.
+ * @param data The bytes to scan.
+ * @param len Number of bytes.
+ * @param out Receives the offsets of the newlines (relative to data), in order.
+ * @param max Capacity of out.
+ * @return Number of offsets stored. If it equals max, the scan stopped at the last one.
+ */
+size_t scan_newlines(const char* data, size_t len, uint32_t* out, size_t max);
+
+#endif // SCAN_H
@@ -13,10 +13,9 @@ int run_server(int port, const char* address);
 
 /**
  * @brief Sends GAME_WIN/GAME_LOSE messages to players when the game ends.
- * @param room The room where the game finished.
- * @param game The final game state (contains winner info).
+ * @param room The room where the game finished (its game holds the winner).
  */
-void broadcast_game_over(const room_t* room, const game_state* game);
+void broadcast_game_over(const room_t* room);
 
 /**
  * @brief Broadcasts the start of a game to both players in a room.
@@ -28,30 +27,61 @@ void broadcast_game_start(const room_t* room, int first_to_act);
 /**
  * @brief Broadcasts the current state of the game to both players.
  * @param room The room where the game is being played.
- * @param game The current state of the game.
  */
-void broadcast_game_state(const room_t* room, const game_state* game);
+void broadcast_game_state(const room_t* room);
 
 /**
 * @brief Send user an OK response with the game status on RESUME
 *  @param player The resuming player
  * @param room The room where the game is being played.
- * @param game The current state of the game.
 */
-void send_game_state(const player_t* player, const room_t* room, const game_state* game);
+void send_game_state(const player_t* player, const room_t* room);
 
 /**
- * @brief The main thread function for handling a single client connection.
- * @param arg A pointer to the player_t object for the connected client.
- * @return NULL.
+ * @brief Reactor callback for a freshly accepted (non-blocking) client socket.
+ * @param client_socket The accepted socket.
+ * @param shard The reactor shard that accepted it and will own it.
+ * @return 0 if the connection was taken, -1 if it was rejected and closed.
  */
-void* client_handler_thread(void* arg);
+int server_on_accept(int client_socket, int shard);
 
 /**
- * @brief The main thread function for managing a single game session.
- * @param arg A pointer to the room_t object for the game.
- * @return NULL.
+ * @brief Reactor callback when a watched client socket is readable or hung up.
+ * Drains the socket and runs every complete command through the player's session state machine,
+ * until the socket is drained, closed or migrated to another shard.
+ * @param player The player owning the socket.
  */
-void* game_thread_func(void* arg);
+void server_on_readable(player_t* player);
+
+/**
+ * @brief Reactor callback when a player's socket arrives from another shard.
+ * Runs the command that triggered the move, or puts a player moved to be paired back in the
+ * quick-match queue, then drains whatever came in meanwhile.
+ * @param player The migrated player, already watched by this shard.
+ * @param command The raw command line to re-run, or NULL.
+ */
+void server_on_migrated(player_t* player, const char* command);
+
+/**
+ * @brief Reactor callback when a client stayed over the send high-water mark for too long.
+ * Its pending output is already discarded; the player is dropped like on a lost connection.
+ * @param player The player not reading their messages.
+ */
+void server_on_slow_consumer(player_t* player);
+
+/**
+ * @brief Reactor callback when a player's idle deadline is due. A player who was heard from in
+ * the meantime is watched again; otherwise a running game is paused and anyone else is disconnected.
+ * @param player The player, on the calling shard.
+ */
+void server_on_idle(player_t* player);
+
+/**
+ * @brief Reactor callback for the shard tick, run after reactor_schedule_tick(). Publishes the
+ * shard's lobby feed and pairs players waiting for a quick match (a room emptied, or a lower shard
+ * waits for one of them). Only players owned by the given shard are touched.
+ * @param shard The shard whose tick this is.
+ */
+void server_on_tick(int shard);
 
 #endif // SERVER_H
@@ -0,0 +1,102 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+/*
+ * Minimal io_uring wrapper on top of the raw syscalls (no liburing needed):
+ * submission/completion rings and one ring of provided receive buffers.
+ * A ring is owned by a single thread.
+ */
+typedef struct
+{
+	int fd;
+
+	// Submission ring
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned sq_pending;      // SQEs filled in but not passed to the kernel yet
+
+	// Completion ring
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+
+	// Provided buffers (buffer group 0) for multishot receives
+	struct io_uring_buf_ring* buf_ring;
+	char* buf_base;
+	unsigned buf_count;
+	unsigned buf_size;
+
+	void* sq_map;
+	size_t sq_map_len;
+	void* cq_map;
+	size_t cq_map_len;
+	size_t sqes_map_len;
+	size_t buf_ring_len;
+} uring_t;
+
+/**
+ * @brief Creates a ring and registers its provided buffer group 0.
+ * Fails if the kernel lacks anything the reactor relies on (ring buffers, extended wait arguments).
+ * @param ring The ring to initialize.
+ * @param entries Submission queue size (the completion queue gets four times as many).
+ * @param buf_count Number of provided receive buffers, a power of two.
+ * @param buf_size Size of each provided receive buffer.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+int uring_init(uring_t* ring, unsigned entries, unsigned buf_count, unsigned buf_size);
+
+/**
+ * @brief Unmaps and closes the ring.
+ * @param ring The ring to destroy.
+ */
+void uring_destroy(uring_t* ring);
+
+/**
+ * @brief Returns a zeroed submission entry, submitting the queued ones first if the ring is full.
+ * @param ring The ring.
+ * @return The entry, or NULL if the kernel refused to take any.
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/**
+ * @brief Submits the queued entries and waits for at least one completion or the timeout.
+ * @param ring The ring.
+ * @param timeout_ms How long to wait, 0 to only submit, -1 to wait for as long as it takes.
+ * @return 0 on success (including timeout and EINTR), -1 on error (errno is set).
+ */
+int uring_submit_and_wait(uring_t* ring, int timeout_ms);
+
+/**
+ * @brief Returns the next completion or NULL if there is none. Call uring_cqe_seen() when done with it.
+ * @param ring The ring.
+ */
+struct io_uring_cqe* uring_peek_cqe(const uring_t* ring);
+
+/**
+ * @brief Releases the completion returned by uring_peek_cqe() back to the kernel.
+ * @param ring The ring.
+ */
+void uring_cqe_seen(const uring_t* ring);
+
+/**
+ * @brief Returns the data of a provided buffer picked by the kernel for a completion.
+ * @param ring The ring.
+ * @param bid Buffer id from the completion flags.
+ */
+const char* uring_buffer(const uring_t* ring, unsigned bid);
+
+/**
+ * @brief Hands a provided buffer back to the kernel once its data has been consumed.
+ * @param ring The ring.
+ * @param bid Buffer id from the completion flags.
+ */
+void uring_recycle_buffer(uring_t* ring, unsigned bid);
+
+#endif // URING_H
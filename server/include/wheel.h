@@ -0,0 +1,94 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+#define WHEEL_TICK_MS 10   // resolution: deadlines fire within one tick after they are due
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4     // 64^4 ticks, about 46 hours; later deadlines wait in the last level
+
+struct timer_wheel_s;
+
+/**
+ * @brief One pending timeout, embedded in whatever it belongs to (a connection, a room).
+ * Zeroed memory is a deadline that is not armed.
+ */
+typedef struct deadline_s
+{
+	struct deadline_s* next;
+	struct deadline_s** link;      // what points at this one, NULL while not armed
+	struct timer_wheel_s* wheel;   // the wheel it is armed on
+	uint64_t expires;              // in ticks
+	void (*fire)(void* arg);
+	void* arg;
+	unsigned slot;                 // level * WHEEL_SLOTS + slot
+} deadline_t;
+
+/**
+ * @brief Hierarchical timer wheel: arming and cancelling a deadline is O(1), and advancing
+ * the clock touches only the slots that hold something. Not thread-safe - one per shard.
+ *
+ * Level 0 has a slot per tick, every level above a slot per WHEEL_SLOTS slots of the one
+ * below. A deadline goes into the lowest level that reaches it and moves down a level
+ * each time the clock gets to its slot, so it is moved at most WHEEL_LEVELS - 1 times.
+ * Per level a bitmap tells which slots hold deadlines, which is how wheel_timeout()
+ * finds the next one without looking at them.
+ */
+typedef struct timer_wheel_s
+{
+	uint64_t now;                                 // the next tick to process
+	uint64_t occupied[WHEEL_LEVELS];              // bit per non-empty slot
+	deadline_t* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	int count;                                    // deadlines armed
+} timer_wheel_t;
+
+/**
+ * @brief Starts an empty wheel at the given time.
+ * @param wheel The wheel.
+ * @param now_ms The current time, in milliseconds of a monotonic clock.
+ */
+void wheel_init(timer_wheel_t* wheel, uint64_t now_ms);
+
+/**
+ * @brief Arms a deadline, replacing its earlier arming if there is one.
+ * @param wheel The wheel.
+ * @param deadline The deadline.
+ * @param expires_ms When it is due, on the clock passed to wheel_advance(). A time that has
+ *        passed already fires on the next advance.
+ * @param fire Called once from wheel_advance() when it is due. It may arm and cancel deadlines,
+ *        this one included.
+ * @param arg Passed to fire.
+ */
+void wheel_arm(timer_wheel_t* wheel, deadline_t* deadline, uint64_t expires_ms, void (*fire)(void* arg), void* arg);
+
+/**
+ * @brief Disarms a deadline. Nothing happens if it is not armed.
+ * @param deadline The deadline.
+ */
+void wheel_cancel(deadline_t* deadline);
+
+/**
+ * @brief Whether a deadline is armed.
+ */
+static inline int wheel_armed(const deadline_t* deadline)
+{
+	return deadline->link != 0;
+}
+
+/**
+ * @brief Fires every deadline due by now_ms, in order of their ticks.
+ * @param wheel The wheel.
+ * @param now_ms The current time.
+ */
+void wheel_advance(timer_wheel_t* wheel, uint64_t now_ms);
+
+/**
+ * @brief How long a caller may sleep before it has to call wheel_advance() again.
+ * @param wheel The wheel.
+ * @param now_ms The current time.
+ * @return Milliseconds, 0 if something is due already, -1 if no deadline is armed.
+ */
+int wheel_timeout(const timer_wheel_t* wheel, uint64_t now_ms);
+
+#endif // WHEEL_H
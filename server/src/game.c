@@ -1,59 +1,232 @@
+/*
+ * game.c - Pig rules and the game store
+ *
+ * The store is a single MAP_NORESERVE mapping holding one array per field
+ * (see game.h), each starting on its own cache line. A game's bytes are
+ * spread over the arrays, but a move touches a handful of lines, and the
+ * sweeps over all games (game_stats()) read plain byte arrays the compiler
+ * can vectorize. The pages of rooms never used are never touched.
+ *
+ * The rules themselves (pig_step()) work on one game by value and know
+ * nothing of the store, sockets or logs.
+ */
+
 #include "game.h"
-#include "protocol.h"
 #include "config.h"
-#include "logger.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
+#include <sys/mman.h>
+
+_Static_assert(WINNING_SCORE + 6 <= UINT8_MAX, "scores are stored in bytes");
 
-void init_game(game_state* game, const int p1_fd, const int p2_fd)
+game_store_t games;
+
+static size_t field_bytes(const size_t size, const int capacity)
 {
-	game->player_fds[0] = p1_fd;
-	game->player_fds[1] = p2_fd;
-	game->scores[0] = 0;
-	game->scores[1] = 0;
-	game->current_player = rand_r(&game->rand_seed) % 2;
-	game->turn_score = 0;
-	game->game_over = 0;
-	game->game_winner = -1;
-	game->roll_result = 0;
-	LOG(LOG_GAME, "New game initialized for players on sockets %d and %d.", p1_fd, p2_fd);
+	return (size * (size_t)capacity + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
 }
 
-void handle_roll(game_state* game)
+int init_games(const int capacity)
 {
-	const int roll = (rand_r(&game->rand_seed) % 6) + 1;
-	game->roll_result = roll;
-	LOG(LOG_GAME, "Player %d rolled a %d.", game->current_player, roll);
+	const size_t rng_bytes = field_bytes(sizeof(rng_t), capacity);
+	const size_t byte_field = field_bytes(1, capacity);
+	char* base = mmap(
+		NULL, rng_bytes + 7 * byte_field, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+	);
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
 
-	if (roll == 1)
+	// All zeros is GAME_NONE everywhere
+	games.rng = (rng_t*)base;
+	char* next = base + rng_bytes;
+	uint8_t** fields[] = {
+		&games.scores[0], &games.scores[1], &games.turn_score, &games.roll, &games.current_player, &games.status
+	};
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i, next += byte_field)
 	{
-		game->turn_score = 0;
-		switch_player(game);
+		*fields[i] = (uint8_t*)next;
 	}
-	else
+	games.winner = (int8_t*)next;
+	games.capacity = capacity;
+	return 0;
+}
+
+/*
+ * The rules as data: what a move does, by action and roll (0 when the action rolls
+ * nothing). pig_step() only follows the table, so a variant of Pig is a table edit.
+ */
+typedef struct
+{
+	uint8_t any_turn; // may be taken when it is not the player's turn
+	uint8_t add_roll; // the roll counts towards the turn
+	uint8_t bust;     // the turn's points are lost and the turn passes
+	uint8_t bank;     // the turn's points are banked and the turn passes
+	uint8_t forfeit;  // the opponent wins
+} pig_rule_t;
+
+#define ROLL_RULE(face) [PIG_ROLL][face] = { .add_roll = 1 }
+
+static const pig_rule_t rules[PIG_ACTIONS][7] = {
+	[PIG_ROLL][1] = { .bust = 1 },
+	ROLL_RULE(2), ROLL_RULE(3), ROLL_RULE(4), ROLL_RULE(5), ROLL_RULE(6),
+	[PIG_HOLD][0] = { .bank = 1 },
+	[PIG_QUIT][0] = { .any_turn = 1, .forfeit = 1 },
+};
+
+static void emit(pig_events_t* events, const pig_event_type type, const int player, const int value)
+{
+	pig_event_t* event = &events->events[events->count++];
+	event->type = (uint8_t)type;
+	event->player = (uint8_t)player;
+	event->value = (uint8_t)value;
+}
+
+pig_state_t pig_new_game(const int first_player)
+{
+	const pig_state_t state = {
+		.current_player = (uint8_t)first_player,
+		.status = GAME_RUNNING,
+		.winner = -1,
+	};
+	return state;
+}
+
+int pig_accepts(const pig_state_t* state, const int player, const pig_action action)
+{
+	return
+		state->status == GAME_RUNNING &&
+		(unsigned)action < PIG_ACTIONS &&
+		(player == state->current_player || rules[action][0].any_turn);
+}
+
+pig_state_t pig_step(pig_state_t state, const int player, const pig_action action, const int roll, pig_events_t* events)
+{
+	events->count = 0;
+	const int face = action == PIG_ROLL ? roll : 0;
+	if (!pig_accepts(&state, player, action) || face < 0 || face > 6 || (action == PIG_ROLL && face == 0))
 	{
-		game->turn_score += roll;
+		emit(events, PIG_REJECTED, player, 0);
+		return state;
+	}
+	const pig_rule_t* rule = &rules[action][face];
 
-		if (game->scores[game->current_player] + game->turn_score >= WINNING_SCORE)
+	if (rule->forfeit)
+	{
+		state.status = GAME_OVER;
+		state.winner = (int8_t)(1 - player);
+		emit(events, PIG_WON, 1 - player, 0);
+		return state;
+	}
+	if (action == PIG_ROLL)
+	{
+		state.roll = (uint8_t)roll;
+		emit(events, PIG_ROLLED, player, roll);
+	}
+	if (rule->add_roll)
+	{
+		state.turn_score += (uint8_t)roll;
+		if (state.scores[player] + state.turn_score >= WINNING_SCORE)
 		{
-			game->game_over = 1;
-			game->game_winner = game->current_player;
+			state.status = GAME_OVER;
+			state.winner = (int8_t)player;
+			emit(events, PIG_WON, player, 0);
 		}
+		return state;
+	}
+	if (rule->bust)
+	{
+		state.turn_score = 0;
+		emit(events, PIG_BUSTED, player, 0);
 	}
+	if (rule->bank)
+	{
+		state.scores[player] += state.turn_score;
+		emit(events, PIG_HELD, player, state.turn_score);
+		state.turn_score = 0;
+		state.roll = 0;
+	}
+	state.current_player = (uint8_t)(1 - player);
+	emit(events, PIG_TURN, 1 - player, 0);
+	return state;
 }
 
-void handle_hold(game_state* game)
+pig_state_t load_game(const int game)
 {
-	game->scores[game->current_player] += game->turn_score;
-	LOG(LOG_GAME, "Player %d holds. Score for turn: %d. New total: %d.", game->current_player, game->turn_score, game->scores[game->current_player]);
-	game->turn_score = 0;
-	game->roll_result = 0;
-	switch_player(game);
+	const pig_state_t state = {
+		.scores = { games.scores[0][game], games.scores[1][game] },
+		.turn_score = games.turn_score[game],
+		.roll = games.roll[game],
+		.current_player = games.current_player[game],
+		.status = games.status[game],
+		.winner = games.winner[game],
+	};
+	return state;
 }
 
-void switch_player(game_state* game)
+void save_game(const int game, const pig_state_t* state)
 {
-	game->current_player = 1 - game->current_player;
-	LOG(LOG_GAME, "Switching turn to player %d.", game->current_player);
+	games.scores[0][game] = state->scores[0];
+	games.scores[1][game] = state->scores[1];
+	games.turn_score[game] = state->turn_score;
+	games.roll[game] = state->roll;
+	games.current_player[game] = state->current_player;
+	games.status[game] = state->status;
+	games.winner[game] = state->winner;
+}
+
+void init_game(const int game)
+{
+	const pig_state_t state = pig_new_game((int)rng_below(&games.rng[game], 2));
+	save_game(game, &state);
+}
+
+void play_move(const int game, const int player, const pig_action action, pig_events_t* events)
+{
+	pig_state_t state = load_game(game);
+	const int roll = action == PIG_ROLL && pig_accepts(&state, player, action) ? rng_roll(&games.rng[game]) : 0;
+	state = pig_step(state, player, action, roll, events);
+	save_game(game, &state);
+}
+
+void end_game(const int game, const int winner)
+{
+	games.winner[game] = (int8_t)winner;
+	games.status[game] = GAME_OVER;
+}
+
+void clear_game(const int game)
+{
+	games.status[game] = GAME_NONE;
+}
+
+void game_stats(game_stats_t* stats, const int bound)
+{
+	const uint8_t* status = games.status;
+	const int8_t* winner = games.winner;
+	const uint8_t* scores0 = games.scores[0];
+	const uint8_t* scores1 = games.scores[1];
+
+	// Whole blocks of a fixed size and no branches: each block is a few vector instructions
+	// (gcc -O2 only vectorizes loops it needs no scalar remainder for). Reading up to a whole
+	// block past bound is safe: the fields are padded to whole cache lines, and there are no
+	// games past bound.
+	int running = 0;
+	int decided = 0;
+	long points = 0;
+	for (int block = 0; block < bound; block += CACHE_LINE)
+	{
+		int block_points = 0;
+		for (int i = block; i < block + CACHE_LINE; ++i)
+		{
+			const int is_running = status[i] == GAME_RUNNING;
+			running += is_running;
+			decided += (status[i] == GAME_OVER) & (winner[i] >= 0);
+			block_points += is_running * (scores0[i] + scores1[i]);
+		}
+		points += block_points;
+	}
+	stats->running = running;
+	stats->decided = decided;
+	stats->points = points;
 }
@@ -1,8 +1,21 @@
 /*
  * lobby.c - Player and room management
  *
- * All functions here are thread-safe (use lobby_mutex).
- * Players and rooms are stored in fixed-size arrays allocated at startup.
+ * All functions here are thread-safe. Players and rooms live in pools (pool.h) sized
+ * for the -p/-r ceilings: the arrays never move, but only the chunks in use are backed
+ * by memory. Rooms are created a chunk at a time when first looked up; player chunks
+ * are created when the live ones are full and given back once they empty out.
+ * There is no lock over the whole lobby:
+ *   room->mutex       - membership and state of one room
+ *   slot_mutex        - the player slot free list
+ *   nick_mutex        - the nickname index
+ *   room_list_mutex   - the cached LIST_ROOMS reply
+ *   room_index_mutex  - the per-state room index and the empty-room bitmap
+ *   feed->mutex       - the lobby feed of one shard
+ * When nested they are taken in this order: room_list_mutex, room->mutex, slot_mutex,
+ * nick_mutex; room_index_mutex and feed->mutex are always the innermost. Nothing is sent while a lock is
+ * held - messages are built under the lock and sent after it is released.
+ * The quick-match queues need no lock: each shard's queue is only changed by that shard.
  */
 
 #include "lobby.h"
@@ -12,219 +25,793 @@
 #include "config.h"
 #include "logger.h"
 #include "protocol.h"
+#include "reactor.h"
+#include "pool.h"
 
-// Global arrays for players and rooms
+// Global arrays for players and rooms (the pools' memory)
 player_t* players;
 room_t* rooms;
+static pool_t player_pool;
+static pool_t room_pool;
 static int player_count = 0;
-static pthread_mutex_t lobby_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t slot_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Forward declaration for static helper function
-static void remove_player_from_room(room_t* room, player_t* player);
+#define PLAYER_CHUNK_MIN 256
+#define ROOM_CHUNK_MIN 256
 
-void broadcast_room_update(const room_t* room)
+/*
+ * Free player slots, a stack of indexes into players per live chunk, so add_player() does
+ * not search. Chunk k's stack is free_slots[k * chunk_items ...]. New players go to the
+ * lowest chunk with a free slot, which keeps the higher chunks draining so they can be
+ * released. A slot is free when nobody is connected on it and it is not held for a
+ * reconnect (socket == -1 and state == LOBBY); a disconnected player in a game keeps theirs.
+ * Protected by slot_mutex, as is player_count.
+ */
+static int* free_slots;
+static int* chunk_free;                    // free slots per player chunk
+static unsigned long long* chunks_with_free; // bit k: chunk k is live and has a free slot
+static int chunk_words;
+static int spare_chunk = -1;               // an empty chunk kept because it is next in line, -1 if none
+
+/*
+ * The LIST_ROOMS reply is the same for every requester until a room changes, so it is
+ * serialized once (in both encodings) and reused. Every room change goes through
+ * broadcast_room_update(), which bumps room_list_version; the next LIST_ROOMS then
+ * rebuilds the list. A list is immutable once published and refcounted: the output queues
+ * send it by reference (reactor_send_shared()), and one still sending an older list is
+ * not disturbed by a rebuild.
+ */
+typedef struct
+{
+	unsigned long version; // room_list_version the list was built at
+	int refs;              // the cache holds one, every output queue sending it another
+	char* text;            // ROOM_INFO lines
+	size_t text_len;
+	char* bin;             // ROOM_INFO frames
+	size_t bin_len;
+} room_list_t;
+
+static unsigned long room_list_version = 1;
+static room_list_t* room_list = NULL;
+static pthread_mutex_t room_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Per-state room index for paged LIST_ROOMS: bit i of room_index[s] is set while room i
+ * is in state s. Kept in step by broadcast_room_update(), which every room change goes
+ * through. room_index_mutex is taken last, nothing else is locked while holding it.
+ */
+#define INDEX_WORD_BITS 64
+static unsigned long long* room_index[NUM_ROOM_STATES];
+static unsigned char* indexed_state; // the state each room is filed under
+static int room_index_words;
+static unsigned long long* empty_rooms; // bit i: room i is WAITING with nobody in it
+static int empty_rooms_hint;            // no empty room below this word
+static pthread_mutex_t room_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Nickname index: open addressing with linear probing, one entry (a player slot) per
+ * nickname, keyed by the nickname stored in the slot itself. At most half full, so
+ * probes stay short; deletion shifts the rest of the cluster back instead of leaving
+ * tombstones. Protected by nick_mutex, which also covers the socket of an indexed player
+ * going to -1 (it decides which of the two lookups finds them).
+ */
+typedef struct
+{
+	unsigned int hash;
+	int slot; // index into players plus one, 0 if the entry is empty (the table starts out zeroed)
+} nick_entry_t;
+
+static nick_entry_t* nick_index;
+static unsigned int nick_index_mask;
+static pthread_mutex_t nick_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Lobby feed of a shard: its subscribers (logged-in players in the lobby whose socket it
+ * owns) and the rooms that changed since its last publish, each listed once. The first
+ * change asks the shard for a tick, in which it renders the changed rooms as they are now,
+ * once, and queues the batch for every subscriber, so a busy room costs one line per tick
+ * rather than one send to every lobby player per change.
+ */
+typedef struct
+{
+	_Alignas(CACHE_LINE) pthread_mutex_t mutex; // feeds of different shards never share a line
+	int* dirty;               // changed rooms
+	int* publishing;          // the previous dirty list, swapped out by the publish
+	unsigned char* is_dirty;  // per room, whether it is in dirty
+	int dirty_count;
+	int* subscribers;         // player slots
+	int subscriber_count;
+	int* sockets;             // the subscribers' sockets, copied out by the publish
+	char* text;               // the batch being published, ROOM_INFO lines
+	size_t text_cap;
+	char* bin;                // and frames
+	size_t bin_cap;
+} lobby_feed_t;
+
+static lobby_feed_t* feeds;
+static int feed_count;
+
+// Where a player is among the feeds' subscribers, per player slot; kept out of player_t
+typedef struct
+{
+	int feed;  // the shard whose feed the player is subscribed to
+	int index; // position among its subscribers, -1 if not subscribed
+} subscription_t;
+
+static subscription_t* subscriptions;
+
+/*
+ * Quick-match queues, one per shard: its players waiting to be paired, oldest first,
+ * linked through match_links by player slot so that a player can leave from anywhere in
+ * O(1). Only the shard owning the players changes its queue; other shards just read its
+ * length to find someone to pair with.
+ */
+typedef struct
+{
+	int prev;  // player slots, -1 at the ends
+	int next;
+	int shard; // the queue the player is in, -1 if not waiting
+	int moving; // taken out to wait on another shard, queued there on arrival
+} match_link_t;
+
+typedef struct
 {
-	char id_str[4], p_count_str[4], state_str[15];
-	sprintf(id_str, "%d", room->id);
-	sprintf(p_count_str, "%d", room->player_count);
+	_Alignas(CACHE_LINE) int head; // -1 if empty
+	int tail;
+	int length;
+} match_queue_t;
+
+static match_link_t* match_links;
+static match_queue_t* match_queues;
 
-	switch (room->state)
+// FNV-1a
+static unsigned int nick_hash(const char* nickname)
+{
+	unsigned int hash = 2166136261u;
+	for (const unsigned char* p = (const unsigned char*)nickname; *p; ++p)
 	{
-		case WAITING: strcpy(state_str, "WAITING");
-			break;
-		case IN_PROGRESS: strcpy(state_str, "IN_PROGRESS");
-			break;
-		case PAUSED: strcpy(state_str, "PAUSED");
-			break;
-		case ABORTED: strcpy(state_str, "ABORTED");
-			break;
+		hash = (hash ^ *p) * 16777619u;
 	}
+	return hash;
+}
 
-	for (int i = 0; i < MAX_PLAYERS; ++i)
+// Position of the nickname's entry, or of the empty entry where it would go
+static unsigned int nick_find(const char* nickname, const unsigned int hash)
+{
+	unsigned int i = hash & nick_index_mask;
+	while (
+		nick_index[i].slot != 0 &&
+		(nick_index[i].hash != hash || strcmp(players[nick_index[i].slot - 1].nickname, nickname) != 0)
+	)
+	{
+		i = (i + 1) & nick_index_mask;
+	}
+	return i;
+}
+
+static player_t* nick_lookup(const char* nickname)
+{
+	const int slot = nick_index[nick_find(nickname, nick_hash(nickname))].slot;
+	return slot == 0 ? NULL : &players[slot - 1];
+}
+
+static void nick_insert(const player_t* player)
+{
+	const unsigned int hash = nick_hash(player->nickname);
+	const unsigned int i = nick_find(player->nickname, hash);
+	nick_index[i].hash = hash;
+	nick_index[i].slot = (int)(player - players) + 1;
+}
+
+// Drops the player's nickname from the index, if it is the player the index knows it for; the caller holds nick_mutex
+static void nick_remove(const player_t* player)
+{
+	if (player->nickname[0] == '\0')
+	{
+		return;
+	}
+	unsigned int i = nick_find(player->nickname, nick_hash(player->nickname));
+	if (nick_index[i].slot != (int)(player - players) + 1)
 	{
-		if (players[i].socket != -1 && players[i].state == LOBBY)
+		return;
+	}
+
+	// Move later entries of the cluster into the hole unless that would put them before their home
+	for (unsigned int j = (i + 1) & nick_index_mask; nick_index[j].slot != 0; j = (j + 1) & nick_index_mask)
+	{
+		const unsigned int home = nick_index[j].hash & nick_index_mask;
+		if (((j - home) & nick_index_mask) >= ((j - i) & nick_index_mask))
 		{
-			send_structured_message(
-				players[i].socket, S_ROOM_INFO, 3,
-				K_ROOM, id_str,
-				K_COUNT, p_count_str,
-				K_STATE, state_str
-			);
+			nick_index[i] = nick_index[j];
+			i = j;
 		}
 	}
+	nick_index[i].slot = 0;
 }
 
-void init_lobby()
+/*
+ * Appends the ROOM_INFO fields of a room. A room that was never created is an empty
+ * WAITING one, it is described without creating it.
+ */
+static void add_room_info(message_t* msg, const int room_id)
 {
-	pthread_mutex_lock(&lobby_mutex);
-	players = malloc(sizeof(player_t) * MAX_PLAYERS);
-	rooms = malloc(sizeof(room_t) * MAX_ROOMS);
-	for (int i = 0; i < MAX_PLAYERS; ++i)
+	if (!pool_is_live(&room_pool, room_id))
 	{
-		players[i].socket = -1;
-		players[i].nickname[0] = '\0';
-		players[i].state = LOBBY;
-		players[i].room_id = -1;
+		room_t blank = { .id = room_id, .state = WAITING, .player_count = 0 };
+		msg_add_room_info(msg, &blank);
+		return;
 	}
-	for (int i = 0; i < MAX_ROOMS; ++i)
+	room_t* room = &rooms[room_id];
+	pthread_mutex_lock(&room->mutex);
+	msg_add_room_info(msg, room);
+	pthread_mutex_unlock(&room->mutex);
+}
+
+// Files the room under its current state; the caller holds room->mutex
+static void index_room(const room_t* room)
+{
+	const int id = room->id;
+	const unsigned long long bit = 1ULL << (id % INDEX_WORD_BITS);
+	pthread_mutex_lock(&room_index_mutex);
+	if (indexed_state[id] != room->state)
 	{
-		rooms[i].id = i;
-		rooms[i].state = WAITING;
-		rooms[i].player_count = 0;
-		for (int j = 0; j < MAX_PLAYERS_PER_ROOM; j++)
+		room_index[indexed_state[id]][id / INDEX_WORD_BITS] &= ~bit;
+		room_index[room->state][id / INDEX_WORD_BITS] |= bit;
+		indexed_state[id] = (unsigned char)room->state;
+	}
+	if (room->state == WAITING && room->player_count == 0)
+	{
+		empty_rooms[id / INDEX_WORD_BITS] |= bit;
+		if (id / INDEX_WORD_BITS < empty_rooms_hint)
 		{
-			rooms[i].players[j] = NULL;
+			empty_rooms_hint = id / INDEX_WORD_BITS;
 		}
-		pthread_mutex_init(&rooms[i].mutex, NULL);
-		pthread_cond_init(&rooms[i].cond, NULL);
 	}
-	player_count = 0;
-	pthread_mutex_unlock(&lobby_mutex);
-	LOG(LOG_LOBBY, "Lobby initialized with %d rooms and %d player slots.", MAX_ROOMS, MAX_PLAYERS);
+	else
+	{
+		empty_rooms[id / INDEX_WORD_BITS] &= ~bit;
+	}
+	pthread_mutex_unlock(&room_index_mutex);
 }
 
-player_t* add_player(const int socket)
+int find_empty_room(const int from)
 {
-	pthread_mutex_lock(&lobby_mutex);
-	if (player_count >= MAX_PLAYERS)
+	if (from < 0 || from >= MAX_ROOMS)
 	{
-		pthread_mutex_unlock(&lobby_mutex);
-		return NULL;
+		return -1;
+	}
+	int found = -1;
+	pthread_mutex_lock(&room_index_mutex);
+	int w = from / INDEX_WORD_BITS;
+	if (w < empty_rooms_hint)
+	{
+		w = empty_rooms_hint;
 	}
-	for (int i = 0; i < MAX_PLAYERS; ++i)
+	// The hint is room_index_words when no room was empty: nothing to read then
+	for (; w < room_index_words; ++w)
 	{
-		// A slot is only free if the socket is -1 AND the player is not in a game.
-		// A player with state IN_GAME and socket -1 is a disconnected player waiting for reconnect.
-		if (players[i].socket == -1 && players[i].state == LOBBY)
+		unsigned long long word = empty_rooms[w];
+		if (w == from / INDEX_WORD_BITS)
 		{
-			players[i].socket = socket;
-			players[i].state = LOBBY;
-			players[i].nickname[0] = '\0';
-			players[i].room_id = -1;
-			players[i].buffer_len = 0;
-			players[i].read_buffer[0] = '\0';
-			players[i].last_activity = time(NULL);
-			player_count++;
-			LOG(LOG_LOBBY, "Player slot %d assigned to socket %d. Total players: %d", i, socket, player_count);
-			pthread_mutex_unlock(&lobby_mutex);
-			return &players[i];
+			// Bits below from in its own word do not count
+			word &= ~0ULL << (from % INDEX_WORD_BITS);
+		}
+		if (word)
+		{
+			found = w * INDEX_WORD_BITS + __builtin_ctzll(word);
+			break;
 		}
 	}
-	pthread_mutex_unlock(&lobby_mutex);
-	return NULL;
+	// Only a search from the start proves that the words before the result are empty
+	if (from == 0)
+	{
+		empty_rooms_hint = found == -1 ? room_index_words : found / INDEX_WORD_BITS;
+	}
+	pthread_mutex_unlock(&room_index_mutex);
+	return found;
 }
 
-void remove_player(player_t* player)
+void broadcast_room_update(room_t* room)
 {
-	pthread_mutex_lock(&lobby_mutex);
-	if (player && player->socket != -1)
+	pthread_mutex_lock(&room->mutex);
+	index_room(room);
+	const int empty = room->state == WAITING && room->player_count == 0;
+	pthread_mutex_unlock(&room->mutex);
+	__atomic_add_fetch(&room_list_version, 1, __ATOMIC_RELEASE);
+
+	for (int i = 0; i < feed_count; ++i)
 	{
-		LOG(LOG_LOBBY, "Removing player %s (socket %d)", player->nickname, player->socket);
-		// If player was in a room, remove them from there first.
-		if (player->room_id != -1)
+		lobby_feed_t* feed = &feeds[i];
+		pthread_mutex_lock(&feed->mutex);
+		const int first = feed->dirty_count == 0;
+		if (!feed->is_dirty[room->id])
 		{
-			room_t* room = &rooms[player->room_id];
-			remove_player_from_room(room, player);
+			feed->is_dirty[room->id] = 1;
+			feed->dirty[feed->dirty_count++] = room->id;
 		}
+		pthread_mutex_unlock(&feed->mutex);
 
-		player->socket = -1;
-		player->state = LOBBY; // Reset state
-		player->room_id = -1;
-		player_count--;
+		// The feed's shard only ticks when asked to, also to pair the players waiting there for a room
+		if (first || (empty && quick_match_length(i) >= 2))
+		{
+			reactor_schedule_tick(i);
+		}
 	}
-	pthread_mutex_unlock(&lobby_mutex);
 }
 
-int join_room(const int room_id, player_t* player)
+static void release_room_list(void* ref)
 {
-	pthread_mutex_lock(&lobby_mutex);
+	room_list_t* list = ref;
+	if (__atomic_sub_fetch(&list->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		free(list->text);
+		free(list->bin);
+		free(list);
+	}
+}
 
-	if (
-		room_id < 0 ||
-		room_id >= MAX_ROOMS ||
-		rooms[room_id].state == IN_PROGRESS ||
-		rooms[room_id].player_count >= MAX_PLAYERS_PER_ROOM
-	)
+static int room_list_append(char** buf, size_t* len, size_t* cap, const char* bytes, const size_t n)
+{
+	if (*len + n > *cap)
 	{
-		pthread_mutex_unlock(&lobby_mutex);
-		return -1;
+		const size_t new_cap = *cap * 2 + n;
+		char* grown = realloc(*buf, new_cap);
+		if (!grown) return -1;
+		*buf = grown;
+		*cap = new_cap;
 	}
+	memcpy(*buf + *len, bytes, n);
+	*len += n;
+	return 0;
+}
 
-	// Check if player is already in the room
-	for (int i = 0; i < rooms[room_id].player_count; ++i)
+// Serializes all rooms; the caller holds room_list_mutex
+static room_list_t* build_room_list(const unsigned long version)
+{
+	room_list_t* list = calloc(1, sizeof(room_list_t));
+	if (!list) return NULL;
+	list->version = version;
+	list->refs = 1;
+	// A ROOM_INFO line is ~40 bytes, a frame ~10
+	size_t text_cap = (size_t)MAX_ROOMS * 48;
+	size_t bin_cap = (size_t)MAX_ROOMS * 12;
+	list->text = malloc(text_cap);
+	list->bin = malloc(bin_cap);
+
+	/*
+	 * Each room is read under its own lock; a change made meanwhile bumps the version
+	 * after the fact, so the list built here is replaced by the next request.
+	 */
+	message_t msg;
+	const char* bytes;
+	size_t len;
+	int failed = !list->text || !list->bin;
+	for (int i = 0; i < MAX_ROOMS && !failed; ++i)
+	{
+		msg_begin(&msg, S_ROOM_INFO);
+		add_room_info(&msg, i);
+		len = msg_encode(&msg, PROTO_TEXT, &bytes);
+		failed = room_list_append(&list->text, &list->text_len, &text_cap, bytes, len);
+		len = msg_encode(&msg, PROTO_BINARY, &bytes);
+		failed = failed || room_list_append(&list->bin, &list->bin_len, &bin_cap, bytes, len);
+	}
+
+	if (failed)
+	{
+		release_room_list(list);
+		return NULL;
+	}
+	return list;
+}
+
+void publish_room_updates(const int shard)
+{
+	lobby_feed_t* feed = &feeds[shard];
+
+	pthread_mutex_lock(&feed->mutex);
+	int* changed = feed->dirty;
+	const int changed_count = feed->dirty_count;
+	feed->dirty = feed->publishing;
+	feed->publishing = changed;
+	feed->dirty_count = 0;
+	for (int i = 0; i < changed_count; ++i)
 	{
-		if (rooms[room_id].players[i] == player)
+		feed->is_dirty[changed[i]] = 0;
+	}
+	const int socket_count = changed_count > 0 ? feed->subscriber_count : 0;
+	for (int i = 0; i < socket_count; ++i)
+	{
+		feed->sockets[i] = players[feed->subscribers[i]].socket;
+	}
+	pthread_mutex_unlock(&feed->mutex);
+
+	if (socket_count == 0)
+	{
+		return;
+	}
+
+	// Only this shard publishes its feed, the batch buffers and the copies are its own
+	message_t msg;
+	const char* bytes;
+	size_t len;
+	size_t text_len = 0;
+	size_t bin_len = 0;
+	int failed = 0;
+	for (int i = 0; i < changed_count && !failed; ++i)
+	{
+		msg_begin(&msg, S_ROOM_INFO);
+		add_room_info(&msg, changed[i]);
+		len = msg_encode(&msg, PROTO_TEXT, &bytes);
+		failed = room_list_append(&feed->text, &text_len, &feed->text_cap, bytes, len);
+		len = msg_encode(&msg, PROTO_BINARY, &bytes);
+		failed = failed || room_list_append(&feed->bin, &bin_len, &feed->bin_cap, bytes, len);
+	}
+	if (failed)
+	{
+		LOG(LOG_LOBBY, "Out of memory while publishing %d room updates on shard %d.", changed_count, shard);
+		return;
+	}
+
+	for (int i = 0; i < socket_count; ++i)
+	{
+		if (get_socket_protocol(feed->sockets[i]) == PROTO_BINARY)
 		{
-			LOG(LOG_LOBBY, "Player %s is already in room %d", player->nickname, room_id);
-			pthread_mutex_unlock(&lobby_mutex);
-			return -1;
+			reactor_send(feed->sockets[i], feed->bin, bin_len);
+		}
+		else
+		{
+			reactor_send(feed->sockets[i], feed->text, text_len);
 		}
 	}
+}
 
-	rooms[room_id].players[rooms[room_id].player_count++] = player;
-	player->state = IN_GAME;
-	player->room_id = room_id;
-	LOG(LOG_LOBBY, "Player %s joined room %d", player->nickname, room_id);
+static void feed_remove(subscription_t* sub)
+{
+	lobby_feed_t* feed = &feeds[sub->feed];
+	pthread_mutex_lock(&feed->mutex);
+	const int last = feed->subscribers[--feed->subscriber_count];
+	feed->subscribers[sub->index] = last;
+	subscriptions[last].index = sub->index;
+	sub->index = -1;
+	pthread_mutex_unlock(&feed->mutex);
+}
 
-	if (rooms[room_id].player_count == MAX_PLAYERS_PER_ROOM)
+void update_lobby_subscription(player_t* player)
+{
+	subscription_t* sub = &subscriptions[player - players];
+	const int wanted = player->socket != -1 && player->state == LOBBY && player->session == SESSION_ACTIVE;
+	if (sub->index != -1 && (!wanted || sub->feed != player->shard))
 	{
-		rooms[room_id].state = IN_PROGRESS;
+		feed_remove(sub);
 	}
+	if (wanted && sub->index == -1)
+	{
+		lobby_feed_t* feed = &feeds[player->shard];
+		pthread_mutex_lock(&feed->mutex);
+		sub->feed = player->shard;
+		sub->index = feed->subscriber_count;
+		feed->subscribers[feed->subscriber_count++] = (int)(player - players);
+		pthread_mutex_unlock(&feed->mutex);
+	}
+}
 
-	broadcast_room_update(&rooms[room_id]);
-	pthread_mutex_unlock(&lobby_mutex);
-	return 0;
+int send_room_list(const int socket)
+{
+	pthread_mutex_lock(&room_list_mutex);
+	const unsigned long version = __atomic_load_n(&room_list_version, __ATOMIC_ACQUIRE);
+	if (!room_list || room_list->version != version)
+	{
+		room_list_t* fresh = build_room_list(version);
+		if (fresh)
+		{
+			if (room_list) release_room_list(room_list);
+			room_list = fresh;
+		}
+	}
+	room_list_t* list = room_list;
+	if (list) __atomic_add_fetch(&list->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&room_list_mutex);
+
+	if (!list) return -1;
+	// The queue takes over the reference: hundreds of KB with many rooms, sent as the client reads
+	const ssize_t sent = get_socket_protocol(socket) == PROTO_BINARY
+		? reactor_send_shared(socket, list->bin, list->bin_len, release_room_list, list)
+		: reactor_send_shared(socket, list->text, list->text_len, release_room_list, list);
+	return sent < 0 ? -1 : 0;
 }
 
-room_t* get_room(const int room_id)
+int send_room_page(const int socket, const int state, const int offset, const int limit)
 {
-	if (room_id < 0 || room_id >= MAX_ROOMS)
+	int ids[ROOM_PAGE_MAX];
+	int count = 0;
+	const int wanted = limit < ROOM_PAGE_MAX ? limit : ROOM_PAGE_MAX;
+
+	if (state < 0)
 	{
-		return NULL;
+		for (int i = offset; i < MAX_ROOMS && count < wanted; ++i)
+		{
+			ids[count++] = i;
+		}
 	}
-	return &rooms[room_id];
+	else
+	{
+		// Whole words of matching rooms before the page are skipped by their popcount
+		int skip = offset;
+		pthread_mutex_lock(&room_index_mutex);
+		for (int w = 0; w < room_index_words && count < wanted; ++w)
+		{
+			unsigned long long word = room_index[state][w];
+			const int matches = __builtin_popcountll(word);
+			if (skip >= matches)
+			{
+				skip -= matches;
+				continue;
+			}
+			for (; word && count < wanted; word &= word - 1)
+			{
+				if (skip > 0)
+				{
+					--skip;
+					continue;
+				}
+				ids[count++] = w * INDEX_WORD_BITS + __builtin_ctzll(word);
+			}
+		}
+		pthread_mutex_unlock(&room_index_mutex);
+	}
+
+	message_t msg;
+	for (int i = 0; i < count; ++i)
+	{
+		msg_begin(&msg, S_ROOM_INFO);
+		add_room_info(&msg, ids[i]);
+		msg_send(socket, &msg);
+	}
+	return count;
 }
 
-// Find a player who dropped mid-game and can reconnect.
-// They have socket == -1 (disconnected) but state == IN_GAME (game still waiting for them).
-player_t* find_disconnected_player(const char* nickname)
+static void init_player(void* item, const int index)
 {
-	pthread_mutex_lock(&lobby_mutex);
-	for (int i = 0; i < MAX_PLAYERS; ++i)
+	player_t* player = item;
+	(void)index;
+	player->socket = -1;
+	player->nickname[0] = '\0';
+	player->state = LOBBY;
+	player->room_id = -1;
+	player->session = SESSION_LOGIN;
+	player->watched = 0;
+	player->shard = 0;
+}
+
+static void init_room(void* item, const int index)
+{
+	room_t* room = item;
+	room->id = index;
+	room->state = WAITING;
+	room->player_count = 0;
+	room->shard = -1;
+	room->games = 0;
+	for (int j = 0; j < MAX_PLAYERS_PER_ROOM; j++)
 	{
-		if (players[i].socket == -1 && players[i].state == IN_GAME && strcmp(players[i].nickname, nickname) == 0)
+		room->players[j] = NULL;
+	}
+	pthread_mutex_init(&room->mutex, NULL);
+}
+
+/*
+ * Checks a startup allocation: there is no lobby without it, so failing ends the server.
+ */
+static void* init_alloc(void* memory, const char* what)
+{
+	if (!memory)
+	{
+		LOG(LOG_LOBBY, "Out of memory while creating the %s.", what);
+		exit(EXIT_FAILURE);
+	}
+	return memory;
+}
+
+void init_lobby()
+{
+	pthread_mutex_lock(&slot_mutex);
+	if (
+		pool_init(&player_pool, sizeof(player_t), MAX_PLAYERS, PLAYER_CHUNK_MIN, init_player) != 0 ||
+		pool_init(&room_pool, sizeof(room_t), MAX_ROOMS, ROOM_CHUNK_MIN, init_room) != 0 ||
+		init_games(MAX_ROOMS) != 0
+	)
+	{
+		LOG(LOG_LOBBY, "Could not reserve memory for %d players and %d rooms.", MAX_PLAYERS, MAX_ROOMS);
+		exit(EXIT_FAILURE);
+	}
+	players = (player_t*)player_pool.base;
+	rooms = (room_t*)room_pool.base;
+
+	// Every room starts out WAITING
+	room_index_words = (MAX_ROOMS + INDEX_WORD_BITS - 1) / INDEX_WORD_BITS;
+	for (int s = 0; s < NUM_ROOM_STATES; ++s)
+	{
+		room_index[s] = init_alloc(calloc(room_index_words, sizeof(unsigned long long)), "room index");
+	}
+	indexed_state = init_alloc(malloc(MAX_ROOMS), "room index");
+	memset(indexed_state, WAITING, MAX_ROOMS);
+	empty_rooms = init_alloc(calloc(room_index_words, sizeof(unsigned long long)), "empty room index");
+	empty_rooms_hint = 0;
+	for (int i = 0; i < MAX_ROOMS; ++i)
+	{
+		room_index[WAITING][i / INDEX_WORD_BITS] |= 1ULL << (i % INDEX_WORD_BITS);
+		empty_rooms[i / INDEX_WORD_BITS] |= 1ULL << (i % INDEX_WORD_BITS);
+	}
+	unsigned int nick_capacity = 16;
+	while (nick_capacity < 2u * (unsigned int)MAX_PLAYERS)
+	{
+		nick_capacity *= 2;
+	}
+	nick_index = init_alloc(calloc(nick_capacity, sizeof(nick_entry_t)), "nickname table");
+	nick_index_mask = nick_capacity - 1;
+	feed_count = SERVER_THREADS > 0 ? SERVER_THREADS : 1;
+	feeds = init_alloc(aligned_alloc(CACHE_LINE, sizeof(lobby_feed_t) * feed_count), "lobby feeds");
+	memset(feeds, 0, sizeof(lobby_feed_t) * feed_count);
+	subscriptions = init_alloc(malloc(sizeof(subscription_t) * MAX_PLAYERS), "lobby subscriptions");
+	match_links = init_alloc(malloc(sizeof(match_link_t) * MAX_PLAYERS), "quick match queues");
+	match_queues = init_alloc(aligned_alloc(CACHE_LINE, sizeof(match_queue_t) * feed_count), "quick match queues");
+	for (int i = 0; i < feed_count; ++i)
+	{
+		match_queues[i] = (match_queue_t){ .head = -1, .tail = -1, .length = 0 };
+	}
+	for (int i = 0; i < feed_count; ++i)
+	{
+		pthread_mutex_init(&feeds[i].mutex, NULL);
+		feeds[i].dirty = init_alloc(malloc(sizeof(int) * MAX_ROOMS), "lobby feeds");
+		feeds[i].publishing = init_alloc(malloc(sizeof(int) * MAX_ROOMS), "lobby feeds");
+		feeds[i].is_dirty = init_alloc(calloc(MAX_ROOMS, 1), "lobby feeds");
+		feeds[i].subscribers = init_alloc(malloc(sizeof(int) * MAX_PLAYERS), "lobby feeds");
+		feeds[i].sockets = init_alloc(malloc(sizeof(int) * MAX_PLAYERS), "lobby feeds");
+	}
+	// Large ones stay untouched (uncommitted) until their chunk is in use
+	free_slots = init_alloc(malloc(sizeof(int) * (size_t)player_pool.chunk_count * player_pool.chunk_items), "player slot stacks");
+	chunk_free = init_alloc(calloc(player_pool.chunk_count, sizeof(int)), "player slot stacks");
+	chunk_words = (player_pool.chunk_count + INDEX_WORD_BITS - 1) / INDEX_WORD_BITS;
+	chunks_with_free = init_alloc(calloc(chunk_words, sizeof(unsigned long long)), "player slot stacks");
+	spare_chunk = -1;
+	player_count = 0;
+	pthread_mutex_unlock(&slot_mutex);
+	LOG(LOG_LOBBY, "Lobby initialized with up to %d rooms and %d player slots.", MAX_ROOMS, MAX_PLAYERS);
+}
+
+// Slots of a player chunk that are below the ceiling (the last chunk may be cut short)
+static int chunk_slots(const int chunk)
+{
+	const int first = chunk * player_pool.chunk_items;
+	const int left = MAX_PLAYERS - first;
+	return left < player_pool.chunk_items ? left : player_pool.chunk_items;
+}
+
+// Lowest chunk with a free slot, -1 if none; the caller holds slot_mutex
+static int lowest_free_chunk()
+{
+	for (int w = 0; w < chunk_words; ++w)
+	{
+		if (chunks_with_free[w])
 		{
-			pthread_mutex_unlock(&lobby_mutex);
-			return &players[i];
+			return w * INDEX_WORD_BITS + __builtin_ctzll(chunks_with_free[w]);
 		}
 	}
-	pthread_mutex_unlock(&lobby_mutex);
-	return NULL;
+	return -1;
 }
 
-player_t* find_active_player_by_nickname(const char* nickname)
+/*
+ * Lowest chunk with a free slot, creating one if all live chunks are full; -1 at the
+ * ceiling. The caller holds slot_mutex.
+ */
+static int chunk_with_free_slot()
 {
-	pthread_mutex_lock(&lobby_mutex);
-	for (int i = 0; i < MAX_PLAYERS; ++i)
+	const int lowest = lowest_free_chunk();
+	if (lowest >= 0)
+	{
+		return lowest;
+	}
+
+	for (int chunk = 0; chunk < player_pool.chunk_count; ++chunk)
 	{
-		if (
-			players[i].socket != -1 &&
-			players[i].nickname[0] != '\0' &&
-			strcmp(players[i].nickname, nickname) == 0
-		)
+		if (!pool_is_live(&player_pool, chunk * player_pool.chunk_items))
 		{
-			pthread_mutex_unlock(&lobby_mutex);
-			return &players[i];
+			pool_ensure(&player_pool, chunk * player_pool.chunk_items);
+			// Lowest slots on top, they are handed out first
+			int* stack = &free_slots[chunk * player_pool.chunk_items];
+			const int slots = chunk_slots(chunk);
+			for (int i = 0; i < slots; ++i)
+			{
+				stack[i] = chunk * player_pool.chunk_items + slots - 1 - i;
+			}
+			chunk_free[chunk] = slots;
+			chunks_with_free[chunk / INDEX_WORD_BITS] |= 1ULL << (chunk % INDEX_WORD_BITS);
+			LOG(LOG_LOBBY, "Player chunk %d created (slots %d-%d).", chunk, chunk * player_pool.chunk_items, chunk * player_pool.chunk_items + slots - 1);
+			return chunk;
 		}
 	}
-	pthread_mutex_unlock(&lobby_mutex);
-	return NULL;
+	return -1;
 }
 
-static void remove_player_from_room(room_t* room, player_t* player)
+static void release_player_chunk(const int chunk)
 {
-	if (!room || !player) return;
+	chunks_with_free[chunk / INDEX_WORD_BITS] &= ~(1ULL << (chunk % INDEX_WORD_BITS));
+	chunk_free[chunk] = 0;
+	pool_release(&player_pool, chunk);
+	LOG(LOG_LOBBY, "Player chunk %d is empty, released.", chunk);
+}
+
+/*
+ * Puts a slot back on its chunk's stack. Empty chunks are released, except chunk 0 and
+ * one spare that new players would go to next anyway (so a player coming and going at
+ * the edge does not create and release a chunk every time). The caller holds slot_mutex.
+ */
+static void free_player_slot(const int slot)
+{
+	const int chunk = slot / player_pool.chunk_items;
+	free_slots[chunk * player_pool.chunk_items + chunk_free[chunk]++] = slot;
+	chunks_with_free[chunk / INDEX_WORD_BITS] |= 1ULL << (chunk % INDEX_WORD_BITS);
+
+	const int lowest = lowest_free_chunk();
+	if (spare_chunk != -1 && spare_chunk != lowest)
+	{
+		release_player_chunk(spare_chunk);
+		spare_chunk = -1;
+	}
+	if (chunk == 0 || chunk_free[chunk] < chunk_slots(chunk))
+	{
+		return;
+	}
+	if (chunk == lowest)
+	{
+		spare_chunk = chunk;
+	}
+	else
+	{
+		release_player_chunk(chunk);
+	}
+}
+
+player_t* add_player(const int socket, const int shard)
+{
+	pthread_mutex_lock(&slot_mutex);
+	const int chunk = chunk_with_free_slot();
+	if (chunk < 0)
+	{
+		pthread_mutex_unlock(&slot_mutex);
+		return NULL;
+	}
+	const int i = free_slots[chunk * player_pool.chunk_items + --chunk_free[chunk]];
+	if (chunk_free[chunk] == 0)
+	{
+		chunks_with_free[chunk / INDEX_WORD_BITS] &= ~(1ULL << (chunk % INDEX_WORD_BITS));
+	}
+	if (chunk == spare_chunk)
+	{
+		spare_chunk = -1;
+	}
+	players[i].socket = socket;
+	players[i].state = LOBBY;
+	players[i].nickname[0] = '\0';
+	players[i].room_id = -1;
+	players[i].last_activity = time(NULL);
+	players[i].session = SESSION_LOGIN;
+	players[i].watched = 0;
+	players[i].shard = shard;
+	subscriptions[i].index = -1;
+	match_links[i].shard = -1;
+	match_links[i].moving = 0;
+	const int total = ++player_count;
+	pthread_mutex_unlock(&slot_mutex);
+	LOG(LOG_LOBBY, "Player slot %d assigned to socket %d. Total players: %d", i, socket, total);
+	return &players[i];
+}
 
+/*
+ * Takes the player out of the room's player list (the caller holds room->mutex).
+ * An empty room is free for any shard again.
+ */
+static void detach_player(room_t* room, const player_t* player)
+{
 	int player_idx = -1;
 	for (int i = 0; i < room->player_count; ++i)
 	{
@@ -249,42 +836,358 @@ static void remove_player_from_room(room_t* room, player_t* player)
 	if (room->player_count == 0)
 	{
 		room->state = WAITING;
+		room->shard = -1;
 	}
+}
 
-	broadcast_room_update(room);
+void remove_player(player_t* player)
+{
+	// Only the shard owning the socket removes the player, so this check does not race
+	if (!player || player->socket == -1)
+	{
+		return;
+	}
+	LOG(LOG_LOBBY, "Removing player %s (socket %d)", player->nickname, player->socket);
+
+	cancel_quick_match(player);
+
+	// If player was in a room, remove them from there first.
+	room_t* room = get_room(player->room_id);
+	if (room)
+	{
+		pthread_mutex_lock(&room->mutex);
+		detach_player(room, player);
+		pthread_mutex_unlock(&room->mutex);
+		broadcast_room_update(room);
+	}
+
+	pthread_mutex_lock(&slot_mutex);
+	pthread_mutex_lock(&nick_mutex);
+	nick_remove(player);
+	player->socket = -1;
+	pthread_mutex_unlock(&nick_mutex);
+	player->state = LOBBY; // Reset state
+	player->room_id = -1;
+	update_lobby_subscription(player);
+	player_count--;
+	free_player_slot((int)(player - players));
+	pthread_mutex_unlock(&slot_mutex);
 }
 
-int leave_room(player_t* player)
+static void match_link(const int slot, const int shard, const int at_head)
+{
+	match_queue_t* queue = &match_queues[shard];
+	match_link_t* link = &match_links[slot];
+	link->shard = shard;
+	if (queue->head == -1)
+	{
+		link->prev = link->next = -1;
+		queue->head = queue->tail = slot;
+	}
+	else if (at_head)
+	{
+		link->prev = -1;
+		link->next = queue->head;
+		match_links[queue->head].prev = slot;
+		queue->head = slot;
+	}
+	else
+	{
+		link->prev = queue->tail;
+		link->next = -1;
+		match_links[queue->tail].next = slot;
+		queue->tail = slot;
+	}
+	// Sequentially consistent like the load in quick_match_length(): a shard that queues and then
+	// looks at the other shards cannot miss one doing the same (see find_quick_match_shard())
+	__atomic_store_n(&queue->length, queue->length + 1, __ATOMIC_SEQ_CST);
+}
+
+static void match_unlink(const int slot)
+{
+	match_link_t* link = &match_links[slot];
+	match_queue_t* queue = &match_queues[link->shard];
+	if (link->prev == -1)
+	{
+		queue->head = link->next;
+	}
+	else
+	{
+		match_links[link->prev].next = link->next;
+	}
+	if (link->next == -1)
+	{
+		queue->tail = link->prev;
+	}
+	else
+	{
+		match_links[link->next].prev = link->prev;
+	}
+	link->shard = -1;
+	__atomic_store_n(&queue->length, queue->length - 1, __ATOMIC_SEQ_CST);
+}
+
+int enqueue_quick_match(player_t* player, const int at_head)
+{
+	const int slot = (int)(player - players);
+	if (match_links[slot].shard != -1)
+	{
+		return -1;
+	}
+	match_link(slot, player->shard, at_head);
+	return 0;
+}
+
+int cancel_quick_match(player_t* player)
+{
+	const int slot = (int)(player - players);
+	if (match_links[slot].shard == -1)
+	{
+		return -1;
+	}
+	match_unlink(slot);
+	return 0;
+}
+
+player_t* dequeue_quick_match(const int shard)
+{
+	const int slot = match_queues[shard].head;
+	if (slot == -1)
+	{
+		return NULL;
+	}
+	match_unlink(slot);
+	return &players[slot];
+}
+
+player_t* move_quick_match(const int shard)
+{
+	player_t* player = dequeue_quick_match(shard);
+	if (player)
+	{
+		match_links[player - players].moving = 1;
+	}
+	return player;
+}
+
+int requeue_quick_match(player_t* player)
+{
+	const int slot = (int)(player - players);
+	if (!match_links[slot].moving)
+	{
+		return -1;
+	}
+	match_links[slot].moving = 0;
+	return enqueue_quick_match(player, 0);
+}
+
+int quick_match_length(const int shard)
+{
+	return __atomic_load_n(&match_queues[shard].length, __ATOMIC_SEQ_CST);
+}
+
+int find_quick_match_shard(const int shard)
+{
+	for (int i = 0; i < shard && i < feed_count; ++i)
+	{
+		if (quick_match_length(i) > 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int join_room(const int room_id, player_t* player, int* host_shard)
 {
-	pthread_mutex_lock(&lobby_mutex);
-	int result = -1; // Default to failure
-	if (player->state == IN_GAME && player->room_id != -1)
+	// Picking a room gives up a place in the quick-match queue
+	cancel_quick_match(player);
+
+	room_t* room = get_room(room_id);
+	if (!room)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&room->mutex);
+	if (room->state == IN_PROGRESS || room->player_count >= MAX_PLAYERS_PER_ROOM)
+	{
+		pthread_mutex_unlock(&room->mutex);
+		return -1;
+	}
+
+	if (room->player_count > 0 && room->shard != player->shard)
 	{
-		room_t* room = &rooms[player->room_id];
-		// A player can only leave a room if it's waiting for players
-		if (room->state == WAITING)
+		// Both players of a game live on the shard hosting the room
+		*host_shard = room->shard;
+		pthread_mutex_unlock(&room->mutex);
+		return 1;
+	}
+
+	// Check if player is already in the room
+	for (int i = 0; i < room->player_count; ++i)
+	{
+		if (room->players[i] == player)
 		{
-			LOG(LOG_LOBBY, "Player %s left room %d", player->nickname, player->room_id);
-			remove_player_from_room(room, player);
-			player->state = LOBBY;
-			player->room_id = -1;
-			result = 0; // Success
+			pthread_mutex_unlock(&room->mutex);
+			LOG(LOG_LOBBY, "Player %s is already in room %d", player->nickname, room_id);
+			return -1;
 		}
 	}
-	pthread_mutex_unlock(&lobby_mutex);
-	return result;
+
+	room->players[room->player_count++] = player;
+	room->shard = player->shard;
+	player->state = IN_GAME;
+	player->room_id = room_id;
+
+	if (room->player_count == MAX_PLAYERS_PER_ROOM)
+	{
+		room->state = IN_PROGRESS;
+	}
+	pthread_mutex_unlock(&room->mutex);
+
+	LOG(LOG_LOBBY, "Player %s joined room %d", player->nickname, room_id);
+	update_lobby_subscription(player);
+	broadcast_room_update(room);
+	return 0;
+}
+
+room_t* get_room(const int room_id)
+{
+	if (room_id < 0 || room_id >= MAX_ROOMS)
+	{
+		return NULL;
+	}
+	if (pool_ensure(&room_pool, room_id))
+	{
+		LOG(LOG_LOBBY, "Room chunk %d created.", room_id / room_pool.chunk_items);
+	}
+	return &rooms[room_id];
+}
+
+room_t* peek_room(const int room_id)
+{
+	if (room_id < 0 || room_id >= MAX_ROOMS || !pool_is_live(&room_pool, room_id))
+	{
+		return NULL;
+	}
+	return &rooms[room_id];
+}
+
+player_t* peek_player(const int slot)
+{
+	if (slot < 0 || slot >= MAX_PLAYERS || !pool_is_live(&player_pool, slot))
+	{
+		return NULL;
+	}
+	return &players[slot];
+}
+
+int room_slots()
+{
+	return pool_bound(&room_pool);
+}
+
+int player_slots()
+{
+	return pool_bound(&player_pool);
+}
+
+// Find a player who dropped mid-game and can reconnect.
+// They have socket == -1 (disconnected) but state == IN_GAME (game still waiting for them).
+player_t* find_disconnected_player(const char* nickname)
+{
+	pthread_mutex_lock(&nick_mutex);
+	player_t* player = nick_lookup(nickname);
+	if (player && (player->socket != -1 || player->state != IN_GAME))
+	{
+		player = NULL;
+	}
+	pthread_mutex_unlock(&nick_mutex);
+	return player;
+}
+
+player_t* find_active_player_by_nickname(const char* nickname)
+{
+	pthread_mutex_lock(&nick_mutex);
+	player_t* player = nick_lookup(nickname);
+	if (player && player->socket == -1)
+	{
+		player = NULL;
+	}
+	pthread_mutex_unlock(&nick_mutex);
+	return player;
+}
+
+void set_player_nickname(player_t* player, const char* nickname)
+{
+	pthread_mutex_lock(&nick_mutex);
+	nick_remove(player);
+	strncpy(player->nickname, nickname, NICKNAME_LEN - 1);
+	player->nickname[NICKNAME_LEN - 1] = '\0';
+	nick_insert(player);
+	pthread_mutex_unlock(&nick_mutex);
+}
+
+void return_player_to_lobby(player_t* player)
+{
+	pthread_mutex_lock(&slot_mutex);
+	if (player->socket == -1 && player->state == IN_GAME)
+	{
+		// Nobody came back for it, the slot is free now. Freeing it may release its chunk,
+		// so the slot is left alone afterwards.
+		pthread_mutex_lock(&nick_mutex);
+		nick_remove(player);
+		pthread_mutex_unlock(&nick_mutex);
+		player->state = LOBBY;
+		player->room_id = -1;
+		update_lobby_subscription(player);
+		player_count--;
+		free_player_slot((int)(player - players));
+		pthread_mutex_unlock(&slot_mutex);
+		return;
+	}
+	player->state = LOBBY;
+	player->room_id = -1;
+	update_lobby_subscription(player);
+	pthread_mutex_unlock(&slot_mutex);
+}
+
+int leave_room(player_t* player)
+{
+	room_t* room = get_room(player->room_id);
+	if (player->state != IN_GAME || !room)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&room->mutex);
+	// A player can only leave a room if it's waiting for players
+	if (room->state != WAITING)
+	{
+		pthread_mutex_unlock(&room->mutex);
+		return -1;
+	}
+	detach_player(room, player);
+	player->state = LOBBY;
+	player->room_id = -1;
+	pthread_mutex_unlock(&room->mutex);
+
+	LOG(LOG_LOBBY, "Player %s left room %d", player->nickname, room->id);
+	update_lobby_subscription(player);
+	broadcast_room_update(room);
+	return 0;
 }
 
 // Mark player as disconnected but keep their slot (for reconnection).
 // Don't change their state - if they were IN_GAME, game is now paused waiting for them.
 void handle_player_disconnect(player_t* player)
 {
-	pthread_mutex_lock(&lobby_mutex);
 	if (player)
 	{
 		LOG(LOG_LOBBY, "Handling disconnect for player %s (socket %d)", player->nickname, player->socket);
+		pthread_mutex_lock(&nick_mutex);
 		player->socket = -1;
-		player->disconnected_timestamp = time(NULL);
+		pthread_mutex_unlock(&nick_mutex);
 	}
-	pthread_mutex_unlock(&lobby_mutex);
 }
@@ -2,22 +2,31 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include "server.h"
 #include "config.h"
 #include "lobby.h"
 #include "logger.h"
+#include "scan.h"
+#include "rng.h"
 
 int MAX_ROOMS = 5;
 int MAX_PLAYERS = 10;
+int SERVER_THREADS = 0; // 0 = one per online CPU
+int PIN_THREADS = 0;
+int USE_IO_URING = 0;
+int SEND_HIGH_WATER = 64 * 1024;
+unsigned long long DICE_SEED = 0;
 
 int main(const int argc, char* argv[])
 {
 	int port = DEFAULT_PORT;
 	char* address = "0.0.0.0";
 	char* log_dir = NULL;
+	int seeded = 0;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "p:r:a:l:")) != -1) {
+	while ((opt = getopt(argc, argv, "p:r:a:l:t:cuw:s:")) != -1) {
 		switch (opt) {
 			case 'p':
 				MAX_PLAYERS = atoi(optarg);
@@ -31,8 +40,30 @@ int main(const int argc, char* argv[])
 			case 'l':
 				log_dir = optarg;
 				break;
+			case 't':
+				SERVER_THREADS = atoi(optarg);
+				break;
+			case 'c':
+				PIN_THREADS = 1;
+				break;
+			case 'u':
+				USE_IO_URING = 1;
+				break;
+			case 'w':
+				SEND_HIGH_WATER = atoi(optarg);
+				if (SEND_HIGH_WATER <= 0)
+				{
+					// Every client would count as a slow consumer
+					fprintf(stderr, "%s: -w needs a positive number of bytes, got '%s'\n", argv[0], optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 's':
+				DICE_SEED = strtoull(optarg, NULL, 0);
+				seeded = 1;
+				break;
 			default:
-				fprintf(stderr, "Usage: %s [-a address] [-p max_players] [-r max_rooms] [-l logdir] [port]\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-a address] [-p max_players] [-r max_rooms] [-l logdir] [-t threads] [-c] [-u] [-w send_high_water] [-s dice_seed] [port]\n", argv[0]);
 				exit(EXIT_FAILURE);
 		}
 	}
@@ -42,13 +73,30 @@ int main(const int argc, char* argv[])
 		port = atoi(argv[optind]);
 	}
 
+	if (SERVER_THREADS <= 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		SERVER_THREADS = cpus > 0 ? (int)cpus : 1;
+	}
+
+	if (!seeded)
+	{
+		// Logged below, so this run can be replayed with -s
+		DICE_SEED = rng_mix((unsigned long long)time(NULL) << 20 ^ (unsigned long long)getpid());
+	}
+
 	if (init_logger(log_dir) != 0) {
 		exit(EXIT_FAILURE);
 	}
 
 	init_lobby();
+	scan_init();
 
-	LOG(LOG_GENERAL, "Starting server on %s:%d, max players %d, max rooms %d", address, port, MAX_PLAYERS, MAX_ROOMS);
+	LOG(
+		LOG_GENERAL, "Starting server on %s:%d, max players %d, max rooms %d, %d threads%s, %s newline scan, dice seed %llu",
+		address, port, MAX_PLAYERS, MAX_ROOMS, SERVER_THREADS, PIN_THREADS ? " (pinned)" : "", scan_kernel_name(),
+		DICE_SEED
+	);
 
 	if (run_server(port, address) != 0)
 	{
@@ -3,87 +3,353 @@
 #include <string.h>
 #include <stdio.h>
 
-// Helper to map command strings to enum values
-static client_command_t get_command_type(const char* verb)
+// Compares a length-checked token with a protocol string literal
+#define TOKEN_IS(token, literal) (memcmp((token), (literal), sizeof(literal) - 1) == 0)
+
+static const char* command_names[] = {
+	[CMD_UNKNOWN] = NULL,
+	[CMD_LOGIN] = C_LOGIN,
+	[CMD_RESUME] = C_RESUME,
+	[CMD_LIST_ROOMS] = C_LIST_ROOMS,
+	[CMD_JOIN_ROOM] = C_JOIN_ROOM,
+	[CMD_LEAVE_ROOM] = C_LEAVE_ROOM,
+	[CMD_ROLL] = C_ROLL,
+	[CMD_HOLD] = C_HOLD,
+	[CMD_GAME_STATE_REQUEST] = C_GAME_STATE_REQUEST,
+	[CMD_QUIT] = C_QUIT,
+	[CMD_EXIT] = C_EXIT,
+	[CMD_PING] = C_PING,
+	[CMD_QUICK_MATCH] = C_QUICK_MATCH,
+};
+
+static const char* key_names[] = {
+	[KEY_CMD] = K_CMD,
+	[KEY_MSG] = K_MSG,
+	[KEY_NICK] = K_NICK,
+	[KEY_ROOM] = K_ROOM,
+	[KEY_STATE] = K_STATE,
+	[KEY_OPP_NICK] = K_OPP_NICK,
+	[KEY_YOUR_TURN] = K_YOUR_TURN,
+	[KEY_MY_SCORE] = K_MY_SCORE,
+	[KEY_OPP_SCORE] = K_OPP_SCORE,
+	[KEY_TURN_SCORE] = K_TURN_SCORE,
+	[KEY_CURRENT] = K_CURRENT,
+	[KEY_COUNT] = K_COUNT,
+	[KEY_ROLL] = K_ROLL,
+	[KEY_PLAYERS] = K_PLAYERS,
+	[KEY_ROOMS] = K_ROOMS,
+	[KEY_PROTO] = K_PROTO,
+	[KEY_OFFSET] = K_OFFSET,
+	[KEY_LIMIT] = K_LIMIT,
+};
+
+// Helper to map command strings to enum values: the length narrows it down to a
+// handful of candidates, the first character (or one memcmp) settles it
+client_command_t lookup_command(const char* verb, const size_t len)
+{
+	switch (len)
+	{
+		case 4:
+			switch (verb[0])
+			{
+				case 'R': return TOKEN_IS(verb, C_ROLL) ? CMD_ROLL : CMD_UNKNOWN;
+				case 'H': return TOKEN_IS(verb, C_HOLD) ? CMD_HOLD : CMD_UNKNOWN;
+				case 'Q': return TOKEN_IS(verb, C_QUIT) ? CMD_QUIT : CMD_UNKNOWN;
+				case 'E': return TOKEN_IS(verb, C_EXIT) ? CMD_EXIT : CMD_UNKNOWN;
+				case 'P': return TOKEN_IS(verb, C_PING) ? CMD_PING : CMD_UNKNOWN;
+				default: return CMD_UNKNOWN;
+			}
+		case 5: return TOKEN_IS(verb, C_LOGIN) ? CMD_LOGIN : CMD_UNKNOWN;
+		case 6: return TOKEN_IS(verb, C_RESUME) ? CMD_RESUME : CMD_UNKNOWN;
+		case 9: return TOKEN_IS(verb, C_JOIN_ROOM) ? CMD_JOIN_ROOM : CMD_UNKNOWN;
+		case 10:
+			if (TOKEN_IS(verb, C_LIST_ROOMS)) return CMD_LIST_ROOMS;
+			if (TOKEN_IS(verb, C_LEAVE_ROOM)) return CMD_LEAVE_ROOM;
+			return CMD_UNKNOWN;
+		case 11: return TOKEN_IS(verb, C_QUICK_MATCH) ? CMD_QUICK_MATCH : CMD_UNKNOWN;
+		case 18: return TOKEN_IS(verb, C_GAME_STATE_REQUEST) ? CMD_GAME_STATE_REQUEST : CMD_UNKNOWN;
+		default: return CMD_UNKNOWN;
+	}
+}
+
+// Maps a key to its slot, -1 for keys the server does not know
+int lookup_key(const char* key, const size_t len)
 {
-	if (strcmp(verb, C_LOGIN) == 0) return CMD_LOGIN;
-	if (strcmp(verb, C_RESUME) == 0) return CMD_RESUME;
-	if (strcmp(verb, C_LIST_ROOMS) == 0) return CMD_LIST_ROOMS;
-	if (strcmp(verb, C_JOIN_ROOM) == 0) return CMD_JOIN_ROOM;
-	if (strcmp(verb, C_LEAVE_ROOM) == 0) return CMD_LEAVE_ROOM;
-	if (strcmp(verb, C_ROLL) == 0) return CMD_ROLL;
-	if (strcmp(verb, C_HOLD) == 0) return CMD_HOLD;
-	if (strcmp(verb, C_GAME_STATE_REQUEST) == 0) return CMD_GAME_STATE_REQUEST;
-	if (strcmp(verb, C_QUIT) == 0) return CMD_QUIT;
-	if (strcmp(verb, C_EXIT) == 0) return CMD_EXIT;
-	if (strcmp(verb, C_PING) == 0) return CMD_PING;
-	return CMD_UNKNOWN;
+	switch (len)
+	{
+		case 3:
+			if (TOKEN_IS(key, K_CMD)) return KEY_CMD;
+			if (TOKEN_IS(key, K_MSG)) return KEY_MSG;
+			return -1;
+		case 4:
+			if (TOKEN_IS(key, K_NICK)) return KEY_NICK;
+			if (TOKEN_IS(key, K_ROOM)) return KEY_ROOM;
+			if (TOKEN_IS(key, K_ROLL)) return KEY_ROLL;
+			return -1;
+		case 5:
+			if (TOKEN_IS(key, K_STATE)) return KEY_STATE;
+			if (TOKEN_IS(key, K_COUNT)) return KEY_COUNT;
+			if (TOKEN_IS(key, K_ROOMS)) return KEY_ROOMS;
+			if (TOKEN_IS(key, K_PROTO)) return KEY_PROTO;
+			if (TOKEN_IS(key, K_LIMIT)) return KEY_LIMIT;
+			return -1;
+		case 6:
+			if (TOKEN_IS(key, K_OFFSET)) return KEY_OFFSET;
+			return -1;
+		case 7:
+			if (TOKEN_IS(key, K_CURRENT)) return KEY_CURRENT;
+			if (TOKEN_IS(key, K_PLAYERS)) return KEY_PLAYERS;
+			return -1;
+		case 8:
+			if (TOKEN_IS(key, K_OPP_NICK)) return KEY_OPP_NICK;
+			if (TOKEN_IS(key, K_MY_SCORE)) return KEY_MY_SCORE;
+			return -1;
+		case 9:
+			if (TOKEN_IS(key, K_YOUR_TURN)) return KEY_YOUR_TURN;
+			if (TOKEN_IS(key, K_OPP_SCORE)) return KEY_OPP_SCORE;
+			return -1;
+		case 10:
+			if (TOKEN_IS(key, K_TURN_SCORE)) return KEY_TURN_SCORE;
+			return -1;
+		default:
+			return -1;
+	}
 }
 
+/*
+ * Records where a known key is, unless it was already seen (the first one wins).
+ */
+static void add_key_slot(parsed_command_t* cmd, const int slot)
+{
+	if (slot >= 0 && !(cmd->key_mask & (1u << slot)))
+	{
+		cmd->key_mask |= 1u << slot;
+		cmd->key_slot[slot] = (unsigned char)cmd->arg_count;
+	}
+}
+
+/*
+ * Field grammar (the same tokens strtok_r used to produce): empty fields between
+ * '|' are skipped, a key/value pair is split at ':' with repeated colons treated
+ * as one separator, and anything after a second ':' in a field is ignored.
+ */
 int parse_command(char* buffer, parsed_command_t* out_cmd)
 {
 	// Initialize the output struct
 	out_cmd->type = CMD_UNKNOWN;
 	out_cmd->arg_count = 0;
+	out_cmd->key_mask = 0;
 
 	if (buffer == NULL)
 	{
 		return -1;
 	}
 
-	char* ptr_1;
-	char* ptr_2;
+	char* p = buffer;
 
 	// The first token is the command verb
-	const char* verb = strtok_r(buffer, "|", &ptr_1);
-	if (verb == NULL)
+	while (*p == '|')
+	{
+		++p;
+	}
+	if (*p == '\0')
 	{
 		return -1; // Empty command
 	}
+	const char* verb = p;
+	while (*p != '|' && *p != '\0')
+	{
+		++p;
+	}
+	out_cmd->type = lookup_command(verb, (size_t)(p - verb));
 
-	out_cmd->type = get_command_type(verb);
-
-	// Subsequent tokens are arguments
-	char* token;
-	while ((token = strtok_r(NULL, "|", &ptr_1)) != NULL)
+	// Subsequent tokens are arguments; p sits on the delimiter ending the previous one
+	while (*p != '\0')
 	{
+		*p++ = '\0';
+		if (*p == '|' || *p == '\0')
+		{
+			continue; // Empty field
+		}
+
 		if (out_cmd->arg_count >= MAX_ARGS)
 		{
 			return -1; // Too many arguments
 		}
 
-		char* key = strtok_r(token, ":", &ptr_2);
-		if (key == NULL)
+		while (*p == ':')
+		{
+			++p;
+		}
+		char* key = p;
+		while (*p != ':' && *p != '|' && *p != '\0')
+		{
+			++p;
+		}
+		if (p == key)
 		{
 			return -1; // Argument without a key
 		}
+		const size_t key_len = (size_t)(p - key);
+		if (*p != ':')
+		{
+			return -1; // Argument without a value
+		}
+		*p++ = '\0';
 
-		char* value = strtok_r(NULL, ":", &ptr_2);
-		if (value == NULL)
+		while (*p == ':')
+		{
+			++p;
+		}
+		char* value = p;
+		while (*p != ':' && *p != '|' && *p != '\0')
+		{
+			++p;
+		}
+		if (p == value)
 		{
 			return -1; // Argument without a value
 		}
+		const size_t value_len = (size_t)(p - value);
+		if (*p == ':')
+		{
+			*p++ = '\0';
+			while (*p != '|' && *p != '\0')
+			{
+				++p;
+			}
+		}
+
+		command_arg* arg = &out_cmd->args[out_cmd->arg_count];
+		arg->key = key;
+		arg->value = value;
+		arg->key_len = (unsigned short)key_len;
+		arg->value_len = (unsigned short)value_len;
 
-		out_cmd->args[out_cmd->arg_count].key = key;
-		out_cmd->args[out_cmd->arg_count].value = value;
+		add_key_slot(out_cmd, lookup_key(key, key_len));
 		out_cmd->arg_count++;
 	}
 
 	return 0; // Success
 }
 
-const char* get_command_arg(const parsed_command_t* cmd, const char* key)
+/*
+ * Reads an unsigned LEB128 varint. Returns the number of bytes it took, 0 if
+ * it is truncated or does not fit 32 bits.
+ */
+static size_t read_varint(const unsigned char* p, const size_t len, unsigned int* out)
 {
-	if (cmd == NULL || key == NULL)
+	unsigned int value = 0;
+	for (size_t i = 0; i < len && i < 5; ++i)
 	{
-		return NULL;
+		value |= (unsigned int)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80))
+		{
+			*out = value;
+			return i + 1;
+		}
 	}
-	for (int i = 0; i < cmd->arg_count; ++i)
+	return 0;
+}
+
+int parse_binary_command(const unsigned char* payload, const size_t len, char* scratch, parsed_command_t* out_cmd)
+{
+	out_cmd->type = CMD_UNKNOWN;
+	out_cmd->arg_count = 0;
+	out_cmd->key_mask = 0;
+
+	if (len == 0)
+	{
+		return -1; // Empty command
+	}
+	if (payload[0] > CMD_QUICK_MATCH)
 	{
-		if (strcmp(cmd->args[i].key, key) == 0)
+		return 0; // Unknown opcode, like an unknown verb
+	}
+	out_cmd->type = (client_command_t)payload[0];
+
+	size_t pos = 1;
+	char* out = scratch;
+	while (pos < len)
+	{
+		if (out_cmd->arg_count >= MAX_ARGS)
+		{
+			return -1; // Too many arguments
+		}
+
+		const unsigned int key = payload[pos++];
+		if (key >= NUM_KEYS)
+		{
+			return -1; // Keys are only known ones, there is no name to report
+		}
+
+		unsigned int value;
+		const size_t used = read_varint(payload + pos, len - pos, &value);
+		if (used == 0)
 		{
-			return cmd->args[i].value;
+			return -1; // Argument without a value
 		}
+		pos += used;
+
+		command_arg* arg = &out_cmd->args[out_cmd->arg_count];
+		arg->key = key_names[key];
+		arg->key_len = (unsigned short)strlen(arg->key);
+		arg->value = out;
+		if (key_is_string((command_key_t)key))
+		{
+			// The varint was the length of the string that follows
+			if (value == 0 || value > len - pos)
+			{
+				return -1;
+			}
+			memcpy(out, payload + pos, value);
+			out[value] = '\0';
+			pos += value;
+			arg->value_len = (unsigned short)value;
+		}
+		else
+		{
+			arg->value_len = (unsigned short)sprintf(out, "%u", value);
+		}
+		out += arg->value_len + 1;
+
+		add_key_slot(out_cmd, (int)key);
+		out_cmd->arg_count++;
+	}
+
+	return 0;
+}
+
+void format_command(const parsed_command_t* cmd, char* out, const size_t out_len)
+{
+	const char* verb = command_name(cmd->type);
+	int offset = snprintf(out, out_len, "%s", verb ? verb : "");
+	for (int i = 0; i < cmd->arg_count && offset >= 0 && (size_t)offset < out_len; ++i)
+	{
+		offset += snprintf(out + offset, out_len - offset, "|%s:%s", cmd->args[i].key, cmd->args[i].value);
+	}
+}
+
+const char* command_name(const client_command_t type)
+{
+	return (unsigned)type <= CMD_QUICK_MATCH ? command_names[type] : NULL;
+}
+
+const char* key_name(const command_key_t key)
+{
+	return key_names[key];
+}
+
+int key_is_string(const command_key_t key)
+{
+	return key == KEY_NICK || key == KEY_OPP_NICK;
+}
+
+const char* get_command_arg(const parsed_command_t* cmd, const command_key_t key)
+{
+	if (cmd == NULL || (unsigned)key >= NUM_KEYS || !(cmd->key_mask & (1u << key)))
+	{
+		return NULL;
 	}
-	return NULL;
+	return cmd->args[cmd->key_slot[key]].value;
 }
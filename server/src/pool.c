@@ -0,0 +1,103 @@
+/*
+ * pool.c - Chunked item pools on a reserved address range
+ *
+ * The range is an anonymous MAP_NORESERVE mapping, so untouched chunks cost
+ * no memory. Releasing a chunk is madvise(MADV_DONTNEED): the pages go back
+ * to the OS but the mapping stays, so a stale pointer into the chunk reads
+ * zeros instead of faulting.
+ */
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t gcd(size_t a, size_t b)
+{
+	while (b)
+	{
+		const size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+int pool_init(pool_t* pool, const size_t item_size, const int capacity, const int min_chunk_items, void (*init_item)(void* item, int index))
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	// The smallest item count that fills whole pages, times whatever reaches min_chunk_items
+	const int page_items = (int)(page / gcd(item_size, page));
+	pool->chunk_items = page_items * ((min_chunk_items + page_items - 1) / page_items);
+	pool->chunk_count = (capacity + pool->chunk_items - 1) / pool->chunk_items;
+	pool->item_size = item_size;
+	pool->capacity = capacity;
+	pool->high_water = 0;
+	pool->init_item = init_item;
+
+	const size_t bytes = (size_t)pool->chunk_count * pool->chunk_items * item_size;
+	void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
+	pool->base = base;
+	pool->live = calloc(pool->chunk_count, 1);
+	if (!pool->live)
+	{
+		munmap(base, bytes);
+		return -1;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	return 0;
+}
+
+int pool_is_live(const pool_t* pool, const int index)
+{
+	return __atomic_load_n(&pool->live[index / pool->chunk_items], __ATOMIC_ACQUIRE);
+}
+
+int pool_ensure(pool_t* pool, const int index)
+{
+	const int chunk = index / pool->chunk_items;
+	if (__atomic_load_n(&pool->live[chunk], __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+
+	int created = 0;
+	pthread_mutex_lock(&pool->mutex);
+	if (!pool->live[chunk])
+	{
+		const int first = chunk * pool->chunk_items;
+		for (int i = first; i < first + pool->chunk_items; ++i)
+		{
+			pool->init_item(pool->base + (size_t)i * pool->item_size, i);
+		}
+		if (chunk >= pool->high_water)
+		{
+			__atomic_store_n(&pool->high_water, chunk + 1, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&pool->live[chunk], 1, __ATOMIC_RELEASE);
+		created = 1;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return created;
+}
+
+void pool_release(pool_t* pool, const int chunk)
+{
+	pthread_mutex_lock(&pool->mutex);
+	__atomic_store_n(&pool->live[chunk], 0, __ATOMIC_RELEASE);
+	const size_t bytes = (size_t)pool->chunk_items * pool->item_size;
+	madvise(pool->base + (size_t)chunk * bytes, bytes, MADV_DONTNEED);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+int pool_bound(const pool_t* pool)
+{
+	const int bound = __atomic_load_n(&pool->high_water, __ATOMIC_ACQUIRE) * pool->chunk_items;
+	return bound < pool->capacity ? bound : pool->capacity;
+}
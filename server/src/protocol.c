@@ -4,12 +4,20 @@
  * Message format: COMMAND|key1:value1|key2:value2\n
  * Example: GAME_STATE|my_score:10|opp_score:5|turn_score:3|roll:4|your_turn:1\n
  *
- * TCP can split/combine messages, so receive_command() buffers partial reads
- * and extracts complete lines (ending with \n).
+ * TCP can split/combine messages, so receive_command() frames complete lines
+ * (ending with \n) out of the connection's receive buffer. Each newly received
+ * chunk is scanned once (SIMD, see scan.c) for all the lines it completes; the
+ * lines are then handed out one per call, in place, without scanning again.
+ *
+ * Clients that negotiate the binary protocol at LOGIN (see protocol.h) get
+ * length-prefixed frames instead, both ways. Messages are built in both
+ * encodings at once, so one message can go to text and binary clients alike.
  */
 
 #include "protocol.h"
 #include "lobby.h"
+#include "reactor.h"
+#include "scan.h"
 #include <sys/socket.h>
 #include <unistd.h>
 #include <string.h>
@@ -17,20 +25,38 @@
 #include <stdarg.h>
 #include <time.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+// A pre-rendered string and its length
+typedef struct
+{
+	const char* text;
+	size_t len;
+} token_t;
+
+#define TOKEN(literal) { literal, sizeof(literal) - 1 }
+
+static const token_t server_command_strings[] = {
+	[S_OK] = TOKEN("OK"),
+	[S_ERROR] = TOKEN("ERROR"),
+	[S_WELCOME] = TOKEN("WELCOME"),
+	[S_GAME_PAUSED] = TOKEN("GAME_PAUSED"),
+	[S_ROOM_INFO] = TOKEN("ROOM_INFO"),
+	[S_GAME_START] = TOKEN("GAME_START"),
+	[S_GAME_STATE] = TOKEN("GAME_STATE"),
+	[S_GAME_WIN] = TOKEN("GAME_WIN"),
+	[S_GAME_LOSE] = TOKEN("GAME_LOSE"),
+	[S_OPPONENT_DISCONNECTED] = TOKEN("OPPONENT_DISCONNECTED"),
+	[S_OPPONENT_RECONNECTED] = TOKEN("OPPONENT_RECONNECTED"),
+	[S_DISCONNECTED] = TOKEN("DISCONNECTED"),
+};
 
-static const char* server_command_strings[] = {
-	[S_OK] = "OK",
-	[S_ERROR] = "ERROR",
-	[S_WELCOME] = "WELCOME",
-	[S_GAME_PAUSED] = "GAME_PAUSED",
-	[S_ROOM_INFO] = "ROOM_INFO",
-	[S_GAME_START] = "GAME_START",
-	[S_GAME_STATE] = "GAME_STATE",
-	[S_GAME_WIN] = "GAME_WIN",
-	[S_GAME_LOSE] = "GAME_LOSE",
-	[S_OPPONENT_DISCONNECTED] = "OPPONENT_DISCONNECTED",
-	[S_OPPONENT_RECONNECTED] = "OPPONENT_RECONNECTED",
-	[S_DISCONNECTED] = "DISCONNECTED",
+static const char* room_state_strings[] = {
+	[WAITING] = "WAITING",
+	[IN_PROGRESS] = "IN_PROGRESS",
+	[PAUSED] = "PAUSED",
+	[ABORTED] = "ABORTED",
 };
 
 static const char* server_error_strings[] = {
@@ -45,17 +71,302 @@ static const char* server_error_strings[] = {
 	[E_NICKNAME_IN_USE] = "NICKNAME_IN_USE",
 };
 
+/*
+ * Protocol of every socket, indexed by the descriptor. Read by any shard (lobby
+ * broadcasts), so it is a plain table rather than part of the reactor's
+ * connection state.
+ */
+static unsigned char* socket_protocols;
+static int socket_protocols_len;
+
+int init_protocol(void)
+{
+	struct rlimit fd_limit;
+	socket_protocols_len = getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY
+		? (int)fd_limit.rlim_cur
+		: 65536;
+	socket_protocols = calloc(socket_protocols_len, 1);
+	return socket_protocols ? 0 : -1;
+}
+
+void set_socket_protocol(const int socket, const wire_protocol_t proto)
+{
+	if (socket >= 0 && socket < socket_protocols_len)
+	{
+		__atomic_store_n(&socket_protocols[socket], (unsigned char)proto, __ATOMIC_RELAXED);
+	}
+}
+
+wire_protocol_t get_socket_protocol(const int socket)
+{
+	if (socket >= 0 && socket < socket_protocols_len)
+	{
+		return (wire_protocol_t)__atomic_load_n(&socket_protocols[socket], __ATOMIC_RELAXED);
+	}
+	return PROTO_TEXT;
+}
+
+/*
+ * Appends raw bytes, truncating at the message limit (one byte stays reserved
+ * for the \n).
+ */
+static void msg_put(message_t* msg, const char* data, size_t len)
+{
+	const size_t room = MSG_MAX_LEN - 1 - msg->len;
+	if (len > room)
+	{
+		len = room;
+	}
+	memcpy(msg->data + msg->len, data, len);
+	msg->len += len;
+}
+
+static size_t varint_len(unsigned int value)
+{
+	size_t len = 1;
+	while (value >= 0x80)
+	{
+		value >>= 7;
+		++len;
+	}
+	return len;
+}
+
+static unsigned char* put_varint(unsigned char* p, unsigned int value)
+{
+	while (value >= 0x80)
+	{
+		*p++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+/*
+ * Binary fields are appended whole or not at all, a cut one would garble the frame.
+ */
+static unsigned char* bin_reserve(message_t* msg, const size_t len)
+{
+	if (msg->bin_len + len > MSG_MAX_LEN)
+	{
+		return NULL;
+	}
+	unsigned char* p = msg->bin + 2 + msg->bin_len;
+	msg->bin_len += len;
+	return p;
+}
+
+static void bin_add_varint(message_t* msg, const command_key_t key, const unsigned int value)
+{
+	unsigned char* p = bin_reserve(msg, 1 + varint_len(value));
+	if (p)
+	{
+		*p++ = (unsigned char)key;
+		put_varint(p, value);
+	}
+}
+
+static void bin_add_string(message_t* msg, const command_key_t key, const char* value, const size_t len)
+{
+	unsigned char* p = bin_reserve(msg, 1 + varint_len((unsigned int)len) + len);
+	if (p)
+	{
+		*p++ = (unsigned char)key;
+		p = put_varint(p, (unsigned int)len);
+		memcpy(p, value, len);
+	}
+}
+
+/*
+ * A field that is text in the text protocol and an enum value in the binary one.
+ */
+static void msg_add_enum(message_t* msg, const command_key_t key, const char* text, const unsigned int code)
+{
+	const char* name = key_name(key);
+	msg_put(msg, "|", 1);
+	msg_put(msg, name, strlen(name));
+	msg_put(msg, ":", 1);
+	msg_put(msg, text, strlen(text));
+	bin_add_varint(msg, key, code);
+}
+
+/*
+ * Index of a string in a table of names, 0 if it is not there.
+ */
+static unsigned int name_index(const char* const* names, const size_t count, const char* value)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (names[i] && strcmp(value, names[i]) == 0)
+		{
+			return (unsigned int)i;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Binary form of a field given as strings (send_structured_message()).
+ */
+static void bin_add_text_field(message_t* msg, const int key, const char* value)
+{
+	if (key < 0)
+	{
+		return; // Only known keys have a binary form
+	}
+	if (key_is_string((command_key_t)key))
+	{
+		bin_add_string(msg, (command_key_t)key, value, strlen(value));
+		return;
+	}
+
+	unsigned int code;
+	switch (key)
+	{
+		case KEY_CMD:
+			code = lookup_command(value, strlen(value));
+			break;
+		case KEY_MSG:
+			code = name_index(server_error_strings, sizeof(server_error_strings) / sizeof(server_error_strings[0]), value);
+			break;
+		case KEY_STATE:
+			code = name_index(room_state_strings, sizeof(room_state_strings) / sizeof(room_state_strings[0]), value);
+			break;
+		default:
+			code = (unsigned int)strtoul(value, NULL, 10);
+			break;
+	}
+	bin_add_varint(msg, (command_key_t)key, code);
+}
+
 int send_error(const int socket, const char* command_str, const server_error_t error)
 {
-	return command_str != NULL
-		? send_structured_message(socket, S_ERROR, 2, K_MSG, server_error_strings[error], K_CMD, command_str)
-		: send_structured_message(socket, S_ERROR, 1, K_MSG, server_error_strings[error]);
+	message_t msg;
+	msg_begin(&msg, S_ERROR);
+	msg_add_enum(&msg, KEY_MSG, server_error_strings[error], error);
+	if (command_str != NULL)
+	{
+		msg_add_enum(&msg, KEY_CMD, command_str, lookup_command(command_str, strlen(command_str)));
+	}
+	return msg_send(socket, &msg);
+}
+
+void msg_begin(message_t* msg, const server_command_t command)
+{
+	msg->len = 0;
+	msg_put(msg, server_command_strings[command].text, server_command_strings[command].len);
+	msg->bin[2] = (unsigned char)command;
+	msg->bin_len = 1;
+}
+
+void msg_add_str(message_t* msg, const command_key_t key, const char* field, const size_t field_len, const char* value)
+{
+	const size_t len = strlen(value);
+	msg_put(msg, field, field_len);
+	msg_put(msg, value, len);
+	bin_add_string(msg, key, value, len);
+}
+
+void msg_add_int(message_t* msg, const command_key_t key, const char* field, const size_t field_len, const int value)
+{
+	static const char digit_pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	// Digits are produced two at a time from the end of a scratch buffer
+	char digits[12];
+	char* p = digits + sizeof(digits);
+	unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	while (v >= 100)
+	{
+		const unsigned int pair = (v % 100) * 2;
+		v /= 100;
+		*--p = digit_pairs[pair + 1];
+		*--p = digit_pairs[pair];
+	}
+	if (v >= 10)
+	{
+		*--p = digit_pairs[v * 2 + 1];
+		*--p = digit_pairs[v * 2];
+	}
+	else
+	{
+		*--p = (char)('0' + v);
+	}
+	if (value < 0)
+	{
+		*--p = '-';
+	}
+
+	msg_put(msg, field, field_len);
+	msg_put(msg, p, (size_t)(digits + sizeof(digits) - p));
+	bin_add_varint(msg, key, value < 0 ? 0u : (unsigned int)value);
+}
+
+void msg_add_room_info(message_t* msg, const room_t* room)
+{
+	msg_add_int(msg, MSG_FIELD(ROOM), room->id);
+	msg_add_int(msg, MSG_FIELD(COUNT), room->player_count);
+	msg_add_enum(msg, KEY_STATE, room_state_strings[room->state], room->state);
+}
+
+int parse_room_state(const char* value)
+{
+	for (int i = 0; i < NUM_ROOM_STATES; ++i)
+	{
+		if (strcmp(value, room_state_strings[i]) == 0)
+		{
+			return i;
+		}
+	}
+	// Binary frames carry the enum value, decoded to decimal
+	if (value[0] >= '0' && value[0] <= '9' && value[1] == '\0' && value[0] - '0' < NUM_ROOM_STATES)
+	{
+		return value[0] - '0';
+	}
+	return -1;
+}
+
+size_t msg_encode(message_t* msg, const wire_protocol_t proto, const char** out)
+{
+	if (proto == PROTO_BINARY)
+	{
+		// The length goes right in front of the payload: one byte below 128, two otherwise
+		unsigned char* frame;
+		if (msg->bin_len < 0x80)
+		{
+			frame = msg->bin + 1;
+			frame[0] = (unsigned char)msg->bin_len;
+		}
+		else
+		{
+			frame = msg->bin;
+			frame[0] = (unsigned char)(msg->bin_len | 0x80);
+			frame[1] = (unsigned char)(msg->bin_len >> 7);
+		}
+		*out = (const char*)frame;
+		return (size_t)(msg->bin + 2 + msg->bin_len - frame);
+	}
+
+	// Always room for it, msg_put() keeps the last byte free
+	msg->data[msg->len] = '\n';
+	*out = msg->data;
+	return msg->len + 1;
+}
+
+int msg_send(const int socket, message_t* msg)
+{
+	const char* bytes;
+	const size_t len = msg_encode(msg, get_socket_protocol(socket), &bytes);
+	return (int)reactor_send(socket, bytes, len);
 }
 
 int send_structured_message(const int socket, const server_command_t command, const int num_args, ...)
 {
-	char buffer[MSG_MAX_LEN];
-	int offset = snprintf(buffer, MSG_MAX_LEN, "%s", server_command_strings[command]);
+	message_t msg;
+	msg_begin(&msg, command);
 
 	va_list args;
 	va_start(args, num_args);
@@ -63,51 +374,125 @@ int send_structured_message(const int socket, const server_command_t command, co
 	{
 		const char* key = va_arg(args, const char *);
 		const char* value = va_arg(args, const char *);
-		offset += snprintf(buffer + offset, MSG_MAX_LEN - offset, "|%s:%s", key, value);
+		const size_t key_len = strlen(key);
+		msg_put(&msg, "|", 1);
+		msg_put(&msg, key, key_len);
+		msg_put(&msg, ":", 1);
+		msg_put(&msg, value, strlen(value));
+		bin_add_text_field(&msg, lookup_key(key, key_len), value);
 	}
 	va_end(args);
 
-	strcat(buffer, "\n");
-	return send(socket, buffer, strlen(buffer), 0);
+	return msg_send(socket, &msg);
 }
 
-ssize_t receive_command(player_t* player, char* out_command_buffer, size_t buffer_size)
+/*
+ * Binary counterpart of receive_command(): the next length-prefixed frame.
+ */
+static ssize_t receive_frame(player_t* player, recv_buffer_t* rx, char** out_payload)
 {
-	// Search for a newline in the existing buffer
-	const char* newline_ptr = strchr(player->read_buffer, '\n');
+	// Lines a text scan may have found in binary data (sent right after LOGIN) mean nothing
+	rx->line_count = rx->line_next = 0;
 
-	// If no newline, read more data from the socket
-	while (newline_ptr == NULL)
+	while (1)
 	{
-		// Check if buffer is full before reading
-		if (player->buffer_len >= sizeof(player->read_buffer) - 1)
+		const unsigned char* p = (const unsigned char*)rx->data + rx->start;
+		const size_t available = rx->end - rx->start;
+
+		// Payload length: a varint of at most two bytes, since frames are at most MSG_MAX_LEN
+		size_t header = 0;
+		size_t len = 0;
+		if (available >= 1 && !(p[0] & 0x80))
 		{
-			// Protocol violation or garbage in buffer. Clear it and report error.
-			player->buffer_len = 0;
-			player->read_buffer[0] = '\0';
-			return -2; // Special error for "line too long" or un-parsable buffer
+			header = 1;
+			len = p[0];
+		}
+		else if (available >= 2)
+		{
+			header = 2;
+			len = (p[0] & 0x7f) | (size_t)p[1] << 7;
+		}
+
+		if (header > 0)
+		{
+			if (len == 0 || len > MSG_MAX_LEN || (header == 2 && (p[1] & 0x80)))
+			{
+				// Framing is lost, there is no way to find the next frame
+				rx->start = rx->scanned = rx->end;
+				return -2;
+			}
+			if (available >= header + len)
+			{
+				*out_payload = rx->data + rx->start + header;
+				rx->start += header + len;
+				rx->scanned = rx->start;
+				player->last_activity = time(NULL);
+				return (ssize_t)len;
+			}
+		}
+
+		const ssize_t bytes_read = reactor_fill(player);
+		if (bytes_read == 0)
+		{
+			return 0;
+		}
+		if (bytes_read < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK ? -3 : -1;
 		}
+	}
+}
 
-		const ssize_t bytes_read = read(
-			player->socket,
-			player->read_buffer + player->buffer_len,
-			sizeof(player->read_buffer) - 1 - player->buffer_len
-		);
+ssize_t receive_command(player_t* player, char** out_line)
+{
+	recv_buffer_t* rx = reactor_recv_buffer(player);
+	if (!rx)
+	{
+		return -3; // Not ours to read (e.g. on its way to another shard)
+	}
+	if (get_socket_protocol(player->socket) == PROTO_BINARY)
+	{
+		return receive_frame(player, rx, out_line);
+	}
 
-		if (bytes_read > 0)
+	// Once the lines found by the last scan are used up, scan what arrived since,
+	// reading more from the socket if that does not complete a line
+	while (rx->line_next == rx->line_count)
+	{
+		if (rx->scanned < rx->end)
 		{
-			player->buffer_len += bytes_read;
-			player->read_buffer[player->buffer_len] = '\0'; // Null-terminate
-			newline_ptr = strchr(player->read_buffer, '\n');
+			const size_t found = scan_newlines(rx->data + rx->scanned, rx->end - rx->scanned, rx->lines, RECV_BATCH_MAX);
+			for (size_t i = 0; i < found; ++i)
+			{
+				rx->lines[i] += (uint32_t)rx->scanned;
+			}
+			rx->line_count = (unsigned)found;
+			rx->line_next = 0;
+			// A full batch may have stopped early; the rest gets scanned with the next batch
+			rx->scanned = found == RECV_BATCH_MAX ? rx->lines[found - 1] + 1 : rx->end;
+			if (found > 0)
+			{
+				break;
+			}
+		}
+
+		// A partial line this long can't become a valid command
+		if (rx->end - rx->start >= MSG_MAX_LEN)
+		{
+			// Protocol violation or garbage in buffer. Clear it and report error.
+			rx->start = rx->scanned = rx->end;
+			return -2; // Special error for "line too long" or un-parsable buffer
 		}
-		else if (bytes_read == 0)
+
+		const ssize_t bytes_read = reactor_fill(player);
+		if (bytes_read == 0)
 		{
 			// Graceful disconnect (peer closed connection)
 			return 0;
 		}
-		else
+		if (bytes_read < 0)
 		{
-			// read() returned -1 - check errno
+			// reactor_fill() returned -1 - check errno
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
 			{
 				// Socket timeout - not a disconnect, just no data available
@@ -118,34 +503,27 @@ ssize_t receive_command(player_t* player, char* out_command_buffer, size_t buffe
 		}
 	}
 
-	// A full command (ending in \n) is in the buffer. Extract it.
-	size_t cmd_len = newline_ptr - player->read_buffer;
+	// A full command (ending in \n) is in the buffer. Consume it (and the \n).
+	char* const newline_ptr = rx->data + rx->lines[rx->line_next++];
+	char* line = rx->data + rx->start;
+	size_t cmd_len = newline_ptr - line;
+	rx->start = newline_ptr - rx->data + 1;
 
 	// Trim trailing \r if it exists (for CRLF line endings)
-	if (cmd_len > 0 && player->read_buffer[cmd_len - 1] == '\r')
+	if (cmd_len > 0 && line[cmd_len - 1] == '\r')
 	{
 		cmd_len--;
 	}
 
-	// Check if output buffer is large enough
-	if (cmd_len >= buffer_size)
+	// Check if the command fits the protocol limit
+	if (cmd_len >= MSG_MAX_LEN)
 	{
-		// Command too long for output buffer. Consume it and report error.
-		player->buffer_len -= (newline_ptr - player->read_buffer + 1);
-		memmove(player->read_buffer, newline_ptr + 1, player->buffer_len);
-		player->read_buffer[player->buffer_len] = '\0';
 		return -2;
 	}
 
-	// Copy the command to the output buffer and null-terminate it
-	strncpy(out_command_buffer, player->read_buffer, cmd_len);
-	out_command_buffer[cmd_len] = '\0';
-
-	// Remove the extracted command (and the \n) from the player's buffer
-	// by shifting the remaining data to the beginning.
-	player->buffer_len -= (newline_ptr - player->read_buffer + 1);
-	memmove(player->read_buffer, newline_ptr + 1, player->buffer_len);
-	player->read_buffer[player->buffer_len] = '\0';
+	// Terminate the line in place - the caller gets a view, not a copy
+	line[cmd_len] = '\0';
+	*out_line = line;
 
 	// Update last activity timestamp on successful command receive
 	player->last_activity = time(NULL);
@@ -0,0 +1,1724 @@
+/*
+ * reactor.c - Sharded event loops (epoll or io_uring)
+ *
+ * The server runs one reactor (shard) per thread. Each shard has its own
+ * SO_REUSEPORT listening socket, so the kernel spreads new connections
+ * across shards and nobody serializes on a single accept(). A socket is
+ * owned by exactly one shard at a time - only that thread reads it, runs
+ * its commands and closes it.
+ *
+ * Every socket gets a connection (conn_t) with an outbound queue: messages
+ * produced while handling events are appended there and flushed once at the
+ * end of the loop round, so a game move or a LIST_ROOMS reply costs a single
+ * send() instead of one per message. Sends never block - what the kernel
+ * does not take waits for the socket to become writable again. A client that
+ * stops reading cannot make the queue grow without bound: past the high-water
+ * mark for SLOW_CONSUMER_TIMEOUT seconds (or past the hard limit) it is
+ * evicted and disconnected like any other dropped connection.
+ *
+ * Two I/O backends sit behind the same API, picked once at startup:
+ *  - epoll: non-blocking sockets registered with EPOLLIN|EPOLLOUT and
+ *    EPOLLET; every readable event is drained until EAGAIN (server_on_readable()
+ *    does that) and reactor_fill() is a plain read() into the receive buffer.
+ *  - io_uring: multishot accept, one multishot receive per connection into
+ *    provided buffers, and the flush is a send request submitted with the
+ *    next io_uring_enter(). Completions land in the receive buffer right away,
+ *    so in-game traffic costs no syscall per message.
+ *
+ * Received bytes stay in the connection's buffer and receive_command() hands
+ * out complete lines as views into it - nothing is copied per command.
+ *
+ * Game rooms have no threads of their own - they advance on their players'
+ * socket events and on the timers of the shard hosting them.
+ *
+ * Timers live in a per-shard timer wheel (wheel.h) on a monotonic clock that
+ * is read once per loop round. Every connection has an idle deadline, paused
+ * games have their reconnect deadline, and the shard tick (lobby feed, quick
+ * match, slow consumers) is only armed while one of them has work. The loop
+ * sleeps until the earliest deadline, so an idle server does not wake up at
+ * all.
+ *
+ * To keep both players of a game on one thread, a connection that wants a
+ * room hosted elsewhere is migrated: the owner stops watching it and posts
+ * it to the target shard's mailbox (woken through an eventfd), together with
+ * the command that triggered the move. Messages for sockets of other shards
+ * (lobby broadcasts) travel through the same mailbox, so only the owner ever
+ * writes to a socket and the byte stream stays intact.
+ */
+
+#define _GNU_SOURCE // accept4, pthread_setaffinity_np
+
+#include "reactor.h"
+#include "server.h"
+#include "logger.h"
+#include "config.h"
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64     // accepts per wakeup before other sockets get a turn
+#define TICK_MS 1000        // the shard tick runs at most this often, and only while it has work
+#define IDLE_ROUND_MS 1000   // idle deadlines are rounded up to this, so they share wakeups
+#define STATS_INTERVAL 60   // seconds between per-shard connection counter reports, while they change
+#define SEND_HARD_LIMIT ((size_t)SEND_HIGH_WATER * 4) // no more output is queued once this much waits behind the current send
+#define RECV_BUFFER_SIZE (MSG_MAX_LEN * 4)   // receive buffer per connection
+#define RECV_BUFFER_LIMIT (64 * 1024)        // io_uring: most unprocessed input a connection may pile up
+
+#define URING_ENTRIES 1024  // submission queue size per shard
+#define URING_BUFFERS 512   // provided receive buffers per shard
+#define URING_BUFFER_SIZE (MSG_MAX_LEN * 4)
+
+// io_uring user_data: small values tag the shard's own requests, anything
+// else is a conn_t* with the operation in the low bits
+#define UD_IGNORE 0
+#define UD_ACCEPT 1
+#define UD_WAKE 2
+#define UD_RECV 1
+#define UD_SEND 2
+#define UD_TAG_MASK 3
+
+// Mailbox entry: a connection on its way to this shard, or output for one of its sockets
+typedef struct reactor_msg_s
+{
+	player_t* player;          // migrating player, NULL for output
+	int socket;                // output: the destination socket
+	char command[MSG_MAX_LEN]; // command to run on arrival, empty if none
+	char* pending;             // migration: received but unprocessed bytes (io_uring); output: the bytes
+	size_t pending_len;
+	reactor_release_fn release; // output: pending is borrowed, release(ref) gives it back
+	void* ref;
+	struct reactor_msg_s* next;
+} reactor_msg_t;
+
+// Output held by reference (reactor_send_shared()), sent from the caller's buffer
+typedef struct shared_out_s
+{
+	const char* data;
+	size_t len;
+	size_t after;              // bytes of the conn's queue that go out before it
+	reactor_release_fn release;
+	void* ref;
+	struct shared_out_s* next;
+} shared_out_t;
+
+/*
+ * Per-socket state shared by both backends. It outlives the player's hold on
+ * the socket until the queued output is sent and (io_uring) every request
+ * referencing it has completed: only then is the socket closed (or handed
+ * over to another shard) and the conn freed.
+ */
+typedef struct conn_s
+{
+	player_t* player;          // NULL once the server stopped watching the socket
+	int socket;
+	int recv_armed;            // io_uring: multishot receive outstanding
+	int send_busy;             // io_uring: send in flight; epoll: waiting for EPOLLOUT
+	int closing;               // close the socket once quiet
+	reactor_msg_t* handover;   // migration waiting for the connection to go quiet
+	int queued;                // on the shard's flush list
+	int dead;                  // released, freed at the end of the loop round
+	int discard;               // evicted as a slow consumer, output goes nowhere
+	int slow;                  // on the shard's slow consumer list
+	time_t over_since;         // when the queued output went over the high-water mark
+	deadline_t idle;           // server_on_idle() for the player, armed by reactor_arm_idle()
+	struct conn_s* next_flush;
+	struct conn_s* next_dead;
+	struct conn_s* next_slow;
+
+	recv_buffer_t rx;          // bytes received, not yet framed into commands
+	int in_closed;             // peer closed or the connection failed
+	int in_errno;              // 0 on orderly close
+
+	char* queue;               // output waiting for the current send to finish
+	size_t queue_len;
+	size_t queue_cap;
+	shared_out_t* shared_head; // output held by reference, waiting in order with the queue
+	shared_out_t* shared_tail;
+	size_t shared_len;         // bytes of it not taken for sending yet
+	char* out;                 // output being sent
+	size_t out_len;
+	size_t out_off;
+	size_t out_cap;
+	shared_out_t* out_shared;  // being sent instead of out, NULL if none
+	const char* out_data;      // out or out_shared->data
+} conn_t;
+
+typedef struct
+{
+	int id;
+	int listen_fd;
+	int wake_fd;         // eventfd, written when the mailbox gets a message
+	pthread_t thread;
+
+	reactor_msg_t* mailbox_head;
+	reactor_msg_t* mailbox_tail;
+	pthread_mutex_t mailbox_mutex;
+
+	// epoll backend
+	int epoll_fd;
+	int accept_pending;  // 1 if the last accept batch stopped before EAGAIN
+
+	// io_uring backend
+	uring_t ring;
+
+	conn_t* flush_head;  // connections with output to send this round
+	conn_t* dead_head;   // released connections, freed once no event of this round can point at them
+	conn_t* slow_head;   // connections over the high-water mark
+
+	timer_wheel_t wheel;
+	uint64_t now_ms;     // monotonic clock, read once per loop round
+	deadline_t tick;     // the shard tick, armed while there is work for it
+	int tick_wanted;     // set by other threads asking for a tick, with a wakeup
+	deadline_t stats;    // the next counter report, armed once the counters change
+
+	// Connection counters, only touched by the shard's own thread
+	int connections;     // sockets currently registered with this shard
+	unsigned long accepted;
+	unsigned long rejected;
+	unsigned long migrated_in;
+	unsigned long migrated_out;
+	unsigned long slow_dropped;
+	unsigned long reported_activity; // what the last report covered
+	int reported_connections;
+} reactor_t;
+
+static reactor_t* shards = NULL;
+static int shard_count = 0;
+static int pin_to_cpus = 0;
+static io_backend_t backend = IO_EPOLL;
+
+// Shard run by the calling thread, -1 outside of reactor threads
+static __thread int current_shard = -1;
+
+// socket -> conn_t of the owning shard. Other threads only read conn_owner.
+static conn_t** conns = NULL;
+static int* conn_owner = NULL;
+static int conn_table_size = 0;
+
+// epoll_event.data.ptr is a conn_t* for clients, these tags mark the other fds
+static char listen_tag;
+static char wake_tag;
+
+static void uring_arm_recv(reactor_t* shard, conn_t* conn);
+static void uring_cancel_recv(reactor_t* shard, conn_t* conn);
+static void uring_submit_send(reactor_t* shard, conn_t* conn);
+static void start_send(reactor_t* shard, conn_t* conn);
+static void uring_cancel(reactor_t* shard, uint64_t user_data);
+static void release_if_quiet(reactor_t* shard, conn_t* conn);
+static void check_slow_consumers(reactor_t* shard, time_t now);
+static void arm_tick(reactor_t* shard);
+
+/*
+ * Appends bytes to a growable buffer.
+ */
+static int buffer_append(char** buf, size_t* len, size_t* cap, const char* data, const size_t n)
+{
+	if (*len + n > *cap)
+	{
+		size_t new_cap = *cap ? *cap * 2 : MSG_MAX_LEN * 2;
+		while (new_cap < *len + n)
+		{
+			new_cap *= 2;
+		}
+		char* grown = realloc(*buf, new_cap);
+		if (!grown)
+		{
+			return -1;
+		}
+		*buf = grown;
+		*cap = new_cap;
+	}
+	memcpy(*buf + *len, data, n);
+	*len += n;
+	return 0;
+}
+
+/*
+ * The conn of a socket owned by the calling thread's shard, or NULL.
+ */
+static conn_t* local_conn(const int socket)
+{
+	if (socket < 0 || socket >= conn_table_size || conn_owner[socket] != current_shard)
+	{
+		return NULL;
+	}
+	return conns[socket];
+}
+
+/*
+ * Makes room for n more bytes at the end of the receive buffer: first by
+ * sliding the unconsumed bytes to the front, then (io_uring) by growing it.
+ */
+static int rx_reserve(recv_buffer_t* rx, const size_t n)
+{
+	if (rx->start == rx->end)
+	{
+		rx->start = rx->end = rx->scanned = 0;
+		rx->line_count = rx->line_next = 0;
+	}
+	if (rx->end + n <= rx->cap)
+	{
+		return 0;
+	}
+	if (rx->start > 0)
+	{
+		memmove(rx->data, rx->data + rx->start, rx->end - rx->start);
+		for (unsigned i = rx->line_next; i < rx->line_count; ++i)
+		{
+			rx->lines[i] -= (uint32_t)rx->start;
+		}
+		rx->end -= rx->start;
+		rx->scanned -= rx->start;
+		rx->start = 0;
+		if (rx->end + n <= rx->cap)
+		{
+			return 0;
+		}
+	}
+
+	size_t new_cap = rx->cap * 2;
+	while (new_cap < rx->end + n)
+	{
+		new_cap *= 2;
+	}
+	if (new_cap > RECV_BUFFER_LIMIT)
+	{
+		return -1;
+	}
+	char* grown = realloc(rx->data, new_cap);
+	if (!grown)
+	{
+		return -1;
+	}
+	rx->data = grown;
+	rx->cap = new_cap;
+	return 0;
+}
+
+/*
+ * Output queued or in flight, not taken by the kernel yet.
+ */
+static size_t pending_output(const conn_t* conn)
+{
+	return conn->queue_len + conn->shared_len + conn->out_len - conn->out_off;
+}
+
+static int has_queued(const conn_t* conn)
+{
+	return conn->queue_len > 0 || conn->shared_head;
+}
+
+/*
+ * Done with the output being sent: sent, or dropped.
+ */
+static void finish_out(conn_t* conn)
+{
+	conn->out_len = 0;
+	conn->out_off = 0;
+	if (conn->out_shared)
+	{
+		conn->out_shared->release(conn->out_shared->ref);
+		free(conn->out_shared);
+		conn->out_shared = NULL;
+	}
+}
+
+/*
+ * Forgets the output not taken for sending yet.
+ */
+static void drop_queue(conn_t* conn)
+{
+	conn->queue_len = 0;
+	while (conn->shared_head)
+	{
+		shared_out_t* shared = conn->shared_head;
+		conn->shared_head = shared->next;
+		shared->release(shared->ref);
+		free(shared);
+	}
+	conn->shared_tail = NULL;
+	conn->shared_len = 0;
+}
+
+static int init_epoll(reactor_t* shard)
+{
+	shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (shard->epoll_fd < 0)
+	{
+		LOG(LOG_SERVER, "epoll_create1() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = &listen_tag;
+	if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->listen_fd, &ev) < 0)
+	{
+		LOG(LOG_SERVER, "epoll_ctl(listen) failed: %s", strerror(errno));
+		return -1;
+	}
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = &wake_tag;
+	if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wake_fd, &ev) < 0)
+	{
+		LOG(LOG_SERVER, "epoll_ctl(eventfd) failed: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The socket -> conn table covers every descriptor the process may open.
+ */
+static int init_conn_table()
+{
+	struct rlimit fd_limit;
+	conn_table_size = getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY
+		? (int)fd_limit.rlim_cur
+		: 65536;
+	conns = calloc(conn_table_size, sizeof(conn_t*));
+	conn_owner = malloc(conn_table_size * sizeof(int));
+	if (!conns || !conn_owner)
+	{
+		LOG(LOG_SERVER, "Out of memory while creating the connection table.");
+		return -1;
+	}
+	for (int i = 0; i < conn_table_size; ++i)
+	{
+		conn_owner[i] = -1;
+	}
+	return 0;
+}
+
+/*
+ * Sets up a ring per shard. Any failure means the kernel (or a seccomp
+ * profile) won't give us io_uring; the caller then falls back to epoll.
+ */
+static int init_uring()
+{
+	for (int i = 0; i < shard_count; ++i)
+	{
+		shards[i].ring.fd = -1;
+	}
+	for (int i = 0; i < shard_count; ++i)
+	{
+		if (uring_init(&shards[i].ring, URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE) != 0)
+		{
+			LOG(LOG_SERVER, "io_uring setup failed on shard %d: %s", i, strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void destroy_uring()
+{
+	for (int i = 0; i < shard_count; ++i)
+	{
+		if (shards[i].ring.fd >= 0)
+		{
+			uring_destroy(&shards[i].ring);
+		}
+	}
+}
+
+int reactor_init(const int* listen_fds, const int count, const int pin_threads, const io_backend_t io)
+{
+	shards = calloc(count, sizeof(reactor_t));
+	if (!shards)
+	{
+		LOG(LOG_SERVER, "Out of memory while creating %d reactor shards.", count);
+		return -1;
+	}
+	shard_count = count;
+	pin_to_cpus = pin_threads;
+	if (init_conn_table() != 0)
+	{
+		return -1;
+	}
+
+	backend = io;
+	if (backend == IO_URING && init_uring() != 0)
+	{
+		LOG(LOG_SERVER, "io_uring is not available, falling back to epoll.");
+		destroy_uring();
+		backend = IO_EPOLL;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		reactor_t* shard = &shards[i];
+		shard->id = i;
+		shard->listen_fd = listen_fds[i];
+		pthread_mutex_init(&shard->mailbox_mutex, NULL);
+
+		shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (shard->wake_fd < 0)
+		{
+			LOG(LOG_SERVER, "eventfd() failed: %s", strerror(errno));
+			return -1;
+		}
+
+		if (backend == IO_EPOLL && init_epoll(shard) != 0)
+		{
+			return -1;
+		}
+	}
+
+	LOG(LOG_SERVER, "Using the %s I/O backend.", backend == IO_URING ? "io_uring" : "epoll");
+	return 0;
+}
+
+int reactor_watch(player_t* player)
+{
+	reactor_t* shard = &shards[player->shard];
+	if (player->socket >= conn_table_size)
+	{
+		LOG(LOG_SERVER, "Socket %d is out of range of the connection table.", player->socket);
+		return -1;
+	}
+	conn_t* conn = calloc(1, sizeof(conn_t));
+	if (!conn)
+	{
+		LOG(LOG_SERVER, "Out of memory while watching socket %d.", player->socket);
+		return -1;
+	}
+	conn->player = player;
+	conn->socket = player->socket;
+	conn->rx.data = malloc(RECV_BUFFER_SIZE);
+	if (!conn->rx.data)
+	{
+		LOG(LOG_SERVER, "Out of memory while watching socket %d.", player->socket);
+		free(conn);
+		return -1;
+	}
+	conn->rx.cap = RECV_BUFFER_SIZE;
+
+	if (backend == IO_URING)
+	{
+		uring_arm_recv(shard, conn);
+	}
+	else
+	{
+		// EPOLLOUT is edge-triggered too: it only fires when a full send buffer drains
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = conn;
+		if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, player->socket, &ev) < 0)
+		{
+			LOG(LOG_SERVER, "epoll_ctl(ADD) failed for socket %d: %s", player->socket, strerror(errno));
+			free(conn->rx.data);
+			free(conn);
+			return -1;
+		}
+	}
+	conns[conn->socket] = conn;
+	conn_owner[conn->socket] = shard->id;
+	player->watched = 1;
+	shard->connections++;
+	return 0;
+}
+
+void reactor_unwatch(player_t* player)
+{
+	if (!player->watched)
+	{
+		return;
+	}
+	reactor_t* shard = &shards[player->shard];
+	conn_t* conn = local_conn(player->socket);
+	if (conn)
+	{
+		// Output queued so far still goes out, input from now on is ignored
+		conn->player = NULL;
+		wheel_cancel(&conn->idle);
+		if (backend == IO_URING)
+		{
+			uring_cancel_recv(shard, conn);
+		}
+	}
+	player->watched = 0;
+	shard->connections--;
+}
+
+void reactor_close(const int socket)
+{
+	conn_t* conn = local_conn(socket);
+	if (!conn)
+	{
+		close(socket);
+		return;
+	}
+
+	// The socket stays open until the queued output is sent and the receive is gone
+	conns[socket] = NULL;
+	conn_owner[socket] = -1;
+	conn->player = NULL;
+	conn->closing = 1;
+	release_if_quiet(&shards[current_shard], conn);
+}
+
+void reactor_rebind(player_t* from, player_t* to)
+{
+	conn_t* conn = local_conn(to->socket);
+	if (conn)
+	{
+		conn->player = to;
+	}
+	to->shard = from->shard;
+	from->watched = 0;
+	to->watched = 1;
+}
+
+static void post_message(reactor_t* target, reactor_msg_t* msg)
+{
+	pthread_mutex_lock(&target->mailbox_mutex);
+	const int was_empty = target->mailbox_head == NULL;
+	if (target->mailbox_tail)
+	{
+		target->mailbox_tail->next = msg;
+	}
+	else
+	{
+		target->mailbox_head = msg;
+	}
+	target->mailbox_tail = msg;
+	pthread_mutex_unlock(&target->mailbox_mutex);
+
+	// A non-empty mailbox already has a wakeup on the way
+	const uint64_t one = 1;
+	if (was_empty && write(target->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+	{
+		LOG(LOG_SERVER, "eventfd write failed: %s", strerror(errno));
+	}
+}
+
+void reactor_migrate(player_t* player, const int shard_id, const char* command)
+{
+	reactor_msg_t* msg = calloc(1, sizeof(reactor_msg_t));
+	if (!msg)
+	{
+		LOG(LOG_SERVER, "Out of memory while migrating player %s.", player->nickname);
+		return;
+	}
+	msg->player = player;
+	if (command)
+	{
+		strncpy(msg->command, command, sizeof(msg->command) - 1);
+	}
+
+	reactor_t* source = &shards[player->shard];
+	conn_t* conn = local_conn(player->socket);
+	reactor_unwatch(player);
+	source->migrated_out++;
+	// From here on the socket belongs to the target shard
+	player->shard = shard_id;
+
+	if (conn)
+	{
+		// Hand over once the queued output is out and (io_uring) the receive is gone
+		conns[conn->socket] = NULL;
+		conn_owner[conn->socket] = -1;
+		conn->handover = msg;
+		release_if_quiet(source, conn);
+		return;
+	}
+	post_message(&shards[shard_id], msg);
+}
+
+recv_buffer_t* reactor_recv_buffer(const player_t* player)
+{
+	conn_t* conn = local_conn(player->socket);
+	return conn ? &conn->rx : NULL;
+}
+
+ssize_t reactor_fill(const player_t* player)
+{
+	conn_t* conn = local_conn(player->socket);
+	if (!conn)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (backend == IO_URING)
+	{
+		// Completions are copied in as they arrive; there is nothing to fetch here
+		if (conn->in_closed)
+		{
+			errno = conn->in_errno;
+			return conn->in_errno ? -1 : 0;
+		}
+		errno = EAGAIN;
+		return -1;
+	}
+
+	recv_buffer_t* rx = &conn->rx;
+	if (rx_reserve(rx, 1) != 0)
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+	const ssize_t bytes_read = read(conn->socket, rx->data + rx->end, rx->cap - rx->end);
+	if (bytes_read > 0)
+	{
+		rx->end += bytes_read;
+	}
+	return bytes_read;
+}
+
+/*
+ * Stops queueing output for a connection and evicts it on the next tick.
+ */
+static void refuse_output(reactor_t* shard, conn_t* conn)
+{
+	conn->over_since = 0;
+	if (!conn->slow)
+	{
+		conn->slow = 1;
+		conn->next_slow = shard->slow_head;
+		shard->slow_head = conn;
+		arm_tick(shard);
+	}
+}
+
+static int append_shared(conn_t* conn, const char* data, const size_t len, const reactor_release_fn release, void* ref)
+{
+	shared_out_t* shared = malloc(sizeof(shared_out_t));
+	if (!shared)
+	{
+		return -1;
+	}
+	shared->data = data;
+	shared->len = len;
+	shared->after = conn->queue_len;
+	shared->release = release;
+	shared->ref = ref;
+	shared->next = NULL;
+	if (conn->shared_tail)
+	{
+		conn->shared_tail->next = shared;
+	}
+	else
+	{
+		conn->shared_head = shared;
+	}
+	conn->shared_tail = shared;
+	conn->shared_len += len;
+	return 0;
+}
+
+/*
+ * Queues output for a socket of the calling shard: a copy of the bytes, or with release
+ * set, a reference to them. The reference is given up here if the output is refused.
+ */
+static ssize_t queue_output(conn_t* conn, const char* data, const size_t len, const reactor_release_fn release, void* ref)
+{
+	reactor_t* shard = &shards[current_shard];
+	if (conn->discard)
+	{
+		if (release)
+		{
+			release(ref);
+		}
+		return (ssize_t)len; // being evicted, nobody reads this any more
+	}
+	size_t pending = pending_output(conn) + len;
+	if (pending > (size_t)SEND_HIGH_WATER && !conn->send_busy)
+	{
+		// A burst (many pipelined commands in one round) - don't wait for the end of the round
+		start_send(shard, conn);
+		pending = pending_output(conn) + len;
+	}
+	// Only output waiting behind the current send counts against the hard limit: one large reply
+	// (a full LIST_ROOMS) is still accepted into an empty queue, and what follows it is queued
+	// while it is being sent
+	const int queued = conn->queue_len + conn->shared_len <= SEND_HARD_LIMIT && (release
+		? append_shared(conn, data, len, release, ref)
+		: buffer_append(&conn->queue, &conn->queue_len, &conn->queue_cap, data, len)) == 0;
+	if (!queued)
+	{
+		if (release)
+		{
+			release(ref);
+		}
+		refuse_output(shard, conn);
+		errno = ENOBUFS;
+		return -1;
+	}
+	if (pending > (size_t)SEND_HIGH_WATER && !conn->slow)
+	{
+		conn->slow = 1;
+		conn->over_since = time(NULL);
+		conn->next_slow = shard->slow_head;
+		shard->slow_head = conn;
+		arm_tick(shard);
+	}
+	if (!conn->queued)
+	{
+		conn->queued = 1;
+		conn->next_flush = shard->flush_head;
+		shard->flush_head = conn;
+	}
+	return (ssize_t)len;
+}
+
+/*
+ * Hands output for a socket of another shard over to it, a copy of the bytes or the reference.
+ */
+static ssize_t post_output(const int owner, const int socket, const char* data, const size_t len, const reactor_release_fn release, void* ref)
+{
+	reactor_msg_t* msg = calloc(1, sizeof(reactor_msg_t));
+	char* copy = release ? (char*)data : malloc(len);
+	if (!msg || !copy)
+	{
+		free(msg);
+		if (release)
+		{
+			release(ref);
+		}
+		else
+		{
+			free(copy);
+		}
+		errno = ENOMEM;
+		return -1;
+	}
+	if (!release)
+	{
+		memcpy(copy, data, len);
+	}
+	msg->socket = socket;
+	msg->pending = copy;
+	msg->pending_len = len;
+	msg->release = release;
+	msg->ref = ref;
+	post_message(&shards[owner], msg);
+	return (ssize_t)len;
+}
+
+ssize_t reactor_send(const int socket, const char* data, const size_t len)
+{
+	conn_t* conn = local_conn(socket);
+	if (conn)
+	{
+		return queue_output(conn, data, len, NULL, NULL);
+	}
+	const int owner = socket >= 0 && socket < conn_table_size ? conn_owner[socket] : -1;
+	if (owner < 0)
+	{
+		// Not a reactor connection (yet), e.g. a rejected accept
+		return send(socket, data, len, MSG_NOSIGNAL);
+	}
+	// Another shard owns the socket - let it queue the bytes with its own output
+	return post_output(owner, socket, data, len, NULL, NULL);
+}
+
+ssize_t reactor_send_shared(const int socket, const char* data, const size_t len, const reactor_release_fn release, void* ref)
+{
+	conn_t* conn = local_conn(socket);
+	if (conn)
+	{
+		return queue_output(conn, data, len, release, ref);
+	}
+	const int owner = socket >= 0 && socket < conn_table_size ? conn_owner[socket] : -1;
+	if (owner < 0)
+	{
+		const ssize_t sent = send(socket, data, len, MSG_NOSIGNAL);
+		release(ref);
+		return sent;
+	}
+	return post_output(owner, socket, data, len, release, ref);
+}
+
+static void drain_mailbox(reactor_t* shard)
+{
+	uint64_t count;
+	while (read(shard->wake_fd, &count, sizeof(count)) > 0)
+	{
+		// just resetting the counter
+	}
+
+	pthread_mutex_lock(&shard->mailbox_mutex);
+	reactor_msg_t* msg = shard->mailbox_head;
+	shard->mailbox_head = NULL;
+	shard->mailbox_tail = NULL;
+	pthread_mutex_unlock(&shard->mailbox_mutex);
+
+	while (msg)
+	{
+		reactor_msg_t* next = msg->next;
+		player_t* player = msg->player;
+		if (!player)
+		{
+			// Output from another shard; dropped if the socket is gone by now
+			if (msg->release)
+			{
+				if (local_conn(msg->socket))
+				{
+					reactor_send_shared(msg->socket, msg->pending, msg->pending_len, msg->release, msg->ref);
+				}
+				else
+				{
+					msg->release(msg->ref);
+				}
+			}
+			else
+			{
+				if (local_conn(msg->socket))
+				{
+					reactor_send(msg->socket, msg->pending, msg->pending_len);
+				}
+				free(msg->pending);
+			}
+			free(msg);
+			msg = next;
+			continue;
+		}
+
+		shard->migrated_in++;
+		if (reactor_watch(player) == 0)
+		{
+			conn_t* conn = local_conn(player->socket);
+			if (conn && msg->pending && rx_reserve(&conn->rx, msg->pending_len) == 0)
+			{
+				// Bytes the previous shard received come before anything read here
+				memcpy(conn->rx.data + conn->rx.end, msg->pending, msg->pending_len);
+				conn->rx.end += msg->pending_len;
+			}
+			server_on_migrated(player, msg->command[0] ? msg->command : NULL);
+		}
+		free(msg->pending);
+		free(msg);
+		msg = next;
+	}
+}
+
+static void on_accepted(reactor_t* shard, const int client_socket)
+{
+	if (server_on_accept(client_socket, shard->id) == 0)
+	{
+		shard->accepted++;
+	}
+	else
+	{
+		shard->rejected++;
+	}
+}
+
+static void accept_pending(reactor_t* shard)
+{
+	shard->accept_pending = 0;
+	for (int i = 0; i < ACCEPT_BATCH; ++i)
+	{
+		const int client_socket = accept4(shard->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_socket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				LOG(LOG_SERVER, "accept() failed on shard %d: %s", shard->id, strerror(errno));
+			}
+			return;
+		}
+		on_accepted(shard, client_socket);
+	}
+
+	// Batch is full but the backlog may not be empty. The edge won't fire again,
+	// so come back next round, right after serving the sockets that are ready by then.
+	shard->accept_pending = 1;
+}
+
+static unsigned long stats_activity(const reactor_t* shard)
+{
+	return shard->accepted + shard->rejected + shard->migrated_in + shard->migrated_out + shard->slow_dropped;
+}
+
+static void log_stats(void* arg)
+{
+	reactor_t* shard = arg;
+	shard->reported_activity = stats_activity(shard);
+	shard->reported_connections = shard->connections;
+	LOG(
+		LOG_SERVER, "Shard %d: %d connections, %lu accepted, %lu rejected, %lu migrated in, %lu migrated out, %lu slow consumers dropped.",
+		shard->id, shard->connections, shard->accepted, shard->rejected, shard->migrated_in, shard->migrated_out,
+		shard->slow_dropped
+	);
+	if (shard->id == 0)
+	{
+		// Games are not per shard, the first one speaks for all
+		game_stats_t games_now;
+		game_stats(&games_now, room_slots());
+		LOG(
+			LOG_SERVER, "Games: %d running (%ld points banked), %d decided and not yet cleared.",
+			games_now.running, games_now.points, games_now.decided
+		);
+	}
+}
+
+static void refresh_clock(reactor_t* shard)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	shard->now_ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void run_tick(void* arg)
+{
+	reactor_t* shard = arg;
+	const time_t now = time(NULL);
+	check_slow_consumers(shard, now);
+	server_on_tick(shard->id);
+	if (shard->slow_head)
+	{
+		arm_tick(shard);
+	}
+}
+
+/*
+ * Runs the shard tick TICK_MS from now, unless it is armed already - work that comes
+ * up in the meantime waits for the same tick.
+ */
+static void arm_tick(reactor_t* shard)
+{
+	if (!wheel_armed(&shard->tick))
+	{
+		wheel_arm(&shard->wheel, &shard->tick, shard->now_ms + TICK_MS, run_tick, shard);
+	}
+}
+
+static void on_idle(void* arg)
+{
+	const conn_t* conn = arg;
+	if (conn->player && conn->player->watched)
+	{
+		server_on_idle(conn->player);
+	}
+}
+
+void reactor_arm(deadline_t* deadline, const int delay_ms, void (*fire)(void* arg), void* arg)
+{
+	reactor_t* shard = &shards[current_shard];
+	wheel_arm(&shard->wheel, deadline, shard->now_ms + (uint64_t)delay_ms, fire, arg);
+}
+
+void reactor_disarm(deadline_t* deadline)
+{
+	wheel_cancel(deadline);
+}
+
+void reactor_arm_idle(const player_t* player, const int delay_ms)
+{
+	conn_t* conn = local_conn(player->socket);
+	if (conn)
+	{
+		// Idle timeouts count whole seconds anyway: rounded up to one, they fire together
+		reactor_t* shard = &shards[current_shard];
+		const uint64_t due = (shard->now_ms + (uint64_t)delay_ms + IDLE_ROUND_MS - 1) / IDLE_ROUND_MS * IDLE_ROUND_MS;
+		wheel_arm(&shard->wheel, &conn->idle, due, on_idle, conn);
+	}
+}
+
+void reactor_schedule_tick(const int shard_id)
+{
+	if (!shards)
+	{
+		return; // no reactor (benchmarks driving the lobby directly)
+	}
+	reactor_t* shard = &shards[shard_id];
+	if (shard_id == current_shard)
+	{
+		arm_tick(shard);
+		return;
+	}
+
+	// The first request since the shard last looked wakes it, later ones ride along
+	const uint64_t one = 1;
+	if (!__atomic_exchange_n(&shard->tick_wanted, 1, __ATOMIC_ACQ_REL) && write(shard->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+	{
+		LOG(LOG_SERVER, "eventfd write failed: %s", strerror(errno));
+	}
+}
+
+/*
+ * After every loop round: fires the deadlines that are due and arms the tick and the
+ * counter report if they have work.
+ */
+static void housekeeping(reactor_t* shard)
+{
+	if (__atomic_load_n(&shard->tick_wanted, __ATOMIC_ACQUIRE) && __atomic_exchange_n(&shard->tick_wanted, 0, __ATOMIC_ACQ_REL))
+	{
+		arm_tick(shard);
+	}
+	wheel_advance(&shard->wheel, shard->now_ms);
+
+	if (
+		!wheel_armed(&shard->stats) &&
+		(stats_activity(shard) != shard->reported_activity || shard->connections != shard->reported_connections)
+	)
+	{
+		wheel_arm(&shard->wheel, &shard->stats, shard->now_ms + STATS_INTERVAL * 1000, log_stats, shard);
+	}
+}
+
+static void uring_arm_accept(reactor_t* shard)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&shard->ring);
+	if (!sqe)
+	{
+		LOG(LOG_SERVER, "io_uring submission queue full, cannot accept on shard %d.", shard->id);
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = shard->listen_fd;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = UD_ACCEPT;
+}
+
+static void uring_arm_wake(reactor_t* shard)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&shard->ring);
+	if (!sqe)
+	{
+		LOG(LOG_SERVER, "io_uring submission queue full, cannot watch the mailbox of shard %d.", shard->id);
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = shard->wake_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = UD_WAKE;
+}
+
+static void uring_arm_recv(reactor_t* shard, conn_t* conn)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&shard->ring);
+	if (!sqe)
+	{
+		LOG(LOG_SERVER, "io_uring submission queue full, cannot read socket %d.", conn->socket);
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->socket;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | UD_RECV;
+	conn->recv_armed = 1;
+}
+
+static void uring_cancel(reactor_t* shard, const uint64_t user_data)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&shard->ring);
+	if (!sqe)
+	{
+		return;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = UD_IGNORE;
+}
+
+static void uring_cancel_recv(reactor_t* shard, conn_t* conn)
+{
+	if (conn->recv_armed)
+	{
+		uring_cancel(shard, (uint64_t)(uintptr_t)conn | UD_RECV);
+	}
+}
+
+static void uring_submit_send(reactor_t* shard, conn_t* conn)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&shard->ring);
+	if (!sqe)
+	{
+		LOG(LOG_SERVER, "io_uring submission queue full, dropping output for socket %d.", conn->socket);
+		finish_out(conn);
+		conn->send_busy = 0;
+		return;
+	}
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->socket;
+	sqe->addr = (uint64_t)(uintptr_t)(conn->out_data + conn->out_off);
+	sqe->len = (unsigned)(conn->out_len - conn->out_off);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | UD_SEND;
+	conn->send_busy = 1;
+}
+
+/*
+ * Moves the queued output into the send buffer, up to the next shared output, or
+ * takes that shared output when it is next. Only one send per connection is in
+ * flight, so the bytes leave in order.
+ */
+static int take_queue(reactor_t* shard, conn_t* conn)
+{
+	shared_out_t* shared = conn->shared_head;
+	if (shared && shared->after == 0)
+	{
+		conn->shared_head = shared->next;
+		if (!conn->shared_head)
+		{
+			conn->shared_tail = NULL;
+		}
+		conn->shared_len -= shared->len;
+		conn->out_shared = shared;
+		conn->out_data = shared->data;
+		conn->out_len = shared->len;
+		conn->out_off = 0;
+		return 1;
+	}
+	if (conn->queue_len == 0)
+	{
+		return 0;
+	}
+	const size_t queued = conn->queue_len;
+	const size_t take = shared ? shared->after : queued;
+	char* buf = conn->out;
+	const size_t cap = conn->out_cap;
+	conn->out = conn->queue;
+	conn->out_cap = conn->queue_cap;
+	conn->out_data = conn->out;
+	conn->out_len = take;
+	conn->out_off = 0;
+	conn->queue = buf;
+	conn->queue_cap = cap;
+	conn->queue_len = 0;
+	if (take < queued)
+	{
+		// What was queued after the shared output waits behind it
+		if (buffer_append(&conn->queue, &conn->queue_len, &conn->queue_cap, conn->out + take, queued - take) != 0)
+		{
+			LOG(LOG_SERVER, "Out of memory queueing output for socket %d, disconnecting.", conn->socket);
+			drop_queue(conn);
+			conn->discard = 1;
+			refuse_output(shard, conn);
+			return 1;
+		}
+		for (; shared; shared = shared->next)
+		{
+			shared->after -= take;
+		}
+	}
+	return 1;
+}
+
+/*
+ * epoll: writes as much of the output as the socket takes right now. The
+ * rest waits for the EPOLLOUT edge.
+ */
+static void epoll_send(reactor_t* shard, conn_t* conn)
+{
+	while (conn->out_off < conn->out_len || take_queue(shard, conn))
+	{
+		const ssize_t sent = send(conn->socket, conn->out_data + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL);
+		if (sent > 0)
+		{
+			conn->out_off += sent;
+			if (conn->out_off == conn->out_len)
+			{
+				finish_out(conn);
+			}
+			continue;
+		}
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			conn->send_busy = 1;
+			return;
+		}
+
+		// The peer is gone; the receive side reports it. Drop the output.
+		drop_queue(conn);
+		break;
+	}
+	finish_out(conn);
+	conn->send_busy = 0;
+}
+
+static void start_send(reactor_t* shard, conn_t* conn)
+{
+	if (conn->send_busy)
+	{
+		return;
+	}
+	if (backend == IO_URING)
+	{
+		if (take_queue(shard, conn))
+		{
+			uring_submit_send(shard, conn);
+		}
+	}
+	else
+	{
+		epoll_send(shard, conn);
+	}
+}
+
+/*
+ * Releases a conn nobody watches any more once its output is sent and no
+ * request references it: the socket is then closed, or passed on to the
+ * shard it migrated to. The memory goes at the end of the loop round.
+ */
+static void release_if_quiet(reactor_t* shard, conn_t* conn)
+{
+	if (conn->player || conn->dead || conn->recv_armed || conn->send_busy || conn->queued)
+	{
+		return;
+	}
+	if (has_queued(conn))
+	{
+		start_send(shard, conn);
+		if (conn->send_busy)
+		{
+			return;
+		}
+	}
+
+	if (conn->handover)
+	{
+		reactor_msg_t* msg = conn->handover;
+		if (backend == IO_EPOLL)
+		{
+			epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+		}
+		// A copy: the current command may still be looking at the buffer
+		const size_t unread = conn->rx.end - conn->rx.start;
+		msg->pending = unread ? malloc(unread) : NULL;
+		if (msg->pending)
+		{
+			memcpy(msg->pending, conn->rx.data + conn->rx.start, unread);
+			msg->pending_len = unread;
+		}
+		post_message(&shards[msg->player->shard], msg);
+	}
+	else if (conn->closing)
+	{
+		close(conn->socket);
+	}
+	else
+	{
+		// Unwatched but neither closed nor migrated (yet) - wait for one of those
+		return;
+	}
+
+	conn->dead = 1;
+	conn->next_dead = shard->dead_head;
+	shard->dead_head = conn;
+}
+
+/*
+ * End of a loop round: one send per connection that got output this round.
+ */
+static void flush_output(reactor_t* shard)
+{
+	conn_t* conn = shard->flush_head;
+	shard->flush_head = NULL;
+	while (conn)
+	{
+		conn_t* next = conn->next_flush;
+		conn->queued = 0;
+		conn->next_flush = NULL;
+		start_send(shard, conn);
+		release_if_quiet(shard, conn);
+		conn = next;
+	}
+}
+
+static void unlink_slow(reactor_t* shard, const conn_t* conn)
+{
+	for (conn_t** link = &shard->slow_head; *link; link = &(*link)->next_slow)
+	{
+		if (*link == conn)
+		{
+			*link = conn->next_slow;
+			return;
+		}
+	}
+}
+
+/*
+ * Drops the output of a client that does not read it and disconnects the
+ * player, the same way as if the connection had been lost.
+ */
+static void evict_slow_consumer(reactor_t* shard, conn_t* conn)
+{
+	shard->slow_dropped++;
+	LOG(
+		LOG_SERVER, "Socket %d is not reading its output (%zu bytes queued), disconnecting.",
+		conn->socket, pending_output(conn)
+	);
+
+	conn->discard = 1;
+	drop_queue(conn);
+	if (backend == IO_URING)
+	{
+		if (conn->send_busy)
+		{
+			uring_cancel(shard, (uint64_t)(uintptr_t)conn | UD_SEND);
+		}
+	}
+	else
+	{
+		finish_out(conn);
+		conn->send_busy = 0;
+	}
+
+	if (conn->player && conn->player->watched)
+	{
+		server_on_slow_consumer(conn->player);
+	}
+	else
+	{
+		release_if_quiet(shard, conn);
+	}
+}
+
+/*
+ * Once per tick: evicts connections that stayed over the high-water mark too long.
+ */
+static void check_slow_consumers(reactor_t* shard, const time_t now)
+{
+	conn_t** link = &shard->slow_head;
+	while (*link)
+	{
+		conn_t* conn = *link;
+		const int drained = pending_output(conn) <= (size_t)SEND_HIGH_WATER && conn->over_since != 0;
+		if (!drained && now - conn->over_since < SLOW_CONSUMER_TIMEOUT)
+		{
+			link = &conn->next_slow;
+			continue;
+		}
+
+		*link = conn->next_slow;
+		conn->slow = 0;
+		if (!drained)
+		{
+			evict_slow_consumer(shard, conn);
+		}
+	}
+}
+
+static void free_dead(reactor_t* shard)
+{
+	while (shard->dead_head)
+	{
+		conn_t* conn = shard->dead_head;
+		shard->dead_head = conn->next_dead;
+		if (conn->slow)
+		{
+			unlink_slow(shard, conn);
+		}
+		wheel_cancel(&conn->idle);
+		drop_queue(conn);
+		finish_out(conn);
+		free(conn->rx.data);
+		free(conn->queue);
+		free(conn->out);
+		free(conn);
+	}
+}
+
+static void uring_on_recv(reactor_t* shard, conn_t* conn, const int res, const unsigned flags)
+{
+	if (!(flags & IORING_CQE_F_MORE))
+	{
+		conn->recv_armed = 0;
+	}
+
+	if (res > 0)
+	{
+		const unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if (rx_reserve(&conn->rx, res) == 0)
+		{
+			memcpy(conn->rx.data + conn->rx.end, uring_buffer(&shard->ring, bid), res);
+			conn->rx.end += res;
+		}
+		else
+		{
+			conn->in_closed = 1;
+			conn->in_errno = ENOBUFS;
+		}
+		uring_recycle_buffer(&shard->ring, bid);
+	}
+	else if (res == 0)
+	{
+		conn->in_closed = 1;
+	}
+	else if (res != -ENOBUFS && res != -ECANCELED)
+	{
+		conn->in_closed = 1;
+		conn->in_errno = -res;
+	}
+
+	if (!conn->player)
+	{
+		release_if_quiet(shard, conn);
+		return;
+	}
+
+	// Multishot ends on errors and when the buffers ran out - re-arm while the peer is there
+	if (!conn->recv_armed && !conn->in_closed)
+	{
+		uring_arm_recv(shard, conn);
+	}
+	if (res != -ENOBUFS)
+	{
+		server_on_readable(conn->player);
+	}
+}
+
+static void uring_on_send(reactor_t* shard, conn_t* conn, const int res)
+{
+	conn->send_busy = 0;
+	if (conn->discard)
+	{
+		drop_queue(conn); // evicted - forget the rest
+	}
+	else if (res > 0)
+	{
+		conn->out_off += res;
+		if (conn->out_off < conn->out_len)
+		{
+			uring_submit_send(shard, conn); // short send - push the rest
+			return;
+		}
+	}
+	else if (res == -EAGAIN || res == -EINTR)
+	{
+		uring_submit_send(shard, conn);
+		return;
+	}
+	else
+	{
+		// The peer is gone; the receive side reports it. Drop the output.
+		drop_queue(conn);
+	}
+	finish_out(conn);
+
+	if (has_queued(conn))
+	{
+		start_send(shard, conn);
+	}
+	release_if_quiet(shard, conn);
+}
+
+static void uring_loop(reactor_t* shard)
+{
+	uring_arm_accept(shard);
+	uring_arm_wake(shard);
+
+	while (1)
+	{
+		flush_output(shard);
+		free_dead(shard);
+		if (uring_submit_and_wait(&shard->ring, wheel_timeout(&shard->wheel, shard->now_ms)) != 0)
+		{
+			LOG(LOG_SERVER, "io_uring_enter() failed on shard %d: %s", shard->id, strerror(errno));
+			return;
+		}
+		refresh_clock(shard);
+
+		struct io_uring_cqe* cqe;
+		while ((cqe = uring_peek_cqe(&shard->ring)))
+		{
+			const uint64_t user_data = cqe->user_data;
+			const int res = cqe->res;
+			const unsigned flags = cqe->flags;
+			uring_cqe_seen(&shard->ring);
+
+			if (user_data == UD_ACCEPT)
+			{
+				if (res >= 0)
+				{
+					on_accepted(shard, res);
+				}
+				else if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED)
+				{
+					LOG(LOG_SERVER, "accept() failed on shard %d: %s", shard->id, strerror(-res));
+				}
+				if (!(flags & IORING_CQE_F_MORE))
+				{
+					uring_arm_accept(shard);
+				}
+			}
+			else if (user_data == UD_WAKE)
+			{
+				drain_mailbox(shard);
+				if (!(flags & IORING_CQE_F_MORE))
+				{
+					uring_arm_wake(shard);
+				}
+			}
+			else if (user_data != UD_IGNORE)
+			{
+				conn_t* conn = (conn_t*)(uintptr_t)(user_data & ~(uint64_t)UD_TAG_MASK);
+				if ((user_data & UD_TAG_MASK) == UD_RECV)
+				{
+					uring_on_recv(shard, conn, res, flags);
+				}
+				else
+				{
+					uring_on_send(shard, conn, res);
+				}
+			}
+		}
+
+		housekeeping(shard);
+	}
+}
+
+static void epoll_loop(reactor_t* shard)
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	while (1)
+	{
+		const int timeout = shard->accept_pending ? 0 : wheel_timeout(&shard->wheel, shard->now_ms);
+		const int n = epoll_wait(shard->epoll_fd, events, MAX_EVENTS, timeout);
+		refresh_clock(shard);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			LOG(LOG_SERVER, "epoll_wait() failed on shard %d: %s", shard->id, strerror(errno));
+			return;
+		}
+
+		// Accept at most one batch per round, after the ready sockets had their turn
+		int listen_ready = shard->accept_pending;
+		for (int i = 0; i < n; ++i)
+		{
+			void* tag = events[i].data.ptr;
+			if (tag == &listen_tag)
+			{
+				listen_ready = 1;
+			}
+			else if (tag == &wake_tag)
+			{
+				drain_mailbox(shard);
+			}
+			else
+			{
+				conn_t* conn = tag;
+				if (conn->dead)
+				{
+					continue;
+				}
+				if ((events[i].events & EPOLLOUT) && conn->send_busy)
+				{
+					// Room in the send buffer again - push the rest with this round's flush
+					conn->send_busy = 0;
+					if (!conn->queued)
+					{
+						conn->queued = 1;
+						conn->next_flush = shard->flush_head;
+						shard->flush_head = conn;
+					}
+				}
+
+				// Skip stale events for sockets closed or migrated earlier in this batch
+				player_t* player = conn->player;
+				if (
+					(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+					player && player->shard == shard->id && player->watched
+				)
+				{
+					server_on_readable(player);
+				}
+			}
+		}
+
+		if (listen_ready)
+		{
+			accept_pending(shard);
+		}
+
+		housekeeping(shard);
+		flush_output(shard);
+		free_dead(shard);
+	}
+}
+
+static void pin_thread(const reactor_t* shard)
+{
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 0)
+	{
+		return;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(shard->id % cpus, &set);
+	const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0)
+	{
+		LOG(LOG_SERVER, "Failed to pin shard %d to CPU %ld: %s", shard->id, shard->id % cpus, strerror(err));
+	}
+}
+
+static void* shard_loop(void* arg)
+{
+	reactor_t* shard = arg;
+	current_shard = shard->id;
+	refresh_clock(shard);
+	wheel_init(&shard->wheel, shard->now_ms);
+
+	if (pin_to_cpus)
+	{
+		pin_thread(shard);
+	}
+	LOG(LOG_SERVER, "Reactor shard %d running.", shard->id);
+
+	if (backend == IO_URING)
+	{
+		uring_loop(shard);
+	}
+	else
+	{
+		epoll_loop(shard);
+	}
+	return NULL;
+}
+
+int reactor_run()
+{
+	for (int i = 1; i < shard_count; ++i)
+	{
+		const int err = pthread_create(&shards[i].thread, NULL, shard_loop, &shards[i]);
+		if (err != 0)
+		{
+			LOG(LOG_SERVER, "pthread_create() failed for shard %d: %s", i, strerror(err));
+			return -1;
+		}
+		pthread_detach(shards[i].thread);
+	}
+
+	shard_loop(&shards[0]);
+	return -1;
+}
@@ -0,0 +1,62 @@
+/*
+ * rng.c - Dice generator seeding and batches
+ *
+ * PCG32 by M. E. O'Neill (pcg-random.org), the single-stream variant so a
+ * game carries 8 bytes of generator. Seeds for rooms and workers are derived
+ * from a master seed with SplitMix64, so one seed reproduces every game.
+ */
+
+#include "rng.h"
+
+uint64_t rng_mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+void rng_seed(rng_t* rng, const uint64_t seed, const uint64_t stream)
+{
+	rng->state = rng_mix(seed ^ rng_mix(stream));
+	rng_next(rng);
+}
+
+void rng_split(rng_t* rng, rng_t* child, const uint64_t stream)
+{
+	const uint64_t high = rng_next(rng);
+	rng_seed(child, high << 32 | rng_next(rng), stream);
+}
+
+#define ROLLS_PER_DRAW 11
+#define SIX_TO_THE_11 362797056u // 6^11: 2^32 mod 6^11 rejects only 7% of the draws
+
+/*
+ * Brackett-Rozinsky and Lemire, "Batched Ranged Random Integer Generation":
+ * multiplying the draw by 6 over and over, each high word is a roll and the
+ * low word carries on. What is left at the end says, like in rng_below(),
+ * whether the draw has to be rejected to keep all 6^11 outcomes equally likely.
+ */
+void rng_rolls(rng_t* rng, uint8_t* out, const size_t count)
+{
+	size_t n = 0;
+	while (n + ROLLS_PER_DRAW <= count)
+	{
+		uint32_t left = rng_next(rng);
+		for (int i = 0; i < ROLLS_PER_DRAW; ++i)
+		{
+			const uint64_t m = (uint64_t)left * 6;
+			out[n + i] = (uint8_t)((m >> 32) + 1);
+			left = (uint32_t)m;
+		}
+		if (left < SIX_TO_THE_11 && left < (uint32_t)(-SIX_TO_THE_11 % SIX_TO_THE_11))
+		{
+			continue; // rejected, roll these again
+		}
+		n += ROLLS_PER_DRAW;
+	}
+	for (; n < count; ++n)
+	{
+		out[n] = (uint8_t)rng_roll(rng);
+	}
+}
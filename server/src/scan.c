@@ -0,0 +1,139 @@
+/*
+ * scan.c - Newline scanning for command framing
+ *
+ * Every received byte goes through here once, so the scan compares a whole
+ * vector of bytes against '\n' at a time and turns the result into a bit mask
+ * (one bit per byte). The kernel is picked at startup from what the CPU
+ * supports; the scalar fallback (memchr) covers other architectures and the
+ * tail shorter than a vector.
+ */
+
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef size_t (*scan_fn)(const char* data, size_t len, uint32_t* out, size_t max);
+
+static size_t scan_scalar(const char* data, const size_t len, uint32_t* out, const size_t max)
+{
+	size_t count = 0;
+	const char* p = data;
+	const char* const end = data + len;
+	while (count < max && p < end)
+	{
+		const char* newline = memchr(p, '\n', end - p);
+		if (!newline)
+		{
+			break;
+		}
+		out[count++] = (uint32_t)(newline - data);
+		p = newline + 1;
+	}
+	return count;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Stores the offsets of the set bits of a comparison mask. Returns 0 once out
+ * is full.
+ */
+static inline int emit_mask(unsigned mask, const size_t base, uint32_t* out, size_t* count, const size_t max)
+{
+	while (mask)
+	{
+		if (*count == max)
+		{
+			return 0;
+		}
+		out[(*count)++] = (uint32_t)(base + __builtin_ctz(mask));
+		mask &= mask - 1;
+	}
+	return 1;
+}
+
+/*
+ * Finishes a vector scan: the tail after offset i goes through the scalar kernel.
+ */
+static size_t scan_tail(const char* data, const size_t len, size_t i, uint32_t* out, size_t count, const size_t max)
+{
+	const size_t found = scan_scalar(data + i, len - i, out + count, max - count);
+	for (size_t k = count; k < count + found; ++k)
+	{
+		out[k] += (uint32_t)i;
+	}
+	return count + found;
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char* data, const size_t len, uint32_t* out, const size_t max)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		const __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+		const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		if (!emit_mask(mask, i, out, &count, max))
+		{
+			return count;
+		}
+	}
+	return scan_tail(data, len, i, out, count, max);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char* data, const size_t len, uint32_t* out, const size_t max)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		const __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+		const unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		if (!emit_mask(mask, i, out, &count, max))
+		{
+			return count;
+		}
+	}
+	return scan_tail(data, len, i, out, count, max);
+}
+
+#endif // SCAN_X86
+
+static scan_fn kernel = scan_scalar;
+static const char* kernel_name = "scalar";
+
+void scan_init(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernel = scan_avx2;
+		kernel_name = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		kernel = scan_sse2;
+		kernel_name = "sse2";
+	}
+#endif
+}
+
+const char* scan_kernel_name(void)
+{
+	return kernel_name;
+}
+
+size_t scan_newlines(const char* data, const size_t len, uint32_t* out, const size_t max)
+{
+	return kernel(data, len, out, max);
+}
@@ -5,6 +5,7 @@
 #include "config.h"
 #include "parser.h"
 #include "logger.h"
+#include "reactor.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,513 +14,407 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <time.h>
 #include <errno.h>
 
 // Forward declarations for helper functions
-static void handle_game_input(room_t* room, game_state* game, int player_idx);
-static void reset_room_after_game(room_t* room);
-static player_t* handle_login_and_reconnect(player_t* player);
-static void handle_lobby_command(player_t* player, const parsed_command_t* cmd);
-static void handle_main_loop(player_t* player);
+static void handle_game_input(room_t* room, const parsed_command_t* cmd, int sending_player_idx);
+static void handle_paused_input(room_t* room, const parsed_command_t* cmd, int sending_player_idx);
+static void finish_game(room_t* room);
+static void pause_game(room_t* room, int idle_player_idx);
+static void end_pause(const room_t* room);
+static void handle_reconnect_timeout(room_t* room);
+static player_t* handle_login(player_t* player, const parsed_command_t* cmd, int parsed, const char* line);
+static player_t* handle_resume(player_t* player, const parsed_command_t* cmd, int parsed);
+static void handle_lobby_command(player_t* player, const parsed_command_t* cmd, const char* line);
+static player_t* handle_client_command(player_t* player, char* buffer, size_t len, wire_protocol_t proto);
+
+// Per room ID, armed while the room's game is PAUSED
+static deadline_t* reconnect_deadlines = NULL;
 
+/*
+ * Returns the room of a player whose game is running (IN_PROGRESS or PAUSED), otherwise NULL.
+ */
+static room_t* get_running_room(const player_t* player)
+{
+	room_t* room = get_room(player->room_id);
+	return (player->state == IN_GAME && room && room->state != WAITING) ? room : NULL;
+}
 
-static void handle_game_input(room_t* room, game_state* game, const int sending_player_idx)
+/*
+ * (Re)arms the idle timeout of a connected player, counted from the last time we heard from them.
+ */
+static void watch_idle(const player_t* player)
 {
-	const int other_player_idx = 1 - sending_player_idx;
-	player_t* sending_player = room->players[sending_player_idx];
-	const player_t* other_player = room->players[other_player_idx];
+	const time_t due = player->last_activity + IDLE_TIMEOUT + 1;
+	const time_t now = time(NULL);
+	reactor_arm_idle(player, due > now ? (int)(due - now) * 1000 : 0);
+}
 
-	char command_buffer[MSG_MAX_LEN];
-	const ssize_t recv_result = receive_command(sending_player, command_buffer, sizeof(command_buffer));
+/*
+ * Name of a parsed command for the logs.
+ */
+static const char* command_label(const parsed_command_t* cmd)
+{
+	const char* name = command_name(cmd->type);
+	return name ? name : "unknown";
+}
 
-	if (recv_result == -3)
-	{
-		// Socket timeout - not a disconnect, just no data yet
-		return;
-	}
+/*
+ * Marks an in-game player as disconnected (their slot stays for reconnect) and closes the socket.
+ */
+static void disconnect_in_game(room_t* room, const int player_idx)
+{
+	player_t* player = room->players[player_idx];
+	const int dead_socket = player->socket;
+	reactor_unwatch(player);
+	handle_player_disconnect(player);
+	reactor_close(dead_socket);
+}
 
-	if (recv_result > 0)
+/*
+ * Logs what a move did, in the words of the game log.
+ */
+static void log_move(const room_t* room, const pig_events_t* events)
+{
+	for (int i = 0; i < events->count; ++i)
 	{
-		LOG(LOG_GAME, "Received from player %s: %s", sending_player->nickname, command_buffer);
-		parsed_command_t cmd;
-		if (parse_command(command_buffer, &cmd) != 0)
+		const pig_event_t* event = &events->events[i];
+		switch (event->type)
 		{
-			LOG(LOG_GAME, "Malformed command from player %s. Ignoring.", sending_player->nickname);
-			// Malformed command from a client. In-game, we'll ignore it
-			// rather than disconnecting the player, which would end the game
-			// for the opponent.
-			return;
+			case PIG_ROLLED:
+				LOG(LOG_GAME, "Player %d rolled a %d.", event->player, event->value);
+				break;
+			case PIG_HELD:
+				LOG(
+					LOG_GAME, "Player %d holds. Score for turn: %d. New total: %d.",
+					event->player, event->value, games.scores[event->player][room->id]
+				);
+				break;
+			case PIG_TURN:
+				LOG(LOG_GAME, "Switching turn to player %d.", event->player);
+				break;
+			case PIG_WON:
+				LOG(LOG_GAME, "Player %s wins the game in room %d.", room->players[event->player]->nickname, room->id);
+				break;
+			default:
+				break;
 		}
+	}
+}
+
+/*
+ * One command from a player in a running (not paused) game.
+ */
+static void handle_game_input(room_t* room, const parsed_command_t* cmd, const int sending_player_idx)
+{
+	const int game = room->id;
+	const player_t* sending_player = room->players[sending_player_idx];
+	pig_action action;
 
+	switch (cmd->type)
+	{
 		// Late attempt at leaving the waiting room
-		if (cmd.type == CMD_LEAVE_ROOM)
-		{
+		case CMD_LEAVE_ROOM:
 			LOG(
-				LOG_GAME, "Player %s attempted to leave the waiting room, while game was established",
+				LOG_GAME, "Player %s attempted to leave the waiting room in room %d, while game was established",
 				sending_player->nickname, room->id
 			);
 			send_error(sending_player->socket, C_LEAVE_ROOM, E_GAME_IN_PROGRESS);
-		}
-		// Handle QUIT from any player at any time
-		else if (cmd.type == CMD_QUIT)
-		{
-			LOG(LOG_GAME, "Player %s quit game in room %d.", sending_player->nickname, room->id);
-			send_structured_message(sending_player->socket, S_OK, 1, K_CMD, C_QUIT);
-			game->game_over = 1;
-			game->game_winner = other_player_idx;
-		}
-		// Handle GAME_STATE_REQUEST from any player at any time (non-turn-changing)
-		else if (cmd.type == CMD_GAME_STATE_REQUEST)
-		{
-			send_game_state(sending_player, room, game);
 			return;
-		}
-		// Handle PING from any player at any time (non-turn-changing)
-		else if (cmd.type == CMD_PING)
-		{
+		// Non-turn-changing, from any player at any time
+		case CMD_GAME_STATE_REQUEST:
+			send_game_state(sending_player, room);
+			return;
+		case CMD_PING:
 			send_structured_message(sending_player->socket, S_OK, 1, K_CMD, C_PING);
 			return;
-		}
-		// Other commands are only valid if it's the sender's turn
-		else if (sending_player_idx == game->current_player)
-		{
-			if (cmd.type == CMD_ROLL)
-			{
-				handle_roll(game);
-			}
-			else if (cmd.type == CMD_HOLD)
-			{
-				handle_hold(game);
-			}
-			else
-			{
-				LOG(
-					LOG_GAME, "Player %s sent invalid command: %s",
-					sending_player->nickname, command_buffer
-				);
-				send_error(sending_player->socket, NULL, E_INVALID_COMMAND);
-				return;
-			}
-		}
-		else
-		{
-			// It's not this player's turn.
-			LOG(
-				LOG_GAME, "Player %s sent command when it wasn't their turn.",
-				sending_player->nickname
-			);
+		// Moves, the engine decides whether they are allowed
+		case CMD_QUIT:
+			LOG(LOG_GAME, "Player %s quit game in room %d.", sending_player->nickname, room->id);
+			send_structured_message(sending_player->socket, S_OK, 1, K_CMD, C_QUIT);
+			action = PIG_QUIT;
+			break;
+		case CMD_ROLL:
+			action = PIG_ROLL;
+			break;
+		case CMD_HOLD:
+			action = PIG_HOLD;
+			break;
+		default:
+			LOG(LOG_GAME, "Player %s sent invalid command: %s", sending_player->nickname, command_label(cmd));
 			send_error(sending_player->socket, NULL, E_INVALID_COMMAND);
 			return;
-		}
-
-		if (!game->game_over)
-		{
-			// Game continues, just broadcast state
-			broadcast_game_state(room, game);
-		}
-		else
-		{
-			// game is over, broadcast final state, then broadcast winner/loser
-			broadcast_game_state(room, game);
-			broadcast_game_over(room, game);
-		}
 	}
-	else
-	{
-		LOG(
-			LOG_GAME, "Player %s disconnected from game in room %d.", sending_player->nickname, room->id
-		);
-		// treating this as disconnect
-		if (other_player->socket != -1)
-		{
-			// Notify the other player about the disconnection
-			send_structured_message(other_player->socket, S_OPPONENT_DISCONNECTED, 0);
-		}
 
-		// Use the new thread-safe function to handle the disconnect
-		handle_player_disconnect(sending_player);
-		game->player_fds[sending_player_idx] = -1;
+	pig_events_t events;
+	play_move(game, sending_player_idx, action, &events);
+	if (events.events[0].type == PIG_REJECTED)
+	{
+		// It's not this player's turn.
+		LOG(LOG_GAME, "Player %s sent command when it wasn't their turn.", sending_player->nickname);
+		send_error(sending_player->socket, NULL, E_INVALID_COMMAND);
+		return;
+	}
+	log_move(room, &events);
 
-		// Lock the room mutex to update its state
-		pthread_mutex_lock(&room->mutex);
-		room->state = PAUSED;
-		broadcast_room_update(room);
-		pthread_mutex_unlock(&room->mutex);
+	// Game continues (or just ended), broadcast state either way
+	broadcast_game_state(room);
+	if (games.status[game] == GAME_OVER)
+	{
+		// then broadcast winner/loser
+		broadcast_game_over(room);
+		finish_game(room);
 	}
 }
 
-static void reset_room_after_game(room_t* room)
+/*
+ * One command from a player while the game is paused.
+ *
+ * Real disconnect: the missing player comes back through LOGIN/RESUME, we just keep
+ * the remaining player alive by answering their PINGs.
+ * Idle timeout: anything from the idle player resumes the game.
+ */
+static void handle_paused_input(room_t* room, const parsed_command_t* cmd, const int sending_player_idx)
 {
-	LOG(LOG_GAME, "Game in room %d finished. Returning players to lobby.", room->id);
-	pthread_mutex_lock(&room->mutex);
-	// After the game loop ends, send players back to the lobby
+	player_t* sending_player = room->players[sending_player_idx];
 
-	for (int i = 0; i < MAX_PLAYERS_PER_ROOM; ++i)
+	if (cmd->type == CMD_PING)
 	{
-		if (room->players[i])
+		send_structured_message(sending_player->socket, S_OK, 1, K_CMD, C_PING);
+	}
+
+	int has_disconnected_player = 0;
+	for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
+	{
+		if (room->players[i] && room->players[i]->socket == -1)
 		{
-			// Reset state for all players who were in the game, connected or not.
-			room->players[i]->state = LOBBY;
-			room->players[i]->room_id = -1;
+			has_disconnected_player = 1;
 		}
 	}
-	room->state = WAITING;
-	room->player_count = 0;
-	room->players[0] = NULL;
-	room->players[1] = NULL;
-	broadcast_room_update(room);
 
-	// Wake up the client_handler_threads that are waiting for the game to end.
-	pthread_cond_broadcast(&room->cond);
+	// Ignore other commands while waiting for reconnection
+	if (has_disconnected_player || sending_player_idx != room->idle_player_idx)
+	{
+		return;
+	}
+
+	LOG(LOG_GAME, "Player %s is back, resuming game.", sending_player->nickname);
+	const int other_idx = 1 - sending_player_idx;
+	if (room->players[other_idx] && room->players[other_idx]->socket != -1)
+	{
+		send_structured_message(room->players[other_idx]->socket, S_OPPONENT_RECONNECTED, 0);
+	}
+	pthread_mutex_lock(&room->mutex);
+	room->state = IN_PROGRESS;
+	room->idle_player_idx = -1;
 	pthread_mutex_unlock(&room->mutex);
+	broadcast_room_update(room);
+	end_pause(room);
 }
 
 /*
- * Main game loop - runs in its own thread, one per active game.
- *
- * Handles: player turns, disconnect/reconnect, idle timeouts.
- *
- * The tricky part is pausing: when a player disconnects or goes idle,
- * we pause the game and wait for them to come back (up to RECONNECT_TIMEOUT).
- * Meanwhile we still need to handle PINGs from the other player so they
- * don't get kicked for inactivity.
+ * Dispatches a command from a player whose game is running.
  */
-void* game_thread_func(void* arg)
+static void handle_game_command(room_t* room, player_t* player, const parsed_command_t* cmd, const int parsed)
 {
-	room_t* room = (room_t*)arg;
-	game_state game;
-
-	LOG(LOG_GAME, "Game thread started for room %d", room->id);
-
-	// Seed the random number generator for this game thread
-	game.rand_seed = time(NULL) ^ (intptr_t)room;
-
-	init_game(&game, room->players[0]->socket, room->players[1]->socket);
-	broadcast_game_start(room, game.current_player);
+	const int player_idx = room->players[0] == player ? 0 : 1;
 
-	while (!game.game_over)
+	if (parsed != 0)
 	{
-		pthread_mutex_lock(&room->mutex);
+		LOG(LOG_GAME, "Malformed command from player %s. Ignoring.", player->nickname);
+		// Malformed command from a client. In-game, we'll ignore it
+		// rather than disconnecting the player, which would end the game
+		// for the opponent.
+		return;
+	}
 
-		// --- PAUSE HANDLING ---
-		// Two reasons we pause: real disconnect (socket == -1) or idle timeout.
-		// For disconnect: client_handler will set room->state = IN_PROGRESS when player RESUMEs.
-		// For idle: we resume as soon as the idle player sends any message.
-		if (room->state == PAUSED)
-		{
-			LOG(LOG_GAME, "Game in room %d is paused, waiting for player to resume.", room->id);
-			const time_t pause_start = time(NULL);
-
-			// Check if this is an actual disconnect (socket == -1) or idle timeout (socket still valid)
-			// For actual disconnect: wait for LOGIN/RESUME flow to set room->state = IN_PROGRESS
-			// For idle timeout: process messages and resume when idle player sends something
-			int has_disconnected_player = 0;
-			int idle_player_idx = -1;
-			for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-			{
-				if (room->players[i])
-				{
-					if (room->players[i]->socket == -1)
-					{
-						has_disconnected_player = 1;
-					}
-					else if (time(NULL) - room->players[i]->last_activity > IDLE_TIMEOUT)
-					{
-						idle_player_idx = i;
-					}
-				}
-			}
+	if (room->state == PAUSED)
+	{
+		handle_paused_input(room, cmd, player_idx);
+	}
+	else
+	{
+		handle_game_input(room, cmd, player_idx);
+	}
+}
 
-			time_t last_debug_log = 0;
-			while (room->state == PAUSED)
-			{
-				const time_t debug_now = time(NULL);
-				if (debug_now - last_debug_log >= 2)
-				{
-					LOG(LOG_GAME, "DEBUG: Room %d PAUSED loop. has_disconnected_player=%d. Players[0]: %s (sock: %d), Players[1]: %s (sock: %d)",
-						room->id, has_disconnected_player,
-						room->players[0] ? room->players[0]->nickname : "NULL",
-						room->players[0] ? room->players[0]->socket : -1,
-						room->players[1] ? room->players[1]->nickname : "NULL",
-						room->players[1] ? room->players[1]->socket : -1);
-					last_debug_log = debug_now;
-				}
+/*
+ * The socket of a player in a running game hung up.
+ */
+static void handle_game_disconnect(room_t* room, player_t* player)
+{
+	const int player_idx = room->players[0] == player ? 0 : 1;
+	const player_t* other_player = room->players[1 - player_idx];
 
-				pthread_mutex_unlock(&room->mutex);
+	if (room->state == PAUSED)
+	{
+		// This player also disconnected (not just timeout), keep waiting for reconnects
+		LOG(LOG_GAME, "Player %s also disconnected.", player->nickname);
+		disconnect_in_game(room, player_idx);
+		return;
+	}
 
-				// Check if total reconnect timeout has expired
-				if (time(NULL) - pause_start >= RECONNECT_TIMEOUT)
-				{
-					LOG(LOG_GAME, "Reconnect timeout in room %d. Game over.", room->id);
-					pthread_mutex_lock(&room->mutex);
-					game.game_over = 1;
+	LOG(LOG_GAME, "Player %s disconnected from game in room %d.", player->nickname, room->id);
+	if (other_player && other_player->socket != -1)
+	{
+		// Notify the other player about the disconnection
+		send_structured_message(other_player->socket, S_OPPONENT_DISCONNECTED, 0);
+	}
 
-					// Determine the winner: the player who stayed active (not the idle/disconnected one)
-					int winner_idx = -1;
-					if (has_disconnected_player)
-					{
-						// Actual disconnect: winner is the one with valid socket
-						for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-						{
-							if (room->players[i] && room->players[i]->socket != -1)
-							{
-								winner_idx = i;
-								break;
-							}
-						}
-					}
-					else if (idle_player_idx != -1)
-					{
-						// Idle timeout: winner is the OTHER player (not the idle one)
-						winner_idx = 1 - idle_player_idx;
-					}
+	disconnect_in_game(room, player_idx);
+	pause_game(room, -1);
+}
 
-					if (winner_idx != -1)
-					{
-						game.game_over = 1;
-						game.game_winner = winner_idx;
-						const int loser_idx = 1 - winner_idx;
-
-						// Send GAME_WIN to winner
-						if (room->players[winner_idx] && room->players[winner_idx]->socket != -1)
-						{
-							send_structured_message(
-								room->players[winner_idx]->socket, S_GAME_WIN, 1,
-								K_MSG, "Your opponent timed out."
-							);
-						}
-
-						// Send DISCONNECTED to loser (if still connected)
-						if (room->players[loser_idx] && room->players[loser_idx]->socket != -1)
-						{
-							// Send to the idle player
-							send_structured_message(room->players[loser_idx]->socket, S_DISCONNECTED, 0);
-
-							// Use helper to disconnect socket
-							handle_player_disconnect(room->players[loser_idx]);
-							game.player_fds[loser_idx] = -1;
-
-							send_structured_message(
-								room->players[loser_idx]->socket, S_GAME_LOSE, 1,
-								K_MSG, "You timed out."
-							);
-						}
-					}
-					break;
-				}
+static void on_reconnect_timeout(void* arg)
+{
+	room_t* room = arg;
+	if (room->state == PAUSED)
+	{
+		handle_reconnect_timeout(room);
+	}
+}
 
-				if (has_disconnected_player)
-				{
-					// Real disconnect: the player's client_handler will handle reconnection.
-					// We just keep the remaining player alive by responding to their PINGs.
-					for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-					{
-						if (room->players[i] && room->players[i]->socket != -1 && game.player_fds[i] != -1)
-						{
-							fd_set read_fds;
-							struct timeval tv = {1, 0};
-							FD_ZERO(&read_fds);
-							FD_SET(room->players[i]->socket, &read_fds);
-
-							if (select(room->players[i]->socket + 1, &read_fds, NULL, NULL, &tv) > 0)
-							{
-								char buffer[MSG_MAX_LEN];
-								const ssize_t recv_result = receive_command(room->players[i], buffer, sizeof(buffer));
-								if (recv_result > 0)
-								{
-									parsed_command_t cmd;
-									if (parse_command(buffer, &cmd) == 0 && cmd.type == CMD_PING)
-									{
-										send_structured_message(room->players[i]->socket, S_OK, 1, K_CMD, C_PING);
-									}
-									// Ignore other commands, wait for reconnection
-								}
-								else if (recv_result != -3)
-								{
-									// This player also disconnected (not just timeout)
-									LOG(LOG_GAME, "Player %s also disconnected.", room->players[i]->nickname);
-									handle_player_disconnect(room->players[i]);
-									game.player_fds[i] = -1;
-								}
-							}
-						}
-					}
-					usleep(100000); // 100ms to avoid busy loop
-				}
-				else
-				{
-					// Idle timeout case: process messages from all players
-					for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-					{
-						if (room->players[i] && room->players[i]->socket != -1)
-						{
-							fd_set read_fds;
-							struct timeval tv = {1, 0};
-							FD_ZERO(&read_fds);
-							FD_SET(room->players[i]->socket, &read_fds);
-
-							if (select(room->players[i]->socket + 1, &read_fds, NULL, NULL, &tv) > 0)
-							{
-								char buffer[MSG_MAX_LEN];
-								const ssize_t recv_result = receive_command(room->players[i], buffer, sizeof(buffer));
-								if (recv_result > 0)
-								{
-									parsed_command_t cmd;
-									if (parse_command(buffer, &cmd) == 0)
-									{
-										if (cmd.type == CMD_PING)
-										{
-											send_structured_message(room->players[i]->socket, S_OK, 1, K_CMD, C_PING);
-										}
-
-										// If the idle player sent a message, resume game
-										if (i == idle_player_idx)
-										{
-											LOG(LOG_GAME, "Player %s is back, resuming game.", room->players[i]->nickname);
-											const int other_idx = 1 - i;
-											if (room->players[other_idx] && room->players[other_idx]->socket != -1)
-											{
-												send_structured_message(room->players[other_idx]->socket, S_OPPONENT_RECONNECTED, 0);
-											}
-											pthread_mutex_lock(&room->mutex);
-											room->state = IN_PROGRESS;
-											broadcast_room_update(room);
-											pthread_mutex_unlock(&room->mutex);
-										}
-									}
-								}
-								else if (recv_result != -3)
-								{
-									// Player disconnected (not just timeout)
-									LOG(LOG_GAME, "Player %s disconnected.", room->players[i]->nickname);
-									handle_player_disconnect(room->players[i]);
-									game.player_fds[i] = -1;
-									has_disconnected_player = 1;
-								}
-							}
-						}
-					}
-				}
+/*
+ * Gives the players of a paused game RECONNECT_TIMEOUT (again) to come back.
+ */
+static void start_reconnect_window(room_t* room)
+{
+	reactor_arm(&reconnect_deadlines[room->id], RECONNECT_TIMEOUT * 1000, on_reconnect_timeout, room);
+}
 
-				pthread_mutex_lock(&room->mutex);
-			}
-		}
-		pthread_mutex_unlock(&room->mutex);
+static void pause_game(room_t* room, const int idle_player_idx)
+{
+	pthread_mutex_lock(&room->mutex);
+	room->state = PAUSED;
+	room->idle_player_idx = idle_player_idx;
+	pthread_mutex_unlock(&room->mutex);
+	start_reconnect_window(room);
+	broadcast_room_update(room);
+	LOG(LOG_GAME, "Game in room %d is paused, waiting for player to resume.", room->id);
+}
 
-		// After a potential pause, player sockets might have changed (reconnect).
-		// Update the game's file descriptors from the room's player data.
-		for (int i = 0; i < MAX_PLAYERS_PER_ROOM; ++i)
+/*
+ * The paused game runs again (or is over): the reconnect window closes and the idle
+ * timeouts, which do not run while paused, count again for whoever is connected.
+ */
+static void end_pause(const room_t* room)
+{
+	reactor_disarm(&reconnect_deadlines[room->id]);
+	for (int i = 0; i < MAX_PLAYERS_PER_ROOM; ++i)
+	{
+		if (room->players[i] && room->players[i]->socket != -1)
 		{
-			if (room->players[i] && game.player_fds[i] != room->players[i]->socket)
-			{
-				send_game_state(room->players[i], room, &game);
-				game.player_fds[i] = room->players[i]->socket;
-			}
+			watch_idle(room->players[i]);
 		}
+	}
+}
+
+/*
+ * The paused game ran out of RECONNECT_TIMEOUT. The player who stayed
+ * active wins, the idle/disconnected one loses.
+ */
+static void handle_reconnect_timeout(room_t* room)
+{
+	LOG(LOG_GAME, "Reconnect timeout in room %d. Game over.", room->id);
 
-		// If the room state was changed to ABORTED (e.g., by a player leaving), end the game
-		if (room->state == ABORTED)
+	// Determine the winner: the player who stayed active (not the idle/disconnected one)
+	int has_disconnected_player = 0;
+	int winner_idx = -1;
+	for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
+	{
+		if (room->players[i] && room->players[i]->socket == -1)
 		{
-			LOG(LOG_GAME, "Game in room %d was aborted.", room->id);
-			game.game_over = 1;
+			has_disconnected_player = 1;
 		}
-
-		// If the game is over for any reason, break out of the main loop
-		if (game.game_over)
+		else if (room->players[i] && winner_idx == -1)
 		{
-			break; // Exit the main game loop
+			winner_idx = i;
 		}
+	}
+	if (!has_disconnected_player)
+	{
+		// Idle timeout: winner is the OTHER player (not the idle one)
+		winner_idx = room->idle_player_idx != -1 ? 1 - room->idle_player_idx : -1;
+	}
 
-		fd_set read_fds;
-		int max_fd = -1;
+	end_game(room->id, winner_idx);
+	if (winner_idx != -1)
+	{
+		const int loser_idx = 1 - winner_idx;
 
-		FD_ZERO(&read_fds);
-		for (int i = 0; i < MAX_PLAYERS_PER_ROOM; ++i)
+		// Send GAME_WIN to winner
+		if (room->players[winner_idx] && room->players[winner_idx]->socket != -1)
 		{
-			if (game.player_fds[i] != -1)
-			{
-				FD_SET(game.player_fds[i], &read_fds);
-				if (game.player_fds[i] > max_fd)
-				{
-					max_fd = game.player_fds[i];
-				}
-			}
+			send_structured_message(
+				room->players[winner_idx]->socket, S_GAME_WIN, 1,
+				K_MSG, "Your opponent timed out."
+			);
 		}
 
-		if (max_fd == -1)
+		// Send DISCONNECTED to loser (if still connected) and drop them
+		if (room->players[loser_idx] && room->players[loser_idx]->socket != -1)
 		{
-			// Both players disconnected, game will be paused and eventually timeout.
-			continue;
+			send_structured_message(room->players[loser_idx]->socket, S_DISCONNECTED, 0);
+			disconnect_in_game(room, loser_idx);
 		}
+	}
 
-		// Set a short timeout for select() to make the loop non-blocking
-		struct timeval tv = {1, 0};
+	finish_game(room);
+}
 
-		// Wait for activity on any of the player sockets
-		const int activity = select(max_fd + 1, &read_fds, NULL, NULL, &tv);
+/*
+ * The room just filled up - deal the first turn and let both players know.
+ * From here on the room is driven by its players' socket events and their idle deadlines.
+ */
+static void start_game(room_t* room)
+{
+	// The dice of game n in room r only depend on DICE_SEED, r and n: the same seed replays every game
+	const unsigned game_number = room->games++;
+	LOG(LOG_GAME, "Game started for room %d (game %u).", room->id, game_number);
+	rng_seed(&games.rng[room->id], DICE_SEED, (uint64_t)room->id << 32 | game_number);
+	room->idle_player_idx = -1;
+
+	init_game(room->id);
+	broadcast_game_start(room, games.current_player[room->id]);
+}
 
-		if ((activity < 0) && (errno != EINTR))
-		{
-			LOG(LOG_GAME, "Select error: %s", strerror(errno));
-		}
+/*
+ * Sends both players back to the lobby once the game is over (or aborted).
+ */
+static void finish_game(room_t* room)
+{
+	LOG(LOG_GAME, "Game in room %d finished. Returning players to lobby.", room->id);
+	end_pause(room);
+	pthread_mutex_lock(&room->mutex);
 
-		if (activity > 0)
-		{
-			for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-			{
-				if (FD_ISSET(game.player_fds[i], &read_fds))
-				{
-					handle_game_input(room, &game, i);
-					if (game.game_over) break;
-				}
-			}
-		}
-		else if (activity == 0)
+	for (int i = 0; i < MAX_PLAYERS_PER_ROOM; ++i)
+	{
+		if (room->players[i])
 		{
-			// Select timed out - check for idle players
-			const time_t now = time(NULL);
-			for (int i = 0; i < MAX_PLAYERS_PER_ROOM; i++)
-			{
-				if (room->players[i] && room->players[i]->socket != -1)
-				{
-					if (now - room->players[i]->last_activity > IDLE_TIMEOUT)
-					{
-						LOG(LOG_GAME, "Player %s timed out in game (idle %ld seconds).",
-							room->players[i]->nickname, now - room->players[i]->last_activity);
-
-						// Notify the other player about the disconnection
-						const int other_idx = 1 - i;
-						if (room->players[other_idx] && room->players[other_idx]->socket != -1)
-						{
-							send_structured_message(room->players[other_idx]->socket, S_OPPONENT_DISCONNECTED, 0);
-						}
-
-						// Keep socket open - player can resume by sending any message
-						// Just pause the game
-						pthread_mutex_lock(&room->mutex);
-						room->state = PAUSED;
-						broadcast_room_update(room);
-						pthread_mutex_unlock(&room->mutex);
-						break;
-					}
-				}
-			}
+			// Reset state for all players who were in the game, connected or not.
+			return_player_to_lobby(room->players[i]);
 		}
 	}
-
-	reset_room_after_game(room);
-	// Exit the thread
-	pthread_exit(NULL);
+	room->state = WAITING;
+	room->player_count = 0;
+	room->players[0] = NULL;
+	room->players[1] = NULL;
+	room->shard = -1;
+	clear_game(room->id);
+	pthread_mutex_unlock(&room->mutex);
+	broadcast_room_update(room);
 }
 
-void broadcast_game_over(const room_t* room, const game_state* game)
+void broadcast_game_over(const room_t* room)
 {
-	if (game->game_winner > -1)
+	const int winner_idx = games.winner[room->id];
+	if (winner_idx > -1)
 	{
-		const player_t* winner = room->players[game->game_winner];
-		const player_t* looser = room->players[1 - game->game_winner];
+		const player_t* winner = room->players[winner_idx];
+		const player_t* looser = room->players[1 - winner_idx];
 
 		send_structured_message(winner->socket, S_GAME_WIN, 0);
 		if (looser->socket != -1)
@@ -553,138 +448,138 @@ void broadcast_game_start(const room_t* room, const int first_to_act)
 	);
 }
 
-void send_game_state(const player_t* player, const room_t* room, const game_state* game)
+/*
+ * Builds the GAME_STATE message from the point of view of one of the players.
+ */
+static void build_game_state(message_t* msg, const int game, const int player_index)
 {
-	const int player_index = room->players[0] == player ? 0 : 1;
+	msg_begin(msg, S_GAME_STATE);
+	msg_add_int(msg, MSG_FIELD(MY_SCORE), games.scores[player_index][game]);
+	msg_add_int(msg, MSG_FIELD(OPP_SCORE), games.scores[1 - player_index][game]);
+	msg_add_int(msg, MSG_FIELD(TURN_SCORE), games.turn_score[game]);
+	msg_add_int(msg, MSG_FIELD(ROLL), games.roll[game]);
+	msg_add_int(msg, MSG_FIELD(YOUR_TURN), player_index == games.current_player[game]);
+}
 
-	char my_score[10], opp_score[10], turn_score[10], roll_result[10];
-	sprintf(my_score, "%d", game->scores[player_index]);
-	sprintf(opp_score, "%d", game->scores[1 - player_index]);
-	sprintf(turn_score, "%d", game->turn_score);
-	sprintf(roll_result, "%d", game->roll_result);
+void send_game_state(const player_t* player, const room_t* room)
+{
+	const int player_index = room->players[0] == player ? 0 : 1;
 
-	send_structured_message(
-		player->socket, S_GAME_STATE, 5,
-		K_MY_SCORE, my_score,
-		K_OPP_SCORE, opp_score,
-		K_TURN_SCORE, turn_score,
-		K_ROLL, roll_result,
-		K_YOUR_TURN, player_index == game->current_player ? "1" : "0"
-	);
+	message_t msg;
+	build_game_state(&msg, room->id, player_index);
+	msg_send(player->socket, &msg);
 }
 
-void broadcast_game_state(const room_t* room, const game_state* game)
+void broadcast_game_state(const room_t* room)
 {
-	const player_t* curr = room->players[game->current_player];
-	const player_t* next = room->players[1 - game->current_player];
-
-	char curr_score[10], next_score[10], turn_score[10], roll_result[10];
-	sprintf(curr_score, "%d", game->scores[game->current_player]);
-	sprintf(next_score, "%d", game->scores[1 - game->current_player]);
-	sprintf(turn_score, "%d", game->turn_score);
-	sprintf(roll_result, "%d", game->roll_result);
+	const int game = room->id;
+	const int curr = games.current_player[game];
+	message_t msg;
 
-	send_structured_message(
-		curr->socket, S_GAME_STATE, 5,
-		K_MY_SCORE, curr_score,
-		K_OPP_SCORE, next_score,
-		K_TURN_SCORE, turn_score,
-		K_ROLL, roll_result,
-		K_YOUR_TURN, "1"
-	);
+	build_game_state(&msg, game, curr);
+	msg_send(room->players[curr]->socket, &msg);
 
-	send_structured_message(
-		next->socket, S_GAME_STATE, 5,
-		K_MY_SCORE, next_score,
-		K_OPP_SCORE, curr_score,
-		K_TURN_SCORE, turn_score,
-		K_ROLL, roll_result,
-		K_YOUR_TURN, "0"
-	);
+	build_game_state(&msg, game, 1 - curr);
+	msg_send(room->players[1 - curr]->socket, &msg);
 }
 
 /*
- * Per-client thread - handles one player's connection from login to disconnect.
- *
- * Flow: LOGIN -> lobby commands -> join room -> wait for game -> back to lobby
- *
- * Note: when a player reconnects, their NEW connection takes over this thread's
- * player object, and this thread quietly exits (see socket != client_socket checks).
+ * Closes a reactor-owned connection and frees its player slot.
  */
-void* client_handler_thread(void* arg)
+static void close_client(player_t* player)
 {
-	player_t* player = (player_t*)arg;
 	const int client_socket = player->socket;
-	LOG(LOG_SERVER, "New client handler thread started for socket %d.", client_socket);
-
-	player = handle_login_and_reconnect(player);
+	reactor_unwatch(player);
+	remove_player(player);
+	reactor_close(client_socket);
+}
 
-	if (player)
+/*
+ * Cleans up after a connection that went away (or timed out), depending on
+ * how far it got: a half-finished reconnect aborts the paused game, a player
+ * in a running game keeps their slot for reconnect, a player in a waiting
+ * room leaves it first.
+ */
+static void drop_client(player_t* player)
+{
+	room_t* room = get_room(player->room_id);
+	if (player->session == SESSION_RESUME && room)
+	{
+		LOG(LOG_GAME, "Game in room %d was aborted.", room->id);
+		pthread_mutex_lock(&room->mutex);
+		room->state = ABORTED;
+		pthread_mutex_unlock(&room->mutex);
+		finish_game(room);
+	}
+	else if (player->session == SESSION_ACTIVE && player->state == IN_GAME && room)
 	{
-		handle_main_loop(player);
+		if (room->state != WAITING)
+		{
+			handle_game_disconnect(room, player);
+			return;
+		}
+		leave_room(player);
 	}
+	close_client(player);
+}
 
-	LOG(LOG_SERVER, "Client handler thread for socket %d is exiting.", client_socket);
-	// Thread exit is handled within the helpers on error, or here on normal completion.
-	pthread_exit(NULL);
+static void handle_connection_lost(player_t* player)
+{
+	switch (player->session)
+	{
+		case SESSION_LOGIN:
+			LOG(LOG_LOBBY, "Client on socket %d disconnected before login.", player->socket);
+			break;
+		case SESSION_RESUME:
+			LOG(LOG_LOBBY, "Player %s disconnected before resuming.", player->nickname);
+			break;
+		case SESSION_ACTIVE:
+			if (!get_running_room(player))
+			{
+				LOG(
+					LOG_LOBBY, "Player %s disconnected from %s.", player->nickname,
+					player->state == IN_GAME ? "waiting room" : "lobby"
+				);
+			}
+			break;
+	}
+	drop_client(player);
 }
 
 /*
- * Handles the LOGIN flow and reconnection logic.
+ * Handles the LOGIN command and reconnection logic.
  *
- * Returns the player object to use (might be different from input if reconnecting),
- * or NULL if login failed and connection was closed.
+ * Returns the player object that owns the socket from now on (might be different
+ * from input if reconnecting), or NULL if login failed and connection was closed.
  *
  * Reconnect flow: if we find a disconnected player with the same nickname who's
- * still in a game, we "adopt" their player slot and resume the paused game.
+ * still in a game, we "adopt" their player slot and wait for RESUME. That happens
+ * on the shard hosting the paused game, so the connection may have to move there first.
  */
-static player_t* handle_login_and_reconnect(player_t* player)
+static player_t* handle_login(player_t* player, const parsed_command_t* cmd, const int parsed, const char* line)
 {
-	char max_players_str[4];
-	char max_rooms_str[4];
-	sprintf(max_players_str, "%d", MAX_PLAYERS);
-	sprintf(max_rooms_str, "%d", MAX_ROOMS);
-
 	const int client_socket = player->socket;
-	send_structured_message(client_socket, S_WELCOME, 2, K_PLAYERS, max_players_str, K_ROOMS, max_rooms_str);
-
-	char buffer[MSG_MAX_LEN];
 	char nickname[NICKNAME_LEN] = {0};
 
-	// --- LOGIN ---
-	ssize_t login_result;
-	while ((login_result = receive_command(player, buffer, sizeof(buffer))) == -3)
-	{
-		// Socket timeout - keep waiting for LOGIN command
-	}
-	if (login_result <= 0)
-	{
-		LOG(LOG_LOBBY, "Client on socket %d disconnected before login.", client_socket);
-		remove_player(player);
-		close(client_socket);
-		return NULL;
-	}
-
-	parsed_command_t cmd;
-	if (parse_command(buffer, &cmd) != 0)
+	if (parsed != 0)
 	{
 		LOG(LOG_LOBBY, "Malformed login command from socket %d.", client_socket);
 		send_error(client_socket, NULL, E_INVALID_COMMAND);
-		remove_player(player);
-		close(client_socket);
+		close_client(player);
 		return NULL;
 	}
 
-	if (cmd.type != CMD_LOGIN)
+	if (cmd->type != CMD_LOGIN)
 	{
 		LOG(LOG_LOBBY, "Invalid command from socket %d, expected LOGIN.", client_socket);
 		send_error(client_socket, NULL, E_INVALID_COMMAND);
-		remove_player(player);
-		close(client_socket);
+		close_client(player);
 		return NULL;
 	}
 
-	const char* nick_val = get_command_arg(&cmd, K_NICK);
+	const char* nick_val = get_command_arg(cmd, KEY_NICK);
+	const char* proto_val = get_command_arg(cmd, KEY_PROTO);
+	const int binary = proto_val && strcmp(proto_val, PROTO_BIN) == 0;
 	if (nick_val)
 	{
 		strncpy(nickname, nick_val, NICKNAME_LEN - 1);
@@ -694,183 +589,264 @@ static player_t* handle_login_and_reconnect(player_t* player)
 	{
 		LOG(LOG_LOBBY, "Empty nickname from socket %d.", client_socket);
 		send_error(client_socket, C_LOGIN, E_INVALID_NICKNAME);
-		remove_player(player);
-		close(client_socket);
+		close_client(player);
 		return NULL;
 	}
 
 	// Check if a player with this nickname is already active
-	player_t* active_player = find_active_player_by_nickname(nickname);
+	const player_t* active_player = find_active_player_by_nickname(nickname);
 	if (active_player)
 	{
 		LOG(LOG_LOBBY, "Player tried to connect with active nickname: %s. Invalidating old session.", nickname);
 
-		// Invalidate the old socket so the game/lobby thread detects disconnect
-		if (active_player->socket != -1)
+		// Invalidate the old socket. The reactor sees the hangup right away and runs
+		// the usual disconnect handling, so the next login attempt can reconnect.
+		const int active_socket = active_player->socket;
+		if (active_socket != -1)
 		{
-			shutdown(active_player->socket, SHUT_RDWR);
-			close(active_player->socket);
+			shutdown(active_socket, SHUT_RDWR);
+		}
+
+		send_error(client_socket, C_LOGIN, E_NICKNAME_IN_USE);
+		close_client(player);
+		return NULL;
+	}
+
+	// --- RECONNECT or NEW PLAYER ---
+	player_t* reconnecting_player = find_disconnected_player(nickname);
+	const room_t* paused_room = reconnecting_player ? get_room(reconnecting_player->room_id) : NULL;
+	if (paused_room && paused_room->shard != -1 && paused_room->shard != player->shard)
+	{
+		LOG(LOG_LOBBY, "Player %s's game is hosted on shard %d, moving there.", nickname, paused_room->shard);
+		reactor_migrate(player, paused_room->shard, line);
+		return player;
+	}
+	if (reconnecting_player)
+	{
+		LOG(LOG_LOBBY, "Player %s is reconnecting.", nickname);
+		// This is a reconnecting player. We need to transfer the socket to the old player slot.
+		reconnecting_player->socket = client_socket;
+		reconnecting_player->session = SESSION_RESUME;
+		reconnecting_player->last_activity = time(NULL);
 
-			// Mark player as disconnected immediately so next reconnection attempt succeeds
-			handle_player_disconnect(active_player);
+		// Point the connection (and whatever it received after LOGIN) at the old slot, then drop the temporary one.
+		reactor_rebind(player, reconnecting_player);
+		remove_player(player);
+
+		send_structured_message(client_socket, S_GAME_PAUSED, binary ? 1 : 0, K_PROTO, PROTO_BIN);
+		if (binary)
+		{
+			set_socket_protocol(client_socket, PROTO_BINARY);
 		}
+		return reconnecting_player;
+	}
+
+	LOG(LOG_LOBBY, "New player %s logged in.", nickname);
+	// Just update the nickname in the player object we were given.
+	set_player_nickname(player, nickname);
+	player->session = SESSION_ACTIVE;
+	update_lobby_subscription(player);
+	// The reply is the last text message, a binary client gets frames from here on
+	send_structured_message(client_socket, S_OK, binary ? 3 : 2, K_CMD, C_LOGIN, K_NICK, nickname, K_PROTO, PROTO_BIN);
+	if (binary)
+	{
+		set_socket_protocol(client_socket, PROTO_BINARY);
+	}
+	return player;
+}
+
+/*
+ * Handles the first command of a reconnected player. Anything but RESUME aborts the paused game.
+ */
+static player_t* handle_resume(player_t* player, const parsed_command_t* cmd, const int parsed)
+{
+	const int client_socket = player->socket;
+	room_t* room = get_room(player->room_id);
 
-		send_error(client_socket, C_LOGIN, E_NICKNAME_IN_USE);
-		remove_player(player);
-		close(client_socket);
+	if (parsed != 0 || cmd->type != CMD_RESUME)
+	{
+		LOG(LOG_LOBBY, "Player %s failed to send RESUME. Aborting game.", player->nickname);
+		drop_client(player);
 		return NULL;
 	}
 
-	// --- RECONNECT or NEW PLAYER ---
-	player_t* reconnecting_player = find_disconnected_player(nickname);
-	if (reconnecting_player)
+	player->session = SESSION_ACTIVE;
+	if (!get_running_room(player))
 	{
-		LOG(LOG_LOBBY, "Player %s is reconnecting.", nickname);
-		// This is a reconnecting player. We need to transfer control to the old player slot.
-		reconnecting_player->socket = client_socket; // Give the new socket to the old player object.
-
-		// Copy any data read after the LOGIN command from the temp buffer to the real buffer.
-		memcpy(reconnecting_player->read_buffer, player->read_buffer, player->buffer_len);
-		reconnecting_player->buffer_len = player->buffer_len;
+		// The game ended (reconnect timeout) while we were waiting for RESUME
+		LOG(LOG_LOBBY, "Player %s sent RESUME but the game is already over.", player->nickname);
+		send_error(client_socket, C_RESUME, E_INVALID_COMMAND);
+		return player;
+	}
 
-		// The temporary player object created by `add_player` is no longer needed.
-		remove_player(player);
+	LOG(LOG_LOBBY, "Player %s resumed game in room %d.", player->nickname, room->id);
+	const int player_idx = (room->players[0] == player) ? 0 : 1;
+	const int other_idx = 1 - player_idx;
+	send_structured_message(client_socket, S_OK, 1, K_CMD, C_RESUME);
 
-		// This thread will now manage the reconnecting player.
-		player = reconnecting_player;
+	if (room->players[other_idx] && room->players[other_idx]->socket != -1)
+	{
+		pthread_mutex_lock(&room->mutex);
+		room->state = IN_PROGRESS;
+		room->idle_player_idx = -1;
+		pthread_mutex_unlock(&room->mutex);
+		broadcast_room_update(room);
+		end_pause(room);
 
-		send_structured_message(client_socket, S_GAME_PAUSED, 0);
+		send_structured_message(room->players[other_idx]->socket, S_OPPONENT_RECONNECTED, 0);
+	}
+	else
+	{
+		// Both dropped - stay paused and give the opponent their own reconnect window
+		LOG(LOG_GAME, "Opponent in room %d is still disconnected, game stays paused.", room->id);
+		start_reconnect_window(room);
+	}
 
-		room_t* room = get_room(player->room_id);
-		const int other_idx = (room->players[0] == player) ? 1 : 0;
+	send_game_state(player, room);
+	return player;
+}
 
-		ssize_t resume_result;
-		while ((resume_result = receive_command(player, buffer, sizeof(buffer))) == -3)
+/*
+ * Seats two players of this shard in an empty room, the way two JOIN_ROOMs would.
+ * Returns the room, or NULL if no empty room could be had.
+ */
+static room_t* seat_pair(player_t* first, player_t* second)
+{
+	int host_shard;
+	for (int room_id = find_empty_room(0); room_id != -1; room_id = find_empty_room(room_id + 1))
+	{
+		// Someone else may have taken the room since it was found
+		if (join_room(room_id, first, &host_shard) != 0)
 		{
-			// Socket timeout - keep waiting for RESUME command
+			continue;
 		}
-
-		if (resume_result > 0)
+		if (join_room(room_id, second, &host_shard) == 0)
 		{
-			parsed_command_t resume_cmd;
-			if (parse_command(buffer, &resume_cmd) == 0 && resume_cmd.type == CMD_RESUME)
-			{
-				LOG(LOG_LOBBY, "Player %s resumed game in room %d.", player->nickname, room->id);
-				LOG(LOG_LOBBY, "Player %s resumed game in room %d. Signaling game thread.", player->nickname, room->id);
-				pthread_mutex_lock(&room->mutex);
-				room->state = IN_PROGRESS;
-				broadcast_room_update(room);
-				pthread_cond_broadcast(&room->cond); // Changed to broadcast
-				pthread_mutex_unlock(&room->mutex);
-
-				send_structured_message(client_socket, S_OK, 1, K_CMD, C_RESUME);
-
-				if (room->players[other_idx]->socket != -1)
-				{
-					send_structured_message(room->players[other_idx]->socket, S_OPPONENT_RECONNECTED, 0);
-				}
-			}
-			else
-			{
-				LOG(LOG_LOBBY, "Player %s failed to send RESUME. Aborting game.", player->nickname);
-				// Failed to send RESUME, abort game.
-				pthread_mutex_lock(&room->mutex);
-				room->state = ABORTED;
-				pthread_cond_signal(&room->cond);
-				pthread_mutex_unlock(&room->mutex);
-				remove_player(player);
-				close(client_socket);
-				return NULL;
-			}
+			return get_room(room_id);
 		}
-		else
+		leave_room(first);
+	}
+	return NULL;
+}
+
+/*
+ * Pairs the shard's quick-match players, longest waiting first, and starts their games.
+ * Whoever cannot be paired (odd one out, or no empty room) keeps their place.
+ */
+static void match_queued_players(const int shard)
+{
+	while (quick_match_length(shard) >= 2 && find_empty_room(0) != -1)
+	{
+		player_t* first = dequeue_quick_match(shard);
+		player_t* second = dequeue_quick_match(shard);
+		room_t* room = seat_pair(first, second);
+		if (!room)
 		{
-			LOG(LOG_LOBBY, "Player %s disconnected before resuming.", player->nickname);
-			// Disconnected before sending RESUME.
-			pthread_mutex_lock(&room->mutex);
-			room->state = ABORTED;
-			pthread_cond_signal(&room->cond);
-			pthread_mutex_unlock(&room->mutex);
-			remove_player(player);
-			close(client_socket);
-			return NULL;
+			// The empty rooms were taken in the meantime
+			LOG(LOG_LOBBY, "No empty room for a quick match, %d players keep waiting.", quick_match_length(shard) + 2);
+			enqueue_quick_match(second, 1);
+			enqueue_quick_match(first, 1);
+			return;
 		}
+
+		LOG(LOG_LOBBY, "Quick match: %s and %s in room %d.", first->nickname, second->nickname, room->id);
+		char room_id_str[12];
+		snprintf(room_id_str, sizeof(room_id_str), "%d", room->id);
+		send_structured_message(first->socket, S_OK, 2, K_CMD, C_QUICK_MATCH, K_ROOM, room_id_str);
+		send_structured_message(second->socket, S_OK, 2, K_CMD, C_QUICK_MATCH, K_ROOM, room_id_str);
+		start_game(room);
 	}
-	else // This is a new player.
+}
+
+/*
+ * Brings a player left waiting alone on the shard together with others. Waiting players only
+ * move down, so one goes to a lower shard with players waiting, or else the higher shards with
+ * players waiting are asked to send theirs here. Nothing retries this later: it runs whenever a
+ * player starts waiting, and the queue lengths are sequentially consistent, so of two shards
+ * queueing at the same time at least one sees the other.
+ */
+static void gather_quick_match(const int shard)
+{
+	if (quick_match_length(shard) != 1)
 	{
-		LOG(LOG_LOBBY, "New player %s logged in.", nickname);
-		// Just update the nickname in the player object we were given.
-		strcpy(player->nickname, nickname);
-		send_structured_message(client_socket, S_OK, 2, K_CMD, C_LOGIN, K_NICK, nickname);
+		return;
+	}
+	const int other_shard = find_quick_match_shard(shard);
+	if (other_shard != -1)
+	{
+		// Their QUICK_MATCH was answered already: put back in line on arrival (server_on_migrated())
+		player_t* player = move_quick_match(shard);
+		LOG(LOG_LOBBY, "Moving quick match player %s to shard %d.", player->nickname, other_shard);
+		reactor_migrate(player, other_shard, NULL);
+		return;
+	}
+	for (int i = shard + 1; i < SERVER_THREADS; ++i)
+	{
+		if (quick_match_length(i) > 0)
+		{
+			reactor_schedule_tick(i);
+		}
 	}
-	return player;
 }
 
-static void handle_lobby_command(player_t* player, const parsed_command_t* lobby_cmd)
+static void handle_lobby_command(player_t* player, const parsed_command_t* lobby_cmd, const char* line)
 {
 	const int client_socket = player->socket;
 	switch (lobby_cmd->type)
 	{
 		case CMD_LIST_ROOMS:
 			{
-				for (int i = 0; i < MAX_ROOMS; ++i)
+				const char* state_str = get_command_arg(lobby_cmd, KEY_STATE);
+				const char* offset_str = get_command_arg(lobby_cmd, KEY_OFFSET);
+				const char* limit_str = get_command_arg(lobby_cmd, KEY_LIMIT);
+				if (!state_str && !offset_str && !limit_str)
 				{
-					const room_t* r = get_room(i);
-					char id_str[4], p_count_str[4], state_str[15];
-					sprintf(id_str, "%d", r->id);
-					sprintf(p_count_str, "%d", r->player_count);
-
-					switch (r->state)
-					{
-						case WAITING:
-							strcpy(state_str, "WAITING");
-							break;
-						case IN_PROGRESS:
-							strcpy(state_str, "IN_PROGRESS");
-							break;
-						case PAUSED:
-							strcpy(state_str, "PAUSED");
-							break;
-						case ABORTED:
-							strcpy(state_str, "ABORTED");
-							break;
-					}
+					send_room_list(client_socket);
+					break;
+				}
 
-					send_structured_message(
-						client_socket, S_ROOM_INFO, 3,
-						K_ROOM, id_str,
-						K_COUNT, p_count_str,
-						K_STATE, state_str
-					);
+				const int state = state_str ? parse_room_state(state_str) : -1;
+				const int offset = offset_str ? atoi(offset_str) : 0;
+				const int limit = limit_str ? atoi(limit_str) : ROOM_PAGE_MAX;
+				if ((state_str && state < 0) || offset < 0 || limit < 0)
+				{
+					LOG(LOG_LOBBY, "LIST_ROOMS command from %s with invalid arguments. Disconnecting.", player->nickname);
+					send_error(client_socket, C_LIST_ROOMS, E_INVALID_COMMAND);
+					close_client(player);
+					return;
 				}
+				send_room_page(client_socket, state, offset, limit);
 				break;
 			}
 		case CMD_JOIN_ROOM:
 			{
-				const char* room_id_str = get_command_arg(lobby_cmd, K_ROOM);
+				const char* room_id_str = get_command_arg(lobby_cmd, KEY_ROOM);
 				if (!room_id_str)
 				{
 					LOG(
 						LOG_LOBBY, "JOIN_ROOM command from %s missing room ID. Disconnecting.", player->nickname
 					);
 					send_error(client_socket, C_JOIN_ROOM, E_INVALID_COMMAND);
-					remove_player(player);
-					close(client_socket);
+					close_client(player);
 					return;
 				}
 				const int room_id = atoi(room_id_str);
 				LOG(LOG_LOBBY, "Player %s trying to join room %d.", player->nickname, room_id);
-				if (join_room(room_id, player) == 0)
+				int host_shard;
+				const int join_result = join_room(room_id, player, &host_shard);
+				if (join_result == 1)
+				{
+					// Keep both players of a game on one shard - retry the JOIN over there
+					LOG(LOG_LOBBY, "Room %d is hosted on shard %d, moving player %s there.", room_id, host_shard, player->nickname);
+					reactor_migrate(player, host_shard, line);
+				}
+				else if (join_result == 0)
 				{
 					send_structured_message(client_socket, S_OK, 2, K_CMD, C_JOIN_ROOM, K_ROOM, room_id_str);
 					room_t* room = get_room(room_id);
 					if (room->player_count == MAX_PLAYERS_PER_ROOM)
 					{
-						pthread_create(&room->game_thread, NULL, game_thread_func, (void*)room);
-						// Wake up the other waiting player in the room.
-						pthread_mutex_lock(&room->mutex);
-						pthread_cond_broadcast(&room->cond);
-						pthread_mutex_unlock(&room->mutex);
+						start_game(room);
 					}
 				}
 				else
@@ -880,8 +856,26 @@ static void handle_lobby_command(player_t* player, const parsed_command_t* lobby
 				}
 				break;
 			}
+		case CMD_QUICK_MATCH:
+			{
+				if (enqueue_quick_match(player, 0) == 0)
+				{
+					LOG(LOG_LOBBY, "Player %s is waiting for a quick match.", player->nickname);
+				}
+				send_structured_message(client_socket, S_OK, 1, K_CMD, C_QUICK_MATCH);
+				const int shard = player->shard;
+				match_queued_players(shard);
+				gather_quick_match(shard); // may move the player to another shard
+				break;
+			}
 		case CMD_LEAVE_ROOM:
 			{
+				if (cancel_quick_match(player) == 0)
+				{
+					LOG(LOG_LOBBY, "Player %s stopped waiting for a quick match.", player->nickname);
+					send_structured_message(client_socket, S_OK, 1, K_CMD, C_LEAVE_ROOM);
+					break;
+				}
 				LOG(LOG_LOBBY, "Player %s leaving room.", player->nickname);
 				if (leave_room(player) == 0)
 				{
@@ -901,253 +895,318 @@ static void handle_lobby_command(player_t* player, const parsed_command_t* lobby
 		case CMD_EXIT:
 			{
 				LOG(LOG_LOBBY, "Player %s exiting from lobby.", player->nickname);
-				remove_player(player);
-				close(client_socket);
+				close_client(player);
 				return;
 			}
 		default:
 			{
 				LOG(LOG_LOBBY, "Invalid command from %s in lobby. Disconnecting.", player->nickname);
 				send_error(client_socket, NULL, E_INVALID_COMMAND);
-				remove_player(player);
-				close(client_socket);
+				close_client(player);
 				return;
 			}
 	}
 }
 
 /*
- * Main loop after login - alternates between LOBBY state and IN_GAME state.
+ * Player is sitting in a room waiting for an opponent - they can still LEAVE_ROOM or PING.
+ */
+static void handle_waiting_room_command(player_t* player, const parsed_command_t* cmd, const int parsed)
+{
+	if (parsed != 0)
+	{
+		send_error(player->socket, NULL, E_INVALID_COMMAND);
+		return;
+	}
+
+	if (cmd->type == CMD_LEAVE_ROOM)
+	{
+		if (leave_room(player) == 0)
+		{
+			send_structured_message(player->socket, S_OK, 1, K_CMD, C_LEAVE_ROOM);
+		}
+		else
+		{
+			send_error(player->socket, C_LEAVE_ROOM, E_GAME_IN_PROGRESS);
+		}
+	}
+	else if (cmd->type == CMD_PING)
+	{
+		send_structured_message(player->socket, S_OK, 1, K_CMD, C_PING);
+	}
+	else
+	{
+		send_error(player->socket, NULL, E_INVALID_COMMAND);
+	}
+}
+
+/*
+ * Logs a command received from a logged-in player, as the lobby and game logs always did.
+ */
+static void log_command(const player_t* player, const char* command)
+{
+	if (player->session != SESSION_ACTIVE)
+	{
+		return;
+	}
+	if (player->state == LOBBY)
+	{
+		LOG(LOG_LOBBY, "Received from player %s in lobby: %s", player->nickname, command);
+	}
+	else if (get_running_room(player))
+	{
+		LOG(LOG_GAME, "Received from player %s: %s", player->nickname, command);
+	}
+}
+
+/*
+ * Per-connection state machine, one command at a time.
  *
- * LOBBY: process commands like LIST_ROOMS, JOIN_ROOM, etc.
- * IN_GAME (waiting): sit in room waiting for opponent, can still LEAVE_ROOM or PING
- * IN_GAME (playing): game_thread handles everything, we just wait for game to end
+ * Flow: LOGIN -> (RESUME) -> lobby commands -> join room -> waiting room -> game -> lobby
+ *
+ * Returns the player that owns the socket afterwards, or NULL if it was closed.
  */
-static void handle_main_loop(player_t* player)
+static player_t* handle_client_command(player_t* player, char* buffer, const size_t len, const wire_protocol_t proto)
 {
-	const int client_socket = player->socket;
+	// Commands that may move the player to another shard (LOGIN, JOIN_ROOM) keep a text
+	// copy to re-run over there, since parsing consumes the buffer.
+	char line[MSG_MAX_LEN];
+	const int may_migrate = player->session == SESSION_LOGIN || (player->session == SESSION_ACTIVE && player->state == LOBBY);
 
-	while (player->socket != -1)
+	parsed_command_t cmd;
+	char scratch[BINARY_SCRATCH_LEN(MSG_MAX_LEN)];
+	int parsed;
+	if (proto == PROTO_BINARY)
 	{
-		// Check if the socket handled by this thread is still the active one for the player.
-		// If not, it means a reconnection happened and this thread is obsolete.
-		if (player->socket != client_socket)
+		parsed = parse_binary_command((const unsigned char*)buffer, len, scratch, &cmd);
+		if (parsed == 0 && may_migrate)
 		{
-			LOG(LOG_SERVER, "Thread for socket %d detected player %s is now on socket %d. Exiting.",
-				client_socket, player->nickname, player->socket);
-			return;
+			format_command(&cmd, line, sizeof(line));
+		}
+		log_command(player, command_label(&cmd));
+	}
+	else
+	{
+		if (may_migrate)
+		{
+			strcpy(line, buffer);
 		}
+		log_command(player, buffer);
+		parsed = parse_command(buffer, &cmd);
+	}
 
-		if (player->state == LOBBY)
+	switch (player->session)
+	{
+		case SESSION_LOGIN:
+			return handle_login(player, &cmd, parsed, line);
+		case SESSION_RESUME:
+			return handle_resume(player, &cmd, parsed);
+		case SESSION_ACTIVE:
+			break;
+	}
+
+	if (player->state == LOBBY)
+	{
+		if (parsed != 0)
 		{
-			// Check if there's already a complete command in the buffer first
-			int has_buffered_command = (player->buffer_len > 0 && strchr(player->read_buffer, '\n') != NULL);
+			LOG(LOG_LOBBY, "Malformed command from %s in lobby. Disconnecting.", player->nickname);
+			send_error(player->socket, NULL, E_INVALID_COMMAND);
+			close_client(player);
+			return NULL;
+		}
+		handle_lobby_command(player, &cmd, line);
+	}
+	else
+	{
+		room_t* room = get_running_room(player);
+		if (room)
+		{
+			handle_game_command(room, player, &cmd, parsed);
+		}
+		else
+		{
+			handle_waiting_room_command(player, &cmd, parsed);
+		}
+	}
+	return player;
+}
 
-			if (!has_buffered_command)
-			{
-				// No buffered command - use select() with timeout to wait for data
-				fd_set read_fds;
-				struct timeval tv;
-				tv.tv_sec = IDLE_TIMEOUT / 2;
-				tv.tv_usec = 0;
+int server_on_accept(const int client_socket, const int shard)
+{
+	LOG(LOG_SERVER, "Accepted new connection on socket %d (shard %d).", client_socket, shard);
 
-				FD_ZERO(&read_fds);
-				FD_SET(player->socket, &read_fds);
+	// The descriptor may have belonged to a binary client before; everyone starts with text
+	set_socket_protocol(client_socket, PROTO_TEXT);
 
-				const int activity = select(player->socket + 1, &read_fds, NULL, NULL, &tv);
+	player_t* player = add_player(client_socket, shard);
+	if (!player)
+	{
+		LOG(LOG_SERVER, "Server is full. Rejecting connection from socket %d.", client_socket);
+		send_error(client_socket, NULL, E_SERVER_FULL);
+		close(client_socket);
+		return -1;
+	}
 
-				if (activity < 0 && errno != EINTR)
-				{
-					LOG(LOG_LOBBY, "Select error for player %s: %s", player->nickname, strerror(errno));
-					remove_player(player);
-					close(client_socket);
-					return;
-				}
+	if (reactor_watch(player) != 0)
+	{
+		remove_player(player); // Rollback the add_player
+		close(client_socket);
+		return -1;
+	}
+	watch_idle(player);
+
+	message_t msg;
+	msg_begin(&msg, S_WELCOME);
+	msg_add_int(&msg, MSG_FIELD(PLAYERS), MAX_PLAYERS);
+	msg_add_int(&msg, MSG_FIELD(ROOMS), MAX_ROOMS);
+	msg_send(client_socket, &msg);
+	return 0;
+}
 
-				if (activity == 0)
-				{
-					// Timeout - check if player should be disconnected for inactivity
-					if (time(NULL) - player->last_activity > IDLE_TIMEOUT)
-					{
-						LOG(
-							LOG_LOBBY, "Player %s timed out in lobby (idle %ld seconds).",
-							player->nickname, time(NULL) - player->last_activity
-						);
-						send_structured_message(client_socket, S_DISCONNECTED, 0);
-						remove_player(player);
-						close(client_socket);
-						return;
-					}
-					continue; // Go back to waiting
-				}
-			}
+void server_on_readable(player_t* player)
+{
+	char* line;
+	const int shard = player->shard;
 
-			// Data available (from socket or buffer) - read command
-			char buffer[MSG_MAX_LEN];
-			const ssize_t recv_result = receive_command(player, buffer, sizeof(buffer));
-			if (recv_result == -3)
-			{
-				// Socket timeout - continue waiting
-				continue;
-			}
-			if (recv_result <= 0)
-			{
-				LOG(LOG_LOBBY, "Player %s disconnected from lobby.", player->nickname);
-				remove_player(player);
-				close(client_socket);
-				return;
-			}
+	// Edge-triggered: keep going until the socket is drained, closed or handed to another shard.
+	while (player && player->watched && player->shard == shard)
+	{
+		const ssize_t recv_result = receive_command(player, &line);
+		if (recv_result == -3)
+		{
+			return; // Nothing more to read until the next edge
+		}
+		if (recv_result <= 0)
+		{
+			handle_connection_lost(player);
+			return;
+		}
+		player = handle_client_command(player, line, (size_t)recv_result, get_socket_protocol(player->socket));
+	}
+}
 
-			LOG(LOG_LOBBY, "Received from player %s in lobby: %s", player->nickname, buffer);
-			parsed_command_t lobby_cmd;
-			if (parse_command(buffer, &lobby_cmd) != 0)
-			{
-				LOG(LOG_LOBBY, "Malformed command from %s in lobby. Disconnecting.", player->nickname);
-				send_error(client_socket, NULL, E_INVALID_COMMAND);
-				remove_player(player);
-				close(client_socket);
-				return;
-			}
-			handle_lobby_command(player, &lobby_cmd);
+void server_on_migrated(player_t* player, const char* command)
+{
+	watch_idle(player);
+	if (command)
+	{
+		char buffer[MSG_MAX_LEN];
+		strncpy(buffer, command, sizeof(buffer) - 1);
+		buffer[sizeof(buffer) - 1] = '\0';
+
+		// Always text, binary commands are converted before the move
+		const int shard = player->shard;
+		player = handle_client_command(player, buffer, strlen(buffer), PROTO_TEXT);
+		if (!player || player->shard != shard)
+		{
+			return;
 		}
-		else if (player->state == IN_GAME)
+	}
+	else if (requeue_quick_match(player) == 0)
+	{
+		// Moved here to be paired, see gather_quick_match()
+		const int shard = player->shard;
+		LOG(LOG_LOBBY, "Player %s is waiting for a quick match on shard %d.", player->nickname, shard);
+		match_queued_players(shard);
+		gather_quick_match(shard);
+		if (player->shard != shard)
 		{
-			room_t* room = get_room(player->room_id);
-			if (room)
-			{
-				pthread_mutex_lock(&room->mutex);
-				if (room->state == WAITING)
-				{
-					// Player is waiting for an opponent. Wait with a timeout to allow leaving.
-                    struct timespec ts;
-                    clock_gettime(CLOCK_REALTIME, &ts);
-                    ts.tv_sec += 1; // 1 second timeout
+			return; // their partner left in the meantime, on to the next one
+		}
+	}
+	// Still in the lobby (e.g. the JOIN_ROOM failed here), now on this shard's feed
+	update_lobby_subscription(player);
 
-                    const int wait_result = pthread_cond_timedwait(&room->cond, &room->mutex, &ts);
-					pthread_mutex_unlock(&room->mutex); // Unlock after wait
+	// Bytes that arrived during the move raised no edge on this shard's epoll
+	server_on_readable(player);
+}
 
-					if (wait_result == ETIMEDOUT)
-					{
-						// Check for idle timeout
-						if (time(NULL) - player->last_activity > IDLE_TIMEOUT)
-						{
-							LOG(
-								LOG_LOBBY, "Player %s timed out in waiting room (idle %ld seconds).",
-								player->nickname, time(NULL) - player->last_activity
-							);
-							send_structured_message(client_socket, S_DISCONNECTED, 0);
-							leave_room(player);
-							remove_player(player);
-							close(client_socket);
-							return;
-						}
-
-						// Timeout: check for commands (from buffer first, then socket)
-						int has_buffered_cmd = (player->buffer_len > 0 && strchr(player->read_buffer, '\n') != NULL);
-						int has_socket_data = 0;
-
-						if (!has_buffered_cmd)
-						{
-							fd_set read_fds;
-							struct timeval tv = {0, 0};
-							FD_ZERO(&read_fds);
-							FD_SET(player->socket, &read_fds);
-							has_socket_data = (select(player->socket + 1, &read_fds, NULL, NULL, &tv) > 0);
-						}
-
-						if (has_buffered_cmd || has_socket_data)
-						{
-							char buffer[MSG_MAX_LEN];
-							const ssize_t recv_result = receive_command(player, buffer, sizeof(buffer));
-							if (recv_result == -3)
-							{
-								// Socket timeout - continue waiting
-								continue;
-							}
-							if (recv_result > 0)
-							{
-								parsed_command_t cmd;
-								if (parse_command(buffer, &cmd) == 0)
-								{
-									if (cmd.type == CMD_LEAVE_ROOM)
-									{
-										if (leave_room(player) == 0)
-										{
-											send_structured_message(player->socket, S_OK, 1, K_CMD, C_LEAVE_ROOM);
-										}
-										else
-										{
-											send_error(player->socket, C_LEAVE_ROOM, E_GAME_IN_PROGRESS);
-										}
-									}
-									else if (cmd.type == CMD_PING)
-									{
-										send_structured_message(player->socket, S_OK, 1, K_CMD, C_PING);
-									}
-									else
-									{
-										send_error(player->socket, NULL, E_INVALID_COMMAND);
-									}
-								}
-								else
-								{
-									send_error(player->socket, NULL, E_INVALID_COMMAND);
-								}
-							}
-							else
-							{
-								// Disconnected while waiting (recv_result <= 0, not -3)
-								LOG(LOG_LOBBY, "Player %s disconnected from waiting room.", player->nickname);
-								leave_room(player);
-								remove_player(player);
-								close(client_socket);
-								return;
-							}
-						}
-					}
-					// If wait was successful, loop will continue and re-evaluate states.
-				}
-				else
-				{
-					// Game is IN_PROGRESS or PAUSED. Wait until game is over.
-					while (player->state == IN_GAME)
-					{
-						pthread_cond_wait(&room->cond, &room->mutex);
-
-						// Check if this thread is obsolete (reconnection happened)
-						if (player->socket != client_socket)
-						{
-							pthread_mutex_unlock(&room->mutex);
-							LOG(LOG_SERVER, "Thread for socket %d detected reconnection after cond_wait. Exiting.",
-								client_socket);
-							return;
-						}
-					}
-					pthread_mutex_unlock(&room->mutex);
-				}
+void server_on_slow_consumer(player_t* player)
+{
+	LOG(LOG_SERVER, "Player %s is not reading (socket %d), dropping the connection.", player->nickname, player->socket);
+	handle_connection_lost(player);
+}
+
+void server_on_idle(player_t* player)
+{
+	const time_t now = time(NULL);
+	if (now - player->last_activity <= IDLE_TIMEOUT)
+	{
+		// Heard from them since the deadline was set, no need to move it on every message
+		watch_idle(player);
+		return;
+	}
+
+	room_t* room = player->session == SESSION_ACTIVE ? get_running_room(player) : NULL;
+	if (room)
+	{
+		// A paused game is waiting for someone else; end_pause() watches everyone again
+		if (room->state == IN_PROGRESS)
+		{
+			const int player_idx = room->players[0] == player ? 0 : 1;
+			LOG(
+				LOG_GAME, "Player %s timed out in game (idle %ld seconds).",
+				player->nickname, now - player->last_activity
+			);
+
+			// Notify the other player about the disconnection
+			const player_t* other_player = room->players[1 - player_idx];
+			if (other_player && other_player->socket != -1)
+			{
+				send_structured_message(other_player->socket, S_OPPONENT_DISCONNECTED, 0);
 			}
+
+			// Keep socket open - player can resume by sending any message
+			// Just pause the game
+			pause_game(room, player_idx);
 		}
+		return;
 	}
+
+	// Login, lobby and waiting room
+	LOG(
+		LOG_LOBBY, "Player %s timed out in %s (idle %ld seconds).",
+		player->nickname, player->state == IN_GAME ? "waiting room" : "lobby", now - player->last_activity
+	);
+	send_structured_message(player->socket, S_DISCONNECTED, 0);
+	drop_client(player);
 }
 
-int run_server(const int port, const char* address)
+void server_on_tick(const int shard)
+{
+	// Room changes since the tick was asked for, one batch per lobby player
+	publish_room_updates(shard);
+
+	// Asked for by broadcast_room_update() when a room emptied, or by a lower shard whose player
+	// waits alone (gather_quick_match())
+	match_queued_players(shard);
+	gather_quick_match(shard);
+}
+
+/*
+ * Creates one non-blocking listening socket for a shard. All shards bind the same
+ * address with SO_REUSEPORT and the kernel balances incoming connections between them.
+ */
+static int create_listen_socket(const int port, const char* address)
 {
 	// Structure to hold server address information
 	struct sockaddr_in server_addr;
 
-	init_lobby();
-
-	// Create a socket for the server
-	const int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+	// Create a non-blocking socket for the server (the reactor accepts until EAGAIN)
+	const int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (server_fd < 0)
 	{
 		LOG(LOG_SERVER, "socket() failed: %s", strerror(errno));
 		return -1;
 	}
 
-	// Set socket options to allow reusing the address, preventing "Address already in use" errors
+	// Set socket options to allow reusing the address, preventing "Address already in use" errors,
+	// and to let every shard bind its own socket to the same port
 	const int opt = 1;
-	if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+	if (
+		setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+		setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0
+	)
 	{
 		LOG(LOG_SERVER, "setsockopt() failed: %s", strerror(errno));
 		close(server_fd);
@@ -1176,50 +1235,62 @@ int run_server(const int port, const char* address)
 		return -1;
 	}
 
-	LOG(LOG_SERVER, "Server listening on port %d...", port);
+	return server_fd;
+}
 
-	while (1)
+int run_server(const int port, const char* address)
+{
+	// Touched (and backed by memory) only for rooms that get paused
+	reconnect_deadlines = calloc(MAX_ROOMS, sizeof(deadline_t));
+	if (!reconnect_deadlines)
 	{
-		// Accept a new client connection
-		const int client_socket = accept(server_fd, NULL, NULL);
-		if (client_socket < 0)
-		{
-			LOG(LOG_SERVER, "accept() failed: %s", strerror(errno));
-			continue;
-		}
+		LOG(LOG_SERVER, "Out of memory while creating the reconnect deadlines.");
+		return -1;
+	}
 
-		// Set socket receive timeout to detect disconnections faster
-		struct timeval recv_timeout;
-		recv_timeout.tv_sec = 5;
-		recv_timeout.tv_usec = 0;
-		if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) < 0)
-		{
-			LOG(LOG_SERVER, "setsockopt(SO_RCVTIMEO) failed: %s", strerror(errno));
-		}
+	// Every player is a file descriptor now, so don't stop at the default soft limit
+	struct rlimit fd_limit;
+	if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max)
+	{
+		fd_limit.rlim_cur = fd_limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &fd_limit);
+	}
+
+	if (init_protocol() != 0)
+	{
+		LOG(LOG_SERVER, "Out of memory while creating the protocol table.");
+		return -1;
+	}
 
-		LOG(LOG_SERVER, "Accepted new connection on socket %d.", client_socket);
+	int* listen_fds = malloc(SERVER_THREADS * sizeof(int));
+	if (!listen_fds)
+	{
+		LOG(LOG_SERVER, "Out of memory while creating %d listening sockets.", SERVER_THREADS);
+		return -1;
+	}
 
-		player_t* player = add_player(client_socket);
-		if (!player)
+	int result = -1;
+	int created = 0;
+	for (; created < SERVER_THREADS; ++created)
+	{
+		listen_fds[created] = create_listen_socket(port, address);
+		if (listen_fds[created] < 0)
 		{
-			LOG(LOG_SERVER, "Server is full. Rejecting connection from socket %d.", client_socket);
-			send_error(client_socket, NULL, E_SERVER_FULL);
-			close(client_socket);
-			continue;
+			break;
 		}
+	}
 
-		// Create a new thread to handle the client connection
-		pthread_t tid;
-		if (pthread_create(&tid, NULL, client_handler_thread, (void*)player) != 0)
-		{
-			LOG(LOG_SERVER, "pthread_create() failed: %s", strerror(errno));
-			remove_player(player); // Rollback the add_player
-			close(client_socket);
-		}
-		else
-		{
-			// Detach the thread so its resources are automatically released on exit
-			pthread_detach(tid);
-		}
+	const io_backend_t io = USE_IO_URING ? IO_URING : IO_EPOLL;
+	if (created == SERVER_THREADS && reactor_init(listen_fds, SERVER_THREADS, PIN_THREADS, io) == 0)
+	{
+		LOG(LOG_SERVER, "Server listening on port %d with %d reactor threads...", port, SERVER_THREADS);
+		result = reactor_run();
+	}
+
+	for (int i = 0; i < created; ++i)
+	{
+		close(listen_fds[i]);
 	}
+	free(listen_fds);
+	return result;
 }
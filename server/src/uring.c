@@ -0,0 +1,252 @@
+/*
+ * uring.c - Minimal io_uring wrapper on raw syscalls
+ *
+ * Maps the submission/completion rings and the entry array, and registers a
+ * ring of provided buffers the kernel picks from for multishot receives.
+ * Ring indices are shared with the kernel, so head/tail accesses use
+ * acquire/release ordering.
+ */
+
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_setup(const unsigned entries, struct io_uring_params* params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags, void* arg, const size_t arg_size)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_register(const int fd, const unsigned opcode, void* arg, const unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int setup_buffers(uring_t* ring, const unsigned buf_count, const unsigned buf_size)
+{
+	ring->buf_count = buf_count;
+	ring->buf_size = buf_size;
+	ring->buf_ring_len = buf_count * sizeof(struct io_uring_buf);
+
+	// The kernel wants the buffer ring page aligned
+	ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buf_ring == MAP_FAILED)
+	{
+		ring->buf_ring = NULL;
+		return -1;
+	}
+	ring->buf_base = malloc((size_t)buf_count * buf_size);
+	if (!ring->buf_base)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ring->buf_ring;
+	reg.ring_entries = buf_count;
+	reg.bgid = 0;
+	if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		return -1;
+	}
+
+	for (unsigned bid = 0; bid < buf_count; ++bid)
+	{
+		struct io_uring_buf* buf = &ring->buf_ring->bufs[bid];
+		buf->addr = (unsigned long)(ring->buf_base + (size_t)bid * buf_size);
+		buf->len = buf_size;
+		buf->bid = bid;
+	}
+	__atomic_store_n(&ring->buf_ring->tail, (unsigned short)buf_count, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int uring_init(uring_t* ring, const unsigned entries, const unsigned buf_count, const unsigned buf_size)
+{
+	memset(ring, 0, sizeof(*ring));
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4; // multishot receives produce many completions per submission
+
+	ring->fd = sys_setup(entries, &params);
+	if (ring->fd < 0)
+	{
+		return -1;
+	}
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+	{
+		close(ring->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	// With SINGLE_MMAP the submission and completion rings share one mapping
+	ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	const size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_len > ring->sq_map_len)
+	{
+		ring->sq_map_len = cq_len;
+	}
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+	{
+		ring->sq_map = NULL;
+		uring_destroy(ring);
+		return -1;
+	}
+	ring->cq_map = ring->sq_map;
+
+	ring->sqes_map_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		uring_destroy(ring);
+		return -1;
+	}
+
+	char* sq = ring->sq_map;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	char* cq = ring->cq_map;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	if (setup_buffers(ring, buf_count, buf_size) != 0)
+	{
+		const int err = errno;
+		uring_destroy(ring);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+void uring_destroy(uring_t* ring)
+{
+	if (ring->buf_ring)
+	{
+		munmap(ring->buf_ring, ring->buf_ring_len);
+	}
+	free(ring->buf_base);
+	if (ring->sqes)
+	{
+		munmap(ring->sqes, ring->sqes_map_len);
+	}
+	if (ring->sq_map)
+	{
+		munmap(ring->sq_map, ring->sq_map_len);
+	}
+	if (ring->fd >= 0)
+	{
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+	unsigned tail = *ring->sq_tail;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > ring->sq_mask)
+	{
+		// Full - hand what we have to the kernel and try again
+		uring_submit_and_wait(ring, 0);
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > ring->sq_mask)
+		{
+			return NULL;
+		}
+	}
+
+	const unsigned index = tail & ring->sq_mask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->sq_pending++;
+	return sqe;
+}
+
+int uring_submit_and_wait(uring_t* ring, const int timeout_ms)
+{
+	int result;
+	if (timeout_ms > 0)
+	{
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (unsigned long)&ts;
+		result = sys_enter(ring->fd, ring->sq_pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	else if (timeout_ms < 0)
+	{
+		result = sys_enter(ring->fd, ring->sq_pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	}
+	else
+	{
+		result = sys_enter(ring->fd, ring->sq_pending, 0, 0, NULL, 0);
+	}
+
+	// Whatever the kernel did not consume stays queued for the next call
+	ring->sq_pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (result < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+struct io_uring_cqe* uring_peek_cqe(const uring_t* ring)
+{
+	const unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(const uring_t* ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+const char* uring_buffer(const uring_t* ring, const unsigned bid)
+{
+	return ring->buf_base + (size_t)bid * ring->buf_size;
+}
+
+void uring_recycle_buffer(uring_t* ring, const unsigned bid)
+{
+	const unsigned short tail = ring->buf_ring->tail;
+	struct io_uring_buf* buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+	buf->addr = (unsigned long)(ring->buf_base + (size_t)bid * ring->buf_size);
+	buf->len = ring->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
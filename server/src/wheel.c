@@ -0,0 +1,188 @@
+/*
+ * wheel.c - Hierarchical timer wheel
+ *
+ * A deadline due in d ticks sits in level L, the lowest with d < 64^(L+1),
+ * in the slot its tick falls into at that level's granularity. Whenever the
+ * clock crosses the start of a level-L slot (all lower levels wrapped around
+ * to slot 0), the deadlines in it move down to where they belong from the
+ * new time. Level 0 slots fire.
+ *
+ * Between two calls the clock jumps over turns of level 0 that hold nothing,
+ * so a shard that slept for a minute does not walk 6000 empty ticks.
+ */
+
+#include "wheel.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_REACH ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) // ticks the top level covers
+
+static void link_deadline(timer_wheel_t* wheel, deadline_t* deadline)
+{
+	// Later than the top level reaches: wait in its farthest slot and get placed again from there
+	const uint64_t at = deadline->expires - wheel->now < WHEEL_REACH ? deadline->expires : wheel->now + WHEEL_REACH - 1;
+	const uint64_t delta = at - wheel->now;
+
+	int level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << (WHEEL_BITS * (level + 1)))
+	{
+		level++;
+	}
+	const unsigned index = (unsigned)(at >> (WHEEL_BITS * level)) & SLOT_MASK;
+
+	deadline_t** head = &wheel->slots[level][index];
+	deadline->next = *head;
+	if (*head)
+	{
+		(*head)->link = &deadline->next;
+	}
+	*head = deadline;
+	deadline->link = head;
+	deadline->wheel = wheel;
+	deadline->slot = (unsigned)level * WHEEL_SLOTS + index;
+	wheel->occupied[level] |= (uint64_t)1 << index;
+	wheel->count++;
+}
+
+void wheel_init(timer_wheel_t* wheel, const uint64_t now_ms)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now_ms / WHEEL_TICK_MS;
+}
+
+void wheel_arm(timer_wheel_t* wheel, deadline_t* deadline, const uint64_t expires_ms, void (*fire)(void* arg), void* arg)
+{
+	wheel_cancel(deadline);
+	deadline->fire = fire;
+	deadline->arg = arg;
+
+	// Rounded up, so it never fires early. Anything due already goes to the next tick,
+	// never into the slot wheel_advance() may be firing right now.
+	deadline->expires = (expires_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+	if (deadline->expires <= wheel->now)
+	{
+		deadline->expires = wheel->now + 1;
+	}
+	link_deadline(wheel, deadline);
+}
+
+void wheel_cancel(deadline_t* deadline)
+{
+	if (!deadline->link)
+	{
+		return;
+	}
+	timer_wheel_t* wheel = deadline->wheel;
+	*deadline->link = deadline->next;
+	if (deadline->next)
+	{
+		deadline->next->link = deadline->link;
+	}
+
+	const unsigned level = deadline->slot / WHEEL_SLOTS;
+	const unsigned index = deadline->slot & SLOT_MASK;
+	if (!wheel->slots[level][index])
+	{
+		wheel->occupied[level] &= ~((uint64_t)1 << index);
+	}
+	deadline->next = NULL;
+	deadline->link = NULL;
+	wheel->count--;
+}
+
+/*
+ * Moves the deadlines of a slot above level 0 down to the levels they belong in now.
+ */
+static void cascade(timer_wheel_t* wheel, const int level, const unsigned index)
+{
+	deadline_t* deadline;
+	while ((deadline = wheel->slots[level][index]))
+	{
+		wheel_cancel(deadline);
+		link_deadline(wheel, deadline);
+	}
+}
+
+void wheel_advance(timer_wheel_t* wheel, const uint64_t now_ms)
+{
+	const uint64_t target = now_ms / WHEEL_TICK_MS;
+	while (wheel->now <= target)
+	{
+		if (wheel->count == 0)
+		{
+			wheel->now = target + 1;
+			return;
+		}
+
+		const unsigned index = (unsigned)wheel->now & SLOT_MASK;
+		for (int level = 1; index == 0 && level < WHEEL_LEVELS; ++level)
+		{
+			const unsigned upper = (unsigned)(wheel->now >> (WHEEL_BITS * level)) & SLOT_MASK;
+			cascade(wheel, level, upper);
+			if (upper != 0)
+			{
+				break;
+			}
+		}
+
+		if (!(wheel->occupied[0] >> index))
+		{
+			// Nothing left in this turn of level 0, go straight to the next one
+			const uint64_t next_turn = (wheel->now | SLOT_MASK) + 1;
+			wheel->now = next_turn < target + 1 ? next_turn : target + 1;
+			continue;
+		}
+
+		// fire() may arm and cancel anything, so take one deadline at a time
+		deadline_t* deadline;
+		while ((deadline = wheel->slots[0][index]))
+		{
+			wheel_cancel(deadline);
+			if (deadline->expires > wheel->now)
+			{
+				link_deadline(wheel, deadline); // parked beyond the reach of the wheel
+				continue;
+			}
+			deadline->fire(deadline->arg);
+		}
+		wheel->now++;
+	}
+}
+
+int wheel_timeout(const timer_wheel_t* wheel, const uint64_t now_ms)
+{
+	if (wheel->count == 0)
+	{
+		return -1;
+	}
+
+	// Per level, the first occupied slot from the current one on, and the tick it fires or moves down at
+	uint64_t next = UINT64_MAX;
+	for (int level = 0; level < WHEEL_LEVELS; ++level)
+	{
+		const uint64_t bits = wheel->occupied[level];
+		if (!bits)
+		{
+			continue;
+		}
+		const int shift = WHEEL_BITS * level;
+		const uint64_t width = (uint64_t)1 << shift;
+		const uint64_t start = (wheel->now + width - 1) & ~(width - 1);
+		const unsigned index = (unsigned)(start >> shift) & SLOT_MASK;
+		const uint64_t rotated = index ? (bits >> index) | (bits << (WHEEL_SLOTS - index)) : bits;
+		const uint64_t tick = start + ((uint64_t)__builtin_ctzll(rotated) << shift);
+		if (tick < next)
+		{
+			next = tick;
+		}
+	}
+
+	const uint64_t due_ms = next * WHEEL_TICK_MS;
+	if (due_ms <= now_ms)
+	{
+		return 0;
+	}
+	return due_ms - now_ms > INT_MAX ? INT_MAX : (int)(due_ms - now_ms);
+}